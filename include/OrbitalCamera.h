@@ -26,6 +26,16 @@ public:
 	inline void setDistance(float distance)
 	{
 		m_distance = distance;
+		m_viewMat.reset();
+		m_projectionMat.reset();
+	}
+
+	// Fit the clip planes to a scene of this radius around the target, following the camera as it zooms, and
+	// zoom in proportion to the distance. 0 goes back to the fixed clip planes and zoom steps
+	inline void setSceneRadius(float radius)
+	{
+		m_sceneRadius = radius;
+		m_projectionMat.reset();
 	}
 
 	glm::mat4 getView() const
@@ -43,6 +53,11 @@ public:
 		m_projectionMat.reset();
 	}
 
+	inline float getFOV() const
+	{
+		return m_fov;
+	}
+
 	// Make sure to call this when the aspect ratio of the window changes
 	inline void setAspect(float aspect)
 	{
@@ -101,6 +116,9 @@ private:
 	// projection near and far clipping distances
 	float m_nearClip, m_farClip;
 
+	// radius of the scene around m_target the clip planes are fitted to, 0 to use the fixed ones
+	float m_sceneRadius;
+
 	// The actual projection matrix... mutable std::optional as above
 	mutable std::optional<const glm::mat4> m_projectionMat;
 };
\ No newline at end of file
@@ -8,15 +8,100 @@
 #include "GLUtils/VAO.h"
 
 #include "OrbitalCamera.h"
+#include "StreamingLoader.h"
+#include "cloud_stats.h"
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
 
 class PointCloudScene
 {
 public:
+	// How the point buffers are ordered after loading, which the fill draws ranges of in turn
+	enum class PointOrder
+	{
+		Unchanged, // file order, the fill shuffles through an index buffer instead
+		Shuffled,
+		MortonBlocks,
+		Hierarchical, // a point per cell of ever finer grids first, see point_order::hierarchical_order
+	};
+
+	// How loaded points are thinned out on the host before they're uploaded, see point_filter.h
+	enum class PointFilter
+	{
+		None,
+		Duplicates, // drop points at exactly the position of an earlier one
+		Voxels, // keep the first point in each voxel, with the average colour of them all
+	};
+
+	// Knobs for how loadPointCloud gets the points onto the GPU
+	struct LoadOptions
+	{
+		// allocate the GL buffers first and decode straight into mappings of them, keeping the peak host
+		// footprint to roughly the file itself, rather than decoding into host arrays and uploading those.
+		// Only for loads in file or shuffled order, the spatial point orders need the positions on the host
+		bool decodeIntoMappedBuffers = true;
+
+		// decode and upload the cloud in batches over the first frames, drawing whatever has arrived so far
+		bool streaming = false;
+		size_t streamBatchSize = 1 << 20; // points
+
+		// load from (and if need be, write) a pre-shuffled '.pcrc' cache next to the source file, see
+		// point_cache.h. A streamed load only uses a cache that already exists
+		bool useCache = true;
+
+		// read binary point records through a ring of staging buffers (io_uring where the kernel allows)
+		// rather than the mapping, overlapping disk reads with decoding. For files bigger than the page cache
+		bool pipelinedIO = false;
+		// open files O_DIRECT for pipelined reads, so a huge scan doesn't evict everything else
+		bool directIO = false;
+
+		// if set, also write the cloud out to this path as a compressed chunked file (see chunked_cloud.h),
+		// which loads with a fraction of the io of the source
+		std::string compressTo;
+
+		// thin the cloud as it's loaded, which always decodes through host arrays, so it skips the cache, and
+		// streaming, which needs every point at once. voxelSize is in the units of the file
+		PointFilter pointFilter = PointFilter::None;
+		float voxelSize = 0.001f;
+
+		// seed for the shuffled fill order, so runs can be reproduced. 0 draws a fresh one every load
+		uint64_t shuffleSeed = 0;
+
+		// reorder the point data itself as it's uploaded, so the fill draws contiguous ranges of the point
+		// buffers instead of gathering through a doubled buffer of shuffled indices. Saves 8 bytes of VRAM per
+		// point and fetches vertices in order, but point IDs then follow the new order. Points decoded straight
+		// into mapped buffers aren't on the host to shuffle, so those keep file order and the index buffer. MortonBlocks sorts the
+		// points along a Morton curve and shuffles blocks of orderBlockSize of them rather than single points,
+		// so each range the fill draws is made of compact patches that hit the same cache lines and pixels.
+		// Hierarchical puts the points in coarse to fine order, so the first frames of the fill are already
+		// spread evenly over the whole cloud
+		PointOrder pointOrder = PointOrder::Shuffled;
+		size_t orderBlockSize = 256;
+
+		// compute the fill order on the GPU, as a permutation of the vertex ID that's seeded afresh for every
+		// pass over the cloud, rather than storing one. Neither reorders the points nor keeps an index buffer
+		bool proceduralFill = false;
+
+		// most points of a '.pcro' level of detail octree (see octree_cloud.h) to keep on the GPU. The nodes are
+		// stored coarse to fine, so this keeps the coarsest levels whole and as much of the finer ones as fits
+		size_t octreePointBudget = 100000000;
+	};
+
 	PointCloudScene();
 
 	// ~PointCloudScene(); // let the compiler do it
 
-	bool loadPointCloud(const char* filepath);
+	bool loadPointCloud(const char* filepath, const LoadOptions& options);
+
+	// Load several files as one cloud, each of which may also be a directory of .ply/.las/.pcd tiles or a
+	// '.tiles' manifest listing one per line. Tiles are decoded concurrently into consecutive ranges of the
+	// point buffers, in the order given, so point IDs are stable from one load to the next and the shuffled
+	// fill spans the whole set
+	bool loadPointCloud(const std::vector<std::string>& filepaths, const LoadOptions& options);
 
 	void processEvent(const SDL_Event& event);
 
@@ -43,31 +128,254 @@ private:
 		GLuint num_groups_z;
 	};
 
+	// How the progressive render finds last frame's visible points to draw again
+	enum class Reprojection
+	{
+		BitsetScan, // set a bit per visible point, then compact the whole bitset, see element_comp.glsl
+		PixelDriven, // append each point straight from the ID texture, see reproject_comp.glsl
+	};
+
+	// What draws the points into the ID and depth textures
+	enum class PointRasterizer
+	{
+		GLPoints, // the raster pipeline, as sized discs
+		Compute, // a pixel per point with atomics, see points_comp.glsl
+	};
+
+	// Where the compute rasterizer gets each invocation's point from, matches the SOURCE_ defines in
+	// points_comp.glsl
+	enum class PointSource : GLuint
+	{
+		Range, // consecutive points
+		Indices, // a range of an index buffer
+		Ranges, // several ranges of points, one after the other
+		Procedural, // the procedural fill order
+	};
+
+	// A draw the compute rasterizer has queued for the end of the frame
+	struct PointDispatch
+	{
+		PointSource source;
+		GLuint first; // point, index or range
+		GLuint count; // points, at most for the reprojection
+		GLuint numRanges;
+		const GLUtils::Buffer* indices;
+		bool countFromCommand; // the reprojection, how many it has is only known on the GPU
+	};
+
+	// A node of a loaded octree, see octree_cloud::node_entry
+	struct OctreeNode
+	{
+		glm::vec3 boundsMin;
+		float size;
+		GLint firstPoint;
+		GLsizei pointCount;
+		GLuint firstChild; // children are consecutive, one for each bit of childMask
+		GLuint childMask; // only the children that are resident
+	};
+
 	bool initIndexFramebuffer(const unsigned int& width, const unsigned int& height);
 
+	// Gather the positions and colours out of the interleaved vertex element straight from a mapping of the
+	// file into the packed point buffers, or decode it into them if its types aren't the ones the shaders read
+	bool uploadMappedPointCloud(const char* filepath);
+
+	// Parse the file through tinyply into packed positions and colours, and upload those. Only used when the
+	// mapped path can't make sense of the file
+	bool uploadParsedPointCloud(const char* filepath);
+
+	// Open every tile, then decode them all concurrently into their ranges of the combined buffers, or stream
+	// them one after the other
+	bool loadTileSet(const std::vector<std::string>& tiles, bool& streaming);
+
+	// Decode a LiDAR .las, PCL .pcd or compressed chunked file into packed arrays, or straight into
+	// mappings of the point buffers
+	bool uploadDecodedPointCloud(const char* filepath);
+
+	// Decode the file through the batch reader openPointReader gives back, which for pipelined io reads the
+	// records into staging buffers rather than faulting in the mapping. Also how filtered loads read any format
+	bool uploadPipelinedPointCloud(const char* filepath);
+
+	// Decode 'count' points with 'decode', straight into mappings of the point buffers if that's enabled and
+	// works, into host arrays and uploaded from those otherwise. Filtered loads always go through host arrays
+	bool uploadWithDecoder(const char* filepath,
+		const size_t count,
+		const std::function<void(float*, uint8_t*)>& decode);
+
+	// Allocate the point buffers for 'count' points and have 'decode' write packed positions and colours
+	// straight into mappings of them, returns false if they couldn't be mapped or the decode threw
+	bool decodeIntoMappedBuffers(
+		const size_t count, const std::function<void(float*, uint8_t*)>& decode);
+
+	// Apply the load options' point filter to 'count' packed points in place, returns how many are left
+	size_t filterPoints(float* positions, uint8_t* colours, const size_t count);
+
+	// Upload 'count' packed float xyz positions and uchar rgb colours, gathered into 'order' on the way
+	void uploadPackedPoints(
+		const float* positions, const uint8_t* colours, const size_t count, const PointOrder order);
+
+	// Take the statistics the view is framed from over 'count' positions 'stride' bytes apart on the host
+	void summarisePoints(const void* positions, const size_t count, const size_t stride);
+
+	// The same from runs of points spread over the packed positions buffer, read back, for when the points
+	// were decoded straight into GPU memory and never were on the host
+	void summariseBufferSample(const size_t count);
+
+	// Centre, scale and orient the cloud from its statistics, and fit the camera, clip planes and point size
+	void frameCloud();
+
+	// Point the VAO and colour texture at packed positions and colours already in the point buffers
+	void bindPackedPoints(const size_t count);
+
+	// Point the colour texture at 'count' packed colours in the colour buffer, warning if the texture buffer
+	// can't hold them all
+	void attachColourTexture(const size_t count);
+
+	// Permute the rows of the point buffers into 'order', returns false (leaving them in their original
+	// order) if they couldn't be mapped. This reads the buffers back, so it's only for the GUI to reorder a
+	// cloud that's already loaded, loads put the points in order on the host as they upload them
+	bool reorderPoints(const PointOrder order);
+
+	// The permutation that puts 'count' points into 'order', from float xyz positions 'stride' bytes apart
+	std::vector<GLuint> pointPermutation(
+		const PointOrder order, const uint8_t* positions, const size_t stride, const size_t count) const;
+
+	// Whether 'order' is worked out from the positions, rather than drawn from the seed alone
+	static bool isSpatialOrder(const PointOrder order);
+
+	// The order a full load puts the points in as it uploads them, if they're on the host to begin with. A
+	// streamed cloud arrives in file order over many frames, so it never gets one, and keeps the shuffled index
+	// buffer instead, as does a shuffled load decoded straight into the point buffers
+	PointOrder uploadOrder() const;
+
+	// Allocate the buffer bound to 'target' for 'count' rows of 'rowBytes', the i'th the start of the source row
+	// permutation[i] (or i without one) of 'rows', each 'stride' bytes apart
+	void gatherIntoBuffer(const GLenum target,
+		const uint8_t* rows,
+		const size_t stride,
+		const size_t rowBytes,
+		const GLuint* permutation,
+		const size_t count);
+
+	// The seed the options ask for, or a fresh random one
+	uint64_t shuffleSeed() const;
+
+	// Allocate the visibility, element and shuffled index buffers for m_numPointsTotal points, the last only
+	// if the points aren't already in shuffled order
+	void allocateRenderBuffers();
+
+	// Allocate the visibility bitset, with a second half for the last cycle when the visibility pass is
+	// subsampled, and clear it to nothing visible
+	void allocateVisibilityBuffer();
+
+	// Set how many points (from the start of the point buffers) are ready to draw, and size the element
+	// pass to match
+	void setLoadedPointCount(const GLuint count);
+
+	// Return the path of an up to date cache for 'filepath', writing one first if allowed to. Returns an
+	// empty string if there's no cache to load from
+	std::string findPointCache(const char* filepath, const bool allowWrite);
+
+	// Write the points in 'filepath' out as a compressed chunked file at 'outputPath', reporting any failure
+	void writeChunkedPointCloud(const char* filepath, const std::string& outputPath);
+
+	// Upload the already packed and shuffled points from a mapping of a cache file
+	bool uploadCachedPointCloud(const char* cachePath);
+
+	// Upload the coarsest nodes of an octree file that fit the point budget straight from a mapping of it, and
+	// keep their bounds and point ranges for choosing what to draw each frame
+	bool uploadOctreePointCloud(const char* filepath);
+
+	// Pick the resident octree nodes to draw from this frame: those in the view frustum whose parents all
+	// project bigger than the LOD threshold, as ranges of the point buffers
+	void selectOctreeNodes(const glm::mat4& view);
+
+	// Open a batch reader over a ply, las, pcd or chunked file with the load options' io settings, setting
+	// 'count' to its total number of points. Throws if the file can't be decoded, see point_readers.h
+	StreamingLoader::ReadFunction openPointReader(const char* filepath, size_t& count);
+
+	// Allocate the point buffers and kick off a StreamingLoader to fill them from a point or cache file,
+	// returns false if the file can't be streamed
+	bool startStreamingLoad(const char* filepath, const bool fromCache);
+
+	// Allocate the point buffers for 'count' points and kick off a StreamingLoader to fill them from 'read'
+	void streamPoints(const size_t count, StreamingLoader::ReadFunction read);
+
+	// Allocate the render buffers once the points are (or are being) loaded, and report
+	void finishLoad(const bool streaming);
+
+	// Upload any batches the StreamingLoader has finished since the last frame
+	void updateStreamingLoad();
+
+	// Draw 'count' points from 'first', several ranges of points, a range of the shuffled indices or the points
+	// the visibility passes found, with the selected rasterizer. The compute rasterizer only queues them, until
+	// rasterizeQueuedPoints takes the whole frame's at once
+	void drawPointRange(const GLint first, const GLsizei count);
+	void drawPointRanges(const std::vector<GLint>& firsts, const std::vector<GLsizei>& counts);
+	void drawShuffledPoints(const GLuint first, const GLsizei count);
+	void drawReprojectedPoints();
+
+	// Rasterize the compute draws queued this frame, and resolve them into the bound ID framebuffer. Without 64
+	// bit atomics every draw's depths have to be in before any of its IDs can be, so each is dispatched twice
+	void rasterizeQueuedPoints();
+
 	const GLUtils::Framebuffer m_idFBO;
 
 	const GLUtils::Texture m_idTexture, m_depthTexture, m_colourTexture;
 
-	const GLUtils::ShaderProgram m_visComputeShader, m_elementComputeShader, m_pointsShader,
-		m_outputShader;
+	const GLUtils::ShaderProgram m_visComputeShader, m_elementComputeShader, m_reprojectComputeShader,
+		m_pointsShader, m_outputShader, m_pointsComputeShader, m_resolveShader;
 
 	const GLUtils::VAO m_pointCloudVAO;
 
-	const glm::mat4 m_modelMat; // Model matrix to roughly center and orient the point cloud...
+	glm::mat4 m_modelMat; // Model matrix to center, scale and orient the point cloud, see frameCloud
+	cloud_stats::summary m_cloudStats;
 
 	const GLUtils::Buffer m_pointsBuffer, m_colBuffer, m_visBuffer, m_elementBuffer,
-		m_shuffledBuffer, m_indirectElementsBuffer, m_indirectComputeBuffer;
+		m_shuffledBuffer, m_indirectElementsBuffer, m_indirectComputeBuffer, m_pixelBuffer,
+		m_pointRangesBuffer;
 
 	OrbitalCamera m_camera;
 
-	GLuint m_computeDispatchCount;
-	GLuint m_computeGroupCount;
+	LoadOptions m_loadOptions;
+
+	GLuint m_computeDispatchCount; // element compute workgroups in x
+	GLuint m_computeGroupCount; // and in y, to fit more than the x limit
+	GLuint m_maxComputeGroupCount; // per dimension
 	GLuint m_numPointsVisible;
 	GLuint m_numPointsTotal;
+	GLuint m_numPointsLoaded; // less than m_numPointsTotal whilst streaming
 
 	bool m_doProgressive, m_doShuffle;
+	Reprojection m_reprojection;
+	GLuint m_visibilitySampling; // the visibility pass reads a pixel of every block this many pixels across
+	GLuint m_visibilityFrame; // which pixel of the blocks it reads, and which half of the bitset it sets
+	GLuint m_visibilityWords; // in each half of the bitset
+	PointRasterizer m_rasterizer;
+	const bool m_hasAtomicInt64; // points_comp.glsl can rasterize in one pass
+	bool m_pointsPreshuffled; // storage order is already random, so the fill can draw it in order
+	int m_guiPointOrder; // the order the GUI would reorder the points into, indexes PointOrder less Unchanged
+	bool m_hasShuffledIndices; // m_shuffledBuffer has been filled
+	bool m_doProceduralFill;
 	unsigned int m_fillStartIndex;
+	GLuint m_fillCycle; // passes the fill has made over the cloud, each one has its own procedural order
+	uint64_t m_fillSeed;
 	float m_fillRate;
 	float m_pointSize;
+
+	std::vector<OctreeNode> m_octreeNodes; // the resident ones, empty unless an octree is loaded
+	std::vector<GLint> m_lodFirsts; // point ranges of the selected nodes
+	std::vector<GLsizei> m_lodCounts;
+	std::vector<GLint> m_fillFirsts; // what the fill draws of them this frame
+	std::vector<GLsizei> m_fillCounts;
+	GLuint m_lodPointCount; // points in the selected nodes
+	float m_lodThreshold; // projected size in pixels a node must exceed for its children to be drawn
+	float m_lodFillPhase; // how far through each selected node the fill has got, as a fraction of it
+	unsigned int m_viewportWidth, m_viewportHeight;
+
+	std::vector<PointDispatch> m_pointDispatches; // queued for the compute rasterizer this frame
+	std::vector<GLuint> m_pointRanges; // their ranges, pairs of first point and end in the dispatch
+
+	std::unique_ptr<StreamingLoader> m_streamingLoader;
+	std::chrono::steady_clock::time_point m_streamStartTime;
 };
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs a point reader on a background thread, queueing up batches of packed positions and colours for the
+// render thread to upload as they arrive. The queue is bounded, so only a few batches are ever held on the host
+
+class StreamingLoader
+{
+public:
+	struct Batch
+	{
+		size_t first = 0; // index of the first point in the batch
+		size_t count = 0;
+		std::vector<float> positions; // packed xyz
+		std::vector<uint8_t> colours; // packed rgb
+	};
+
+	// Reads up to 'maxCount' more points into the given arrays, returning how many it read, or 0 once it's
+	// exhausted. Called from the loader thread only
+	typedef std::function<size_t(size_t maxCount, float* positions, uint8_t* colours)> ReadFunction;
+
+	StreamingLoader(ReadFunction read, size_t batchSize, size_t maxQueuedBatches);
+
+	// Stops the reader after its current batch and joins it
+	~StreamingLoader();
+
+	// Disable copy constructor and assignment operator, the loader thread holds a pointer to this
+	StreamingLoader(const StreamingLoader&) = delete;
+	StreamingLoader& operator=(const StreamingLoader&) = delete;
+	// ...and move constructor, move assignment
+	StreamingLoader(StreamingLoader&&) = delete;
+	StreamingLoader& operator=(StreamingLoader&&) = delete;
+
+	// Take the oldest decoded batch if there is one, never blocks
+	bool tryPop(Batch& batch);
+
+	// Hand a popped batch's storage back so the reader can reuse its allocations
+	void recycle(Batch&& batch);
+
+	// True once the reader is exhausted (or failed) and every batch has been popped
+	bool isFinished() const;
+
+private:
+	void run();
+
+	const ReadFunction m_read;
+	const size_t m_batchSize;
+	const size_t m_maxQueuedBatches;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_spaceAvailable;
+	std::deque<Batch> m_ready;
+	std::vector<Batch> m_spare;
+	bool m_readerDone;
+	bool m_stopRequested;
+
+	// last, so everything above is constructed before the thread starts
+	std::thread m_thread;
+};
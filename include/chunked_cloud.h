@@ -0,0 +1,600 @@
+#ifndef CHUNKED_CLOUD_H
+#define CHUNKED_CLOUD_H
+
+#include "cloud_stats.h"
+#include "ply_utils.h"
+#include "point_format.h"
+#include "point_order.h"
+
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include <cstdio>
+
+// A compressed, chunked point format for archiving clouds and loading them with less io. The points are Morton
+// sorted and cut into chunks of consecutive points, so each chunk covers a small, compact region. Within a chunk,
+// positions are quantised to 'position_bits' per axis relative to the chunk's own bounds, and colours are kept as
+// they are. Each of those six channels is delta coded against the previous point (neighbours in Morton order are
+// close in space and usually in colour) and the deltas are entropy coded with an adaptive binary range coder:
+// a colour delta is coded a bit at a time through a tree of probabilities per channel, a position delta is
+// zigzag mapped and coded as its bit length through a tree per axis, followed by the bits below its leading one
+// as they are. Chunks are independent, so they decode in parallel straight into the destination arrays.
+//
+// The file is a fixed header, the chunk data, then a table with an entry per chunk. Integers and floats are
+// native (little) endian. Points decode in chunk order, so the first point of a chunk is the sum of the point
+// counts before it in the table.
+
+namespace chunked_cloud
+{
+	constexpr char magic[8] = { 'P', 'C', 'R', 'C', 'H', 'U', 'N', 'K' };
+	constexpr uint32_t current_version = 2;
+	constexpr uint32_t channel_count = 6; // x, y, z, r, g, b
+
+	struct header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t position_bits;
+		uint64_t point_count;
+		uint64_t chunk_count;
+		float bounds_min[3];
+		float bounds_max[3];
+		uint64_t table_offset; // chunk_count chunk_entry's
+	};
+	static_assert(sizeof(header) == 64, "chunked header layout changed, bump current_version");
+
+	struct chunk_entry
+	{
+		uint64_t data_offset;
+		uint32_t data_size; // bytes
+		uint32_t point_count;
+		float origin[3]; // a position decodes as origin + q * scale per axis
+		float scale[3];
+	};
+	static_assert(sizeof(chunk_entry) == 40, "chunk table layout changed, bump current_version");
+
+	struct write_options
+	{
+		uint32_t chunk_size {1 << 16};  // points
+		uint32_t position_bits {16};    // quantisation per axis within a chunk, at most 24
+		uint32_t batch_size {1 << 22};  // points a streamed write sorts and encodes at a time, rounded up to whole chunks
+	};
+
+	struct mapped_chunked
+	{
+		std::shared_ptr<ply_utils::mapped_file> file;
+		header hdr;
+		const chunk_entry * chunks {nullptr};
+		std::vector<uint64_t> first_point; // chunk_count + 1 prefix sums of the chunk point counts
+	};
+
+	namespace detail
+	{
+		inline uint32_t zigzag(const int32_t v) { return (uint32_t(v) << 1) ^ uint32_t(v >> 31); }
+		inline int32_t unzigzag(const uint32_t v) { return int32_t(v >> 1) ^ -int32_t(v & 1); }
+
+		inline uint32_t bit_width(const uint32_t v) { return v ? 32 - __builtin_clz(v) : 0; }
+
+		// Probabilities are 11 bit estimates that the next bit is a 0, adapting by 1/32 of the error per bit
+		constexpr uint32_t probability_bits = 11;
+		constexpr uint32_t adapt_shift = 5;
+		constexpr uint32_t range_top = uint32_t(1) << 24;
+
+		// A carry-less range coder over adaptive binary probabilities, in the style of LZMA's
+		class range_encoder
+		{
+			std::vector<uint8_t> & out;
+			uint64_t low {0};
+			uint32_t range {0xFFFFFFFF};
+			uint8_t cache {0};
+			uint64_t cache_size {1};
+
+			void shift_low()
+			{
+				// a byte can only be written once a carry out of 'low' can no longer reach it
+				if (uint32_t(low) < 0xFF000000u || (low >> 32) != 0)
+				{
+					const uint8_t carry = uint8_t(low >> 32);
+					uint8_t pending = cache;
+					do
+					{
+						out.push_back(uint8_t(pending + carry));
+						pending = 0xFF;
+					} while (--cache_size != 0);
+					cache = uint8_t(low >> 24);
+				}
+				++cache_size;
+				low = (low & 0x00FFFFFF) << 8;
+			}
+
+			void normalise()
+			{
+				while (range < range_top)
+				{
+					range <<= 8;
+					shift_low();
+				}
+			}
+
+		public:
+			explicit range_encoder(std::vector<uint8_t> & output) : out(output) {}
+
+			void encode_bit(uint16_t & probability, const uint32_t bit)
+			{
+				const uint32_t bound = (range >> probability_bits) * probability;
+				if (bit == 0)
+				{
+					range = bound;
+					probability += ((1 << probability_bits) - probability) >> adapt_shift;
+				}
+				else
+				{
+					low += bound;
+					range -= bound;
+					probability -= probability >> adapt_shift;
+				}
+				normalise();
+			}
+
+			// 'count' low bits of 'value' at even odds, msb first
+			void encode_direct(const uint32_t value, const uint32_t count)
+			{
+				for (uint32_t i = count; i-- > 0;)
+				{
+					range >>= 1;
+					if ((value >> i) & 1) low += range;
+					normalise();
+				}
+			}
+
+			void flush()
+			{
+				for (int i = 0; i < 5; ++i) shift_low();
+			}
+		};
+
+		class range_decoder
+		{
+			const uint8_t * data;
+			const uint8_t * const end;
+			uint32_t range {0xFFFFFFFF};
+			uint32_t code {0};
+			size_t overrun {0}; // bytes read past the end, which decode as zeroes
+
+			uint8_t next_byte()
+			{
+				if (data < end) return *data++;
+				++overrun;
+				return 0;
+			}
+
+			void normalise()
+			{
+				if (range < range_top)
+				{
+					range <<= 8;
+					code = (code << 8) | next_byte();
+				}
+			}
+
+		public:
+			range_decoder(const uint8_t * begin, const size_t size) : data(begin), end(begin + size)
+			{
+				for (int i = 0; i < 5; ++i) code = (code << 8) | next_byte();
+			}
+
+			// The encoder flushes everything the decoder needs, so reading past the end means the data is malformed
+			bool overran() const { return overrun > 0; }
+
+			uint32_t decode_bit(uint16_t & probability)
+			{
+				const uint32_t bound = (range >> probability_bits) * probability;
+				uint32_t bit;
+				if (code < bound)
+				{
+					range = bound;
+					probability += ((1 << probability_bits) - probability) >> adapt_shift;
+					bit = 0;
+				}
+				else
+				{
+					code -= bound;
+					range -= bound;
+					probability -= probability >> adapt_shift;
+					bit = 1;
+				}
+				normalise();
+				return bit;
+			}
+
+			uint32_t decode_direct(const uint32_t count)
+			{
+				uint32_t value = 0;
+				for (uint32_t i = 0; i < count; ++i)
+				{
+					range >>= 1;
+					const uint32_t bit = code >= range;
+					code -= range & (0 - bit);
+					value = (value << 1) | bit;
+					normalise();
+				}
+				return value;
+			}
+		};
+
+		// Adaptive probabilities for 'bits' bit symbols, one per node of a binary tree walked msb first
+		template <uint32_t bits>
+		struct bit_tree
+		{
+			uint16_t probabilities[1 << bits];
+
+			bit_tree() { std::fill_n(probabilities, 1 << bits, uint16_t(1 << (probability_bits - 1))); }
+
+			void encode(range_encoder & encoder, const uint32_t symbol)
+			{
+				for (uint32_t node = 1, i = bits; i-- > 0;)
+				{
+					const uint32_t bit = (symbol >> i) & 1;
+					encoder.encode_bit(probabilities[node], bit);
+					node = (node << 1) | bit;
+				}
+			}
+
+			uint32_t decode(range_decoder & decoder)
+			{
+				uint32_t node = 1;
+				for (uint32_t i = 0; i < bits; ++i) node = (node << 1) | decoder.decode_bit(probabilities[node]);
+				return node - (1 << bits);
+			}
+		};
+
+		// The adaptive models of a chunk, which start over for every chunk so chunks decode independently
+		struct chunk_models
+		{
+			bit_tree<5> position_widths[3]; // bit length of each axis' zigzagged delta, at most 25
+			bit_tree<8> colour_deltas[3];   // each colour channel's delta, mod 256
+		};
+
+		// Encode 'count' packed points (already Morton sorted) as one chunk into 'out', filling in 'entry' apart
+		// from its data_offset
+		inline void encode_chunk(const float * positions, const uint8_t * colours, const size_t count, const uint32_t position_bits,
+			chunk_entry & entry, std::vector<uint8_t> & out)
+		{
+			float chunk_min[3], chunk_max[3];
+			cloud_stats::bounds(positions, count, chunk_min, chunk_max);
+
+			const float max_q = float((uint32_t(1) << position_bits) - 1);
+			entry.point_count = uint32_t(count);
+			for (size_t k = 0; k < 3; ++k)
+			{
+				entry.origin[k] = chunk_min[k];
+				entry.scale[k] = (chunk_max[k] > chunk_min[k]) ? (chunk_max[k] - chunk_min[k]) / max_q : 0.f;
+			}
+
+			out.clear();
+			range_encoder encoder(out);
+			chunk_models models;
+			int32_t previous[channel_count] = {};
+			for (size_t i = 0; i < count; ++i)
+			{
+				for (size_t k = 0; k < 3; ++k)
+				{
+					// fmax/fmin take a NaN coordinate to the chunk's origin
+					const float q = entry.scale[k] > 0.f ? std::round((positions[3 * i + k] - entry.origin[k]) / entry.scale[k]) : 0.f;
+					const int32_t current = int32_t(std::fmin(std::fmax(q, 0.f), max_q));
+					const uint32_t delta = zigzag(current - previous[k]);
+					const uint32_t width = bit_width(delta);
+					models.position_widths[k].encode(encoder, width);
+					if (width > 1) encoder.encode_direct(delta, width - 1);
+					previous[k] = current;
+				}
+				for (size_t k = 0; k < 3; ++k)
+				{
+					const int32_t current = colours[3 * i + k];
+					models.colour_deltas[k].encode(encoder, uint8_t(current - previous[3 + k]));
+					previous[3 + k] = current;
+				}
+			}
+			encoder.flush();
+			entry.data_size = uint32_t(out.size());
+		}
+
+		// Decode one chunk into packed positions and colours, returns false if its data is malformed
+		inline bool decode_chunk(const chunk_entry & entry, const uint8_t * data, float * positions, uint8_t * colours)
+		{
+			range_decoder decoder(data, entry.data_size);
+			chunk_models models;
+			int32_t previous[channel_count] = {};
+			for (size_t i = 0; i < entry.point_count; ++i)
+			{
+				for (size_t k = 0; k < 3; ++k)
+				{
+					const uint32_t width = models.position_widths[k].decode(decoder);
+					if (width > 25) return false;
+					const uint32_t delta = width > 1 ? ((uint32_t(1) << (width - 1)) | decoder.decode_direct(width - 1)) : width;
+					previous[k] = int32_t(uint32_t(previous[k]) + uint32_t(unzigzag(delta)));
+					positions[3 * i + k] = entry.origin[k] + float(previous[k]) * entry.scale[k];
+				}
+				for (size_t k = 0; k < 3; ++k)
+				{
+					previous[3 + k] = uint8_t(previous[3 + k] + models.colour_deltas[k].decode(decoder));
+					colours[3 * i + k] = uint8_t(previous[3 + k]);
+				}
+			}
+			return !decoder.overran();
+		}
+	}
+
+	inline bool is_chunked_file(const std::string & path)
+	{
+		return point_format::has_magic(path, magic, sizeof(magic));
+	}
+
+	// Map a chunked file and validate its header and chunk table, throws if it isn't usable
+	inline mapped_chunked map_chunked_file(const std::string & path)
+	{
+		mapped_chunked chunked;
+		chunked.file = std::make_shared<ply_utils::mapped_file>(path);
+		const uint8_t * data = chunked.file->data();
+		const size_t size = chunked.file->size();
+		if (size < sizeof(header) || !point_format::has_magic(data, size, magic, sizeof(magic))) throw std::runtime_error(path + " isn't a chunked point file");
+
+		header & hdr = chunked.hdr;
+		std::memcpy(&hdr, data, sizeof(header));
+		if (hdr.version != current_version) throw std::runtime_error(path + " has chunked version " + std::to_string(hdr.version) + ", expected " + std::to_string(current_version));
+		if (hdr.table_offset % alignof(chunk_entry) || hdr.table_offset > size || hdr.chunk_count > (size - hdr.table_offset) / sizeof(chunk_entry))
+			throw std::runtime_error(path + " has a truncated chunk table");
+
+		chunked.chunks = reinterpret_cast<const chunk_entry*>(data + hdr.table_offset);
+		chunked.first_point.resize(hdr.chunk_count + 1, 0);
+		for (size_t c = 0; c < hdr.chunk_count; ++c)
+		{
+			const chunk_entry & entry = chunked.chunks[c];
+			if (entry.data_offset > size || entry.data_size > size - entry.data_offset)
+				throw std::runtime_error(path + " has chunk " + std::to_string(c) + " outside the file");
+			chunked.first_point[c + 1] = chunked.first_point[c] + entry.point_count;
+		}
+		if (chunked.first_point.back() != hdr.point_count) throw std::runtime_error(path + " has chunks that don't add up to its point count");
+
+		std::cout << "\t[chunked_header] " << hdr.point_count << " points in " << hdr.chunk_count << " chunks, "
+			<< (size / std::max(1.0, double(hdr.point_count))) << " bytes per point" << std::endl;
+		return chunked;
+	}
+
+	// Decode chunks [first_chunk, first_chunk + count) into packed arrays, one chunk per task across all cores
+	inline void decode_chunks(const mapped_chunked & chunked, const size_t first_chunk, const size_t count, float * positions, uint8_t * colours)
+	{
+		const uint64_t base = chunked.first_point[first_chunk];
+		std::atomic<bool> malformed {false};
+		parallel_utils::parallel_tasks(count, [&](const size_t i)
+		{
+			const chunk_entry & entry = chunked.chunks[first_chunk + i];
+			const uint64_t first = chunked.first_point[first_chunk + i] - base;
+			if (!detail::decode_chunk(entry, chunked.file->data() + entry.data_offset, positions + 3 * first, colours + 3 * first))
+				malformed = true;
+		});
+		if (malformed) throw std::runtime_error("malformed chunk data");
+	}
+
+	inline void decode_points(const mapped_chunked & chunked, float * positions, uint8_t * colours)
+	{
+		ply_utils::manual_timer decode_timer;
+		decode_timer.start();
+		decode_chunks(chunked, 0, chunked.hdr.chunk_count, positions, colours);
+		decode_timer.stop();
+
+		const float size_mb = chunked.file->size() * float(1e-6);
+		const float decode_time = decode_timer.get() / 1000.f;
+		std::cout << "\tdecoding " << size_mb << "mb in " << decode_time << " seconds [" << (size_mb / decode_time) << " MBps] on "
+			<< std::min<size_t>(parallel_utils::thread_count(), chunked.hdr.chunk_count) << " threads" << std::endl;
+	}
+
+	// Decodes a mapped chunked file a batch of points at a time. Batches are made of whole chunks where they fit,
+	// a chunk that doesn't is decoded to a staging buffer and handed out from there
+	class point_batch_reader
+	{
+		mapped_chunked chunked;
+		size_t next_chunk {0};
+		size_t next_row {0};
+		std::vector<float> staged_positions;
+		std::vector<uint8_t> staged_colours;
+		size_t staged_first {0}, staged_count {0}; // rows still to hand out from the staging buffers
+
+	public:
+		explicit point_batch_reader(mapped_chunked mapped) : chunked(std::move(mapped)) {}
+
+		size_t total_rows() const { return chunked.hdr.point_count; }
+		size_t rows_read() const { return next_row; }
+
+		// Decode up to 'max_rows' of the remaining points, returns how many were written (0 once done)
+		size_t read(const size_t max_rows, float * positions, uint8_t * colours)
+		{
+			if (staged_count == 0)
+			{
+				// as many whole chunks as fit go straight into the destination
+				size_t last_chunk = next_chunk;
+				while (last_chunk < chunked.hdr.chunk_count && chunked.first_point[last_chunk + 1] - chunked.first_point[next_chunk] <= max_rows) ++last_chunk;
+				if (last_chunk > next_chunk)
+				{
+					decode_chunks(chunked, next_chunk, last_chunk - next_chunk, positions, colours);
+					const size_t count = chunked.first_point[last_chunk] - chunked.first_point[next_chunk];
+					next_chunk = last_chunk;
+					next_row += count;
+					return count;
+				}
+				if (next_chunk == chunked.hdr.chunk_count) return 0;
+
+				staged_count = chunked.chunks[next_chunk].point_count;
+				staged_first = 0;
+				staged_positions.resize(3 * staged_count);
+				staged_colours.resize(3 * staged_count);
+				decode_chunks(chunked, next_chunk++, 1, staged_positions.data(), staged_colours.data());
+			}
+
+			const size_t count = std::min(max_rows, staged_count);
+			std::copy_n(staged_positions.data() + 3 * staged_first, 3 * count, positions);
+			std::copy_n(staged_colours.data() + 3 * staged_first, 3 * count, colours);
+			staged_first += count;
+			staged_count -= count;
+			next_row += count;
+			return count;
+		}
+	};
+
+	namespace detail
+	{
+		// Writes a chunked file a batch of points at a time to a temporary path, which commit() renames into place.
+		// Chunk data goes out as each batch is encoded, the table and the header once every batch is in
+		class chunk_writer
+		{
+			const std::string path;
+			const std::string temp_path;
+			const write_options options;
+			std::ofstream out;
+			header hdr = {};
+			std::vector<chunk_entry> table;
+			uint64_t offset {sizeof(header)};
+			ply_utils::manual_timer write_timer;
+			bool committed {false};
+
+		public:
+			chunk_writer(const std::string & output_path, const write_options & write) : path(output_path), temp_path(output_path + ".tmp"), options(write)
+			{
+				if (options.chunk_size == 0 || options.position_bits == 0 || options.position_bits > 24) throw std::runtime_error("invalid chunked write options");
+				write_timer.start();
+
+				std::memcpy(hdr.magic, magic, sizeof(magic));
+				hdr.version = current_version;
+				hdr.position_bits = options.position_bits;
+				std::fill_n(hdr.bounds_min, 3, INFINITY);
+				std::fill_n(hdr.bounds_max, 3, -INFINITY);
+
+				// a placeholder, the header is written again once the counts and bounds are known
+				out.open(temp_path, std::ios::binary | std::ios::trunc);
+				out.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+				if (!out) throw std::runtime_error("could not write " + temp_path);
+			}
+
+			~chunk_writer()
+			{
+				if (!committed)
+				{
+					out.close();
+					::unlink(temp_path.c_str());
+				}
+			}
+
+			// Morton sort 'count' packed points over their own bounds, then encode them as chunks in parallel and
+			// append those to the file
+			void write_batch(const float * positions, const uint8_t * colours, const size_t count)
+			{
+				if (count > UINT32_MAX) throw std::runtime_error("too many points for one chunked batch");
+
+				float batch_min[3], batch_max[3];
+				cloud_stats::bounds(positions, count, batch_min, batch_max);
+				for (size_t k = 0; k < 3; ++k)
+				{
+					hdr.bounds_min[k] = std::min(hdr.bounds_min[k], batch_min[k]);
+					hdr.bounds_max[k] = std::max(hdr.bounds_max[k], batch_max[k]);
+				}
+
+				// sort by a 63 bit Morton code over the batch's bounds, so each run of chunk_size points is compact
+				std::vector<uint64_t> codes;
+				const std::vector<uint32_t> order = point_order::morton_order(positions, count, codes);
+				codes = {};
+
+				const size_t chunk_count = (count + options.chunk_size - 1) / options.chunk_size;
+				const size_t first_chunk = table.size();
+				table.resize(first_chunk + chunk_count);
+				std::vector<std::vector<uint8_t>> encoded(chunk_count);
+				parallel_utils::parallel_tasks(chunk_count, [&](const size_t c)
+				{
+					// gather the chunk's points, so it's encoded from contiguous arrays
+					const size_t first = c * options.chunk_size;
+					const size_t n = std::min<size_t>(options.chunk_size, count - first);
+					std::vector<float> chunk_positions(3 * n);
+					std::vector<uint8_t> chunk_colours(3 * n);
+					for (size_t i = 0; i < n; ++i)
+					{
+						const uint32_t p = order[first + i];
+						std::copy_n(positions + 3 * size_t(p), 3, chunk_positions.data() + 3 * i);
+						std::copy_n(colours + 3 * size_t(p), 3, chunk_colours.data() + 3 * i);
+					}
+					encode_chunk(chunk_positions.data(), chunk_colours.data(), n, options.position_bits, table[first_chunk + c], encoded[c]);
+				});
+
+				for (size_t c = 0; c < chunk_count; ++c)
+				{
+					table[first_chunk + c].data_offset = offset;
+					offset += encoded[c].size();
+					out.write(reinterpret_cast<const char*>(encoded[c].data()), encoded[c].size());
+				}
+				hdr.point_count += count;
+				if (!out) throw std::runtime_error("could not write " + temp_path);
+			}
+
+			// Write the chunk table and the final header, and move the file into place
+			void commit()
+			{
+				// the table is aligned after the chunk data, so it can be used in place from a mapping
+				const char zeroes[alignof(chunk_entry)] = {};
+				const uint64_t padding = (alignof(chunk_entry) - offset % alignof(chunk_entry)) % alignof(chunk_entry);
+				out.write(zeroes, padding);
+				hdr.chunk_count = table.size();
+				hdr.table_offset = offset + padding;
+				out.write(reinterpret_cast<const char*>(table.data()), sizeof(chunk_entry) * table.size());
+				out.seekp(0);
+				out.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+				out.close();
+				if (!out) throw std::runtime_error("could not write " + temp_path);
+				if (std::rename(temp_path.c_str(), path.c_str()) != 0) throw std::runtime_error("could not move the chunked file into place at " + path);
+				committed = true;
+
+				write_timer.stop();
+				const uint64_t size = hdr.table_offset + sizeof(chunk_entry) * table.size();
+				const float size_mb = size * float(1e-6);
+				const float write_time = write_timer.get() / 1000.f;
+				std::cout << "\twriting " << size_mb << "mb chunked file " << path << " in " << write_time << " seconds [" << (double(size) / std::max<uint64_t>(hdr.point_count, 1))
+					<< " bytes per point, " << (15.0 * hdr.point_count / size) << "x smaller than packed]" << std::endl;
+			}
+		};
+	}
+
+	// Compress 'count' packed points already in memory into a chunked file at 'path', Morton sorted over the
+	// whole cloud. Chunks are encoded in parallel, and the file is written to a temporary path and renamed into place
+	inline void write_chunked(const std::string & path, const uint64_t count, const float * positions, const uint8_t * colours,
+		const write_options & options = write_options())
+	{
+		detail::chunk_writer writer(path, options);
+		writer.write_batch(positions, colours, count);
+		writer.commit();
+	}
+
+	// Compress the 'count' points produced by 'read' into a chunked file at 'path', holding one batch of
+	// options.batch_size points at a time. Each batch is Morton sorted on its own, so when the source isn't already
+	// spatially ordered a batch's chunks each cover more of the cloud, costing some precision and colour coherence
+	inline void write_chunked(const std::string & path, const uint64_t count, const point_format::read_function & read, const write_options & options = write_options())
+	{
+		detail::chunk_writer writer(path, options);
+		const size_t chunk_size = std::max<size_t>(options.chunk_size, 1);
+		const size_t batch_size = std::max<size_t>(1, (size_t(options.batch_size) + chunk_size - 1) / chunk_size) * chunk_size;
+		std::vector<float> positions(3 * std::min<uint64_t>(count, batch_size));
+		std::vector<uint8_t> colours(3 * std::min<uint64_t>(count, batch_size));
+		for (uint64_t first = 0; first < count;)
+		{
+			const size_t batch = std::min<uint64_t>(count - first, batch_size);
+			for (size_t filled = 0, n = 0; filled < batch; filled += n)
+			{
+				n = read(batch - filled, positions.data() + 3 * filled, colours.data() + 3 * filled);
+				if (n == 0) throw std::runtime_error("ran out of points after " + std::to_string(first + filled));
+			}
+			writer.write_batch(positions.data(), colours.data(), batch);
+			first += batch;
+		}
+		writer.commit();
+	}
+}
+
+#endif // CHUNKED_CLOUD_H
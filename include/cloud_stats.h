@@ -0,0 +1,249 @@
+#pragma once
+
+#include "parallel_utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Summary statistics of a point cloud's positions, cheap enough to take on every load: the exact bounds and
+// centroid from one vectorised pass over every point across all cores, then robust extents and an estimate of
+// the point spacing from an evenly spread sample of a quarter of a million of them
+
+namespace cloud_stats
+{
+struct summary
+{
+	size_t count = 0;
+	float bounds_min[3] = {0.f, 0.f, 0.f};
+	float bounds_max[3] = {0.f, 0.f, 0.f};
+	double centroid[3] = {0.0, 0.0, 0.0};
+	// the 0.5th and 99.5th percentiles on each axis, which stray outliers don't drag out
+	float robust_min[3] = {0.f, 0.f, 0.f};
+	float robust_max[3] = {0.f, 0.f, 0.f};
+	// mean distance from a point to its neighbours, treating the cloud as a scanned surface
+	float spacing = 0.f;
+};
+
+constexpr size_t default_sample_size = 1 << 18;
+
+namespace detail
+{
+inline float load_float(const uint8_t* p)
+{
+	float v;
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+// Bounds and sum of packed positions. Four points are twelve floats, which the compiler keeps in lanes of
+// their own, and sums are taken in float over short blocks then carried in double so a billion points don't
+// lose the centroid to rounding
+inline void reduce_packed(const float* positions, const size_t count, float min[3], float max[3], double sum[3])
+{
+	constexpr size_t lanes = 12;
+	constexpr size_t block = 1 << 12; // points
+	float lane_min[lanes], lane_max[lanes];
+	std::fill_n(lane_min, lanes, INFINITY);
+	std::fill_n(lane_max, lanes, -INFINITY);
+	double lane_sum[lanes] = {};
+	const size_t quads = count / 4;
+	for(size_t first = 0; first < quads; first += block / 4)
+	{
+		const size_t last = std::min(quads, first + block / 4);
+		float block_sum[lanes] = {};
+		for(size_t q = first; q < last; ++q)
+		{
+			const float* v = positions + lanes * q;
+			for(size_t l = 0; l < lanes; ++l)
+			{
+				// in the form minps and maxps compute, which std::min and std::max aren't for NaNs
+				lane_min[l] = v[l] < lane_min[l] ? v[l] : lane_min[l];
+				lane_max[l] = v[l] > lane_max[l] ? v[l] : lane_max[l];
+				block_sum[l] += v[l];
+			}
+		}
+		for(size_t l = 0; l < lanes; ++l)
+		{
+			lane_sum[l] += block_sum[l];
+		}
+	}
+	for(size_t l = 0; l < lanes; ++l)
+	{
+		min[l % 3] = std::min(min[l % 3], lane_min[l]);
+		max[l % 3] = std::max(max[l % 3], lane_max[l]);
+		sum[l % 3] += lane_sum[l];
+	}
+	for(size_t i = 4 * quads; i < count; ++i)
+	{
+		for(size_t k = 0; k < 3; ++k)
+		{
+			min[k] = std::min(min[k], positions[3 * i + k]);
+			max[k] = std::max(max[k], positions[3 * i + k]);
+			sum[k] += positions[3 * i + k];
+		}
+	}
+}
+
+// The same over positions 'stride' bytes apart, at any alignment (inside an interleaved ply vertex, say)
+inline void reduce_strided(const uint8_t* positions, const size_t count, const size_t stride, float min[3], float max[3],
+	double sum[3])
+{
+	for(size_t i = 0; i < count; ++i)
+	{
+		for(size_t k = 0; k < 3; ++k)
+		{
+			const float v = load_float(positions + i * stride + k * sizeof(float));
+			min[k] = std::min(min[k], v);
+			max[k] = std::max(max[k], v);
+			sum[k] += v;
+		}
+	}
+}
+
+// Bounds and sum of 'count' positions, 'stride' bytes apart, one contiguous range per thread
+inline void reduce(const void* positions, const size_t count, const size_t stride, float min[3], float max[3],
+	double sum[3])
+{
+	const uint8_t* bytes = static_cast<const uint8_t*>(positions);
+	const bool packed = stride == 3 * sizeof(float) && reinterpret_cast<uintptr_t>(positions) % alignof(float) == 0;
+	const size_t num_ranges = std::min(parallel_utils::thread_count(), std::max<size_t>(1, count >> 16));
+	std::vector<float> range_min(3 * num_ranges, INFINITY), range_max(3 * num_ranges, -INFINITY);
+	std::vector<double> range_sum(3 * num_ranges, 0.0);
+	parallel_utils::parallel_tasks(num_ranges, [&](const size_t r) {
+		const size_t begin = count * r / num_ranges;
+		const size_t n = count * (r + 1) / num_ranges - begin;
+		if(packed)
+		{
+			reduce_packed(static_cast<const float*>(positions) + 3 * begin, n, &range_min[3 * r], &range_max[3 * r],
+				&range_sum[3 * r]);
+		}
+		else
+		{
+			reduce_strided(bytes + begin * stride, n, stride, &range_min[3 * r], &range_max[3 * r], &range_sum[3 * r]);
+		}
+	});
+	for(size_t k = 0; k < 3; ++k)
+	{
+		min[k] = INFINITY;
+		max[k] = -INFINITY;
+		sum[k] = 0.0;
+		for(size_t r = 0; r < num_ranges; ++r)
+		{
+			min[k] = std::min(min[k], range_min[3 * r + k]);
+			max[k] = std::max(max[k], range_max[3 * r + k]);
+			sum[k] += range_sum[3 * r + k];
+		}
+	}
+}
+
+// The 'fraction' quantile of one axis of the sample, which is reordered
+inline float quantile(std::vector<float>& values, const double fraction)
+{
+	const size_t n = std::min(values.size() - 1, size_t(fraction * (values.size() - 1) + 0.5));
+	std::nth_element(values.begin(), values.begin() + n, values.end());
+	return values[n];
+}
+} // namespace detail
+
+// Summarise 'count' positions, each three floats starting 'stride' bytes after the last (12 for packed)
+// The exact bounds of 'count' packed positions across all cores, which are inverted (min above max) if there are
+// none. NaN coordinates are left out
+inline void bounds(const float* positions, const size_t count, float min[3], float max[3])
+{
+	double sum[3];
+	detail::reduce(positions, count, 3 * sizeof(float), min, max, sum);
+}
+
+inline summary summarise(const void* positions, const size_t count, const size_t stride = 3 * sizeof(float),
+	const size_t sample_size = default_sample_size)
+{
+	summary stats;
+	stats.count = count;
+	if(count == 0)
+	{
+		return stats;
+	}
+	const uint8_t* bytes = static_cast<const uint8_t*>(positions);
+
+	// exact bounds and centroid
+	double sum[3];
+	detail::reduce(positions, count, stride, stats.bounds_min, stats.bounds_max, sum);
+	for(size_t k = 0; k < 3; ++k)
+	{
+		stats.centroid[k] = sum[k] / count;
+	}
+
+	// an evenly spaced sample, which for shuffled points is a random one too
+	const size_t n = std::min(count, std::max<size_t>(1, sample_size));
+	std::vector<float> sample(3 * n);
+	for(size_t i = 0; i < n; ++i)
+	{
+		const uint8_t* p = bytes + (n == count ? i : i * count / n) * stride;
+		for(size_t k = 0; k < 3; ++k)
+		{
+			sample[3 * i + k] = detail::load_float(p + k * sizeof(float));
+		}
+	}
+
+	std::vector<float> axis(n);
+	for(size_t k = 0; k < 3; ++k)
+	{
+		for(size_t i = 0; i < n; ++i)
+		{
+			axis[i] = sample[3 * i + k];
+		}
+		stats.robust_min[k] = detail::quantile(axis, 0.005);
+		stats.robust_max[k] = detail::quantile(axis, 0.995);
+	}
+
+	// count the occupied cells of a grid over the robust bounds, which for a surface is roughly its area over the
+	// square of the cell size. Cells need a good number of sample points each to all be found occupied, so the
+	// grid is coarsened until they do. The points share the area between them, spacing is the side of a share
+	float extent = 0.f;
+	for(size_t k = 0; k < 3; ++k)
+	{
+		extent = std::max(extent, stats.robust_max[k] - stats.robust_min[k]);
+	}
+	if(!(extent > 0.f) || !std::isfinite(extent))
+	{
+		return stats;
+	}
+	std::vector<uint64_t> occupancy;
+	for(uint32_t cells = 128; cells >= 1; cells /= 2)
+	{
+		const float cell_size = extent / cells;
+		occupancy.assign(std::max<size_t>(1, (size_t(cells) * cells * cells) / 64), 0);
+		size_t inside = 0, occupied = 0;
+		for(size_t i = 0; i < n; ++i)
+		{
+			uint32_t cell[3];
+			bool in_bounds = true;
+			for(size_t k = 0; k < 3; ++k)
+			{
+				const float c = (sample[3 * i + k] - stats.robust_min[k]) / cell_size;
+				in_bounds &= c >= 0.f && c <= float(cells);
+				cell[k] = in_bounds ? std::min(uint32_t(c), cells - 1) : 0;
+			}
+			if(in_bounds)
+			{
+				const uint64_t code = (uint64_t(cell[2]) * cells + cell[1]) * cells + cell[0];
+				const uint64_t bit = uint64_t(1) << (code & 63);
+				occupied += (occupancy[code >> 6] & bit) == 0;
+				occupancy[code >> 6] |= bit;
+				++inside;
+			}
+		}
+		if(occupied == 0 || inside >= 16 * occupied || cells == 1)
+		{
+			const double area = double(occupied) * cell_size * cell_size;
+			stats.spacing = float(std::sqrt(area / (double(inside) * count / n)));
+			break;
+		}
+	}
+	return stats;
+}
+} // namespace cloud_stats
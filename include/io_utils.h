@@ -0,0 +1,573 @@
+#ifndef IO_UTILS_H
+#define IO_UTILS_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+	#include <linux/io_uring.h>
+	#include <sys/syscall.h>
+	#define IO_UTILS_IO_URING 1
+#endif
+
+// Sequential reads of files bigger than the page cache can hold. A range of a file is read in large aligned
+// blocks into a small ring of staging buffers, keeping every free buffer's read in flight while the caller works
+// on the oldest completed one, so disk transfers overlap with parsing and decoding. Reads go through io_uring when
+// the kernel allows it, otherwise through pread on a worker thread. With direct_io the file is opened O_DIRECT,
+// bypassing the page cache entirely, which stops a scan larger than memory from evicting everything else.
+
+namespace io_utils
+{
+	struct read_options
+	{
+		size_t block_size = 8 << 20; // bytes per read, rounded up to the direct io alignment
+		size_t queue_depth = 4;      // staging buffers, so reads in flight at once
+		bool direct_io = false;
+		bool use_io_uring = true;
+	};
+
+	namespace detail
+	{
+		// O_DIRECT transfers need their offset, length and buffer aligned to the logical block size, 4k covers
+		// every device we're likely to see
+		constexpr size_t direct_alignment = 4096;
+
+		inline size_t align_up(const size_t value) { return (value + direct_alignment - 1) & ~(direct_alignment - 1); }
+
+		struct completion
+		{
+			size_t slot;
+			int64_t result; // bytes read, or -errno
+		};
+
+		// Something that can read into a numbered staging slot in the background and report when it's done
+		class read_backend
+		{
+		public:
+			virtual ~read_backend() {}
+			virtual void submit(size_t slot, uint8_t * buffer, size_t size, uint64_t offset) = 0;
+			virtual completion wait() = 0;
+			virtual const char * name() const = 0;
+		};
+
+		// Read until 'size' bytes are in or the file ends, returns the bytes read or -errno
+		inline int64_t pread_fully(const int fd, uint8_t * buffer, const size_t size, const uint64_t offset)
+		{
+			size_t done = 0;
+			while (done < size)
+			{
+				const ssize_t n = ::pread(fd, buffer + done, size - done, offset + done);
+				if (n < 0 && errno == EINTR) continue;
+				if (n < 0) return -errno;
+				if (n == 0) break;
+				done += n;
+			}
+			return int64_t(done);
+		}
+
+		// Fallback, a single worker thread running the queued reads in order
+		class thread_backend : public read_backend
+		{
+			struct request { size_t slot; uint8_t * buffer; size_t size; uint64_t offset; };
+
+			const int fd;
+			std::mutex mutex;
+			std::condition_variable changed;
+			std::deque<request> requests;
+			std::deque<completion> completions;
+			bool stopping {false};
+			std::thread worker;
+
+			void run()
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				while (true)
+				{
+					changed.wait(lock, [this]() { return stopping || !requests.empty(); });
+					if (requests.empty()) return;
+					const request r = requests.front();
+					requests.pop_front();
+					lock.unlock();
+					const int64_t result = pread_fully(fd, r.buffer, r.size, r.offset);
+					lock.lock();
+					completions.push_back({ r.slot, result });
+					changed.notify_all();
+				}
+			}
+
+		public:
+			explicit thread_backend(const int file) : fd(file), worker([this]() { run(); }) {}
+
+			~thread_backend()
+			{
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					stopping = true;
+					requests.clear();
+				}
+				changed.notify_all();
+				worker.join();
+			}
+
+			void submit(const size_t slot, uint8_t * buffer, const size_t size, const uint64_t offset) override
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				requests.push_back({ slot, buffer, size, offset });
+				changed.notify_all();
+			}
+
+			completion wait() override
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				changed.wait(lock, [this]() { return !completions.empty(); });
+				const completion c = completions.front();
+				completions.pop_front();
+				return c;
+			}
+
+			const char * name() const override { return "pread thread"; }
+		};
+
+	#ifdef IO_UTILS_IO_URING
+		// io_uring through the raw syscalls, so there's no liburing to link. One readv per slot, these have been
+		// supported since the first io_uring kernels (5.1)
+		class uring_backend : public read_backend
+		{
+			const int fd;
+			int ring_fd {-1};
+			void * sq_ring {MAP_FAILED}, * cq_ring {MAP_FAILED};
+			size_t sq_ring_size {0}, cq_ring_size {0}, sqes_size {0};
+			io_uring_sqe * sqes {nullptr};
+			unsigned * sq_tail {nullptr}, * sq_mask {nullptr}, * sq_array {nullptr};
+			unsigned * cq_head {nullptr}, * cq_tail {nullptr}, * cq_mask {nullptr};
+			io_uring_cqe * cqes {nullptr};
+			std::vector<iovec> iovecs;
+			size_t in_flight {0};
+
+			int enter(const unsigned to_submit, const unsigned min_complete, const unsigned flags)
+			{
+				int result;
+				do result = int(::syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+				while (result < 0 && errno == EINTR);
+				return result;
+			}
+
+		public:
+			uring_backend(const int file, const size_t queue_depth) : fd(file), iovecs(queue_depth)
+			{
+				io_uring_params params;
+				std::memset(&params, 0, sizeof(params));
+				ring_fd = int(::syscall(__NR_io_uring_setup, unsigned(queue_depth), &params));
+				if (ring_fd < 0) throw std::runtime_error("io_uring_setup failed: " + std::string(std::strerror(errno)));
+
+				sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+				cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+				const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+				if (single_mmap) sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+
+				sq_ring = ::mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+				cq_ring = single_mmap ? sq_ring : ::mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+				sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+				void * sqe_memory = ::mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+				if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqe_memory == MAP_FAILED)
+				{
+					if (sqe_memory != MAP_FAILED) ::munmap(sqe_memory, sqes_size);
+					release();
+					throw std::runtime_error("could not map the io_uring rings");
+				}
+				sqes = static_cast<io_uring_sqe*>(sqe_memory);
+
+				uint8_t * sq = static_cast<uint8_t*>(sq_ring);
+				sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+				sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+				sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+				uint8_t * cq = static_cast<uint8_t*>(cq_ring);
+				cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+				cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+				cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+				cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+			}
+
+			~uring_backend()
+			{
+				// the kernel is still writing into the staging buffers until every read has completed
+				try { while (in_flight) wait(); }
+				catch (const std::exception &) {}
+				if (sqes) ::munmap(sqes, sqes_size);
+				release();
+			}
+
+			void release()
+			{
+				if (cq_ring != MAP_FAILED && cq_ring != sq_ring) ::munmap(cq_ring, cq_ring_size);
+				if (sq_ring != MAP_FAILED) ::munmap(sq_ring, sq_ring_size);
+				if (ring_fd >= 0) ::close(ring_fd);
+				sq_ring = cq_ring = MAP_FAILED;
+				ring_fd = -1;
+			}
+
+			void submit(const size_t slot, uint8_t * buffer, const size_t size, const uint64_t offset) override
+			{
+				iovecs[slot] = { buffer, size };
+
+				const unsigned tail = *sq_tail;
+				const unsigned index = tail & *sq_mask;
+				io_uring_sqe & sqe = sqes[index];
+				std::memset(&sqe, 0, sizeof(sqe));
+				sqe.opcode = IORING_OP_READV;
+				sqe.fd = fd;
+				sqe.addr = reinterpret_cast<uint64_t>(&iovecs[slot]);
+				sqe.len = 1;
+				sqe.off = offset;
+				sqe.user_data = slot;
+				sq_array[index] = index;
+				__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+				if (enter(1, 0, 0) != 1) throw std::runtime_error("io_uring_enter failed to submit: " + std::string(std::strerror(errno)));
+				++in_flight;
+			}
+
+			completion wait() override
+			{
+				while (true)
+				{
+					const unsigned head = *cq_head;
+					if (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+					{
+						const io_uring_cqe & cqe = cqes[head & *cq_mask];
+						const completion c { size_t(cqe.user_data), int64_t(cqe.res) };
+						__atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+						--in_flight;
+						return c;
+					}
+					if (enter(0, 1, IORING_ENTER_GETEVENTS) < 0) throw std::runtime_error("io_uring_enter failed to wait: " + std::string(std::strerror(errno)));
+				}
+			}
+
+			const char * name() const override { return "io_uring"; }
+		};
+	#endif // IO_UTILS_IO_URING
+
+		struct aligned_free { void operator()(uint8_t * p) const { std::free(p); } };
+	}
+
+	// Reads [begin, end) of a file front to back, handing out one block at a time in order, see the top of the file
+	class pipelined_reader
+	{
+		int fd {-1};
+		int buffered_fd {-1}; // fd itself, or for a direct read the same file without O_DIRECT
+		bool direct {false};
+		uint64_t begin, end;
+		uint64_t aligned_begin;
+		size_t block_size;
+		size_t num_blocks;
+		std::vector<std::unique_ptr<uint8_t, detail::aligned_free>> buffers;
+		std::vector<int64_t> results; // per slot, bytes read, -1 whilst in flight
+		size_t next_submit {0}, next_hand_out {0};
+		std::unique_ptr<detail::read_backend> backend;
+
+		uint64_t block_offset(const size_t block) const { return aligned_begin + uint64_t(block) * block_size; }
+
+		void submit_ready()
+		{
+			// a block's slot is free once the block before it in that slot has been handed out and released
+			while (next_submit < num_blocks && next_submit < next_hand_out + buffers.size())
+			{
+				const size_t slot = next_submit % buffers.size();
+				const uint64_t offset = block_offset(next_submit);
+				const size_t wanted = size_t(std::min<uint64_t>(block_size, end - offset));
+				results[slot] = -1;
+				backend->submit(slot, buffers[slot].get(), direct ? detail::align_up(wanted) : wanted, offset);
+				++next_submit;
+			}
+		}
+
+	public:
+		pipelined_reader(const std::string & path, const uint64_t range_begin, const uint64_t range_end, const read_options & options = read_options())
+			: begin(range_begin)
+			, end(range_end)
+		{
+			if (options.direct_io)
+			{
+				fd = ::open(path.c_str(), O_RDONLY | O_DIRECT);
+				direct = fd >= 0;
+			}
+			// some filesystems (tmpfs for one) refuse O_DIRECT, just read through the page cache then
+			if (fd < 0) fd = ::open(path.c_str(), O_RDONLY);
+			if (fd < 0) throw std::runtime_error("could not open " + path + ": " + std::strerror(errno));
+			// the rest of a short direct read starts at an offset O_DIRECT would refuse, so it's finished through a
+			// descriptor that goes through the page cache
+			buffered_fd = direct ? ::open(path.c_str(), O_RDONLY) : fd;
+			if (buffered_fd < 0)
+			{
+				::close(fd);
+				throw std::runtime_error("could not open " + path + ": " + std::strerror(errno));
+			}
+			try { start(options); }
+			catch (const std::exception &)
+			{
+				backend.reset();
+				close_files();
+				throw;
+			}
+		}
+
+		~pipelined_reader()
+		{
+			// let the backend finish (or drop) its reads before the buffers and file go away
+			backend.reset();
+			close_files();
+		}
+
+		// Disable copy constructor and assignment operator, the backend holds pointers into our buffers
+		pipelined_reader(const pipelined_reader &) = delete;
+		pipelined_reader & operator=(const pipelined_reader &) = delete;
+
+	private:
+		void close_files()
+		{
+			if (buffered_fd != fd) ::close(buffered_fd);
+			::close(fd);
+		}
+
+		void start(const read_options & options)
+		{
+			if (!direct) ::posix_fadvise(fd, off_t(begin), off_t(end - begin), POSIX_FADV_SEQUENTIAL);
+
+			aligned_begin = direct ? (begin & ~uint64_t(detail::direct_alignment - 1)) : begin;
+			block_size = detail::align_up(std::max<size_t>(options.block_size, 1));
+			num_blocks = (end > begin) ? size_t((end - aligned_begin + block_size - 1) / block_size) : 0;
+
+			const size_t depth = std::max<size_t>(1, std::min(options.queue_depth, num_blocks));
+			results.assign(depth, -1);
+			for (size_t slot = 0; slot < depth; ++slot)
+			{
+				uint8_t * buffer = static_cast<uint8_t*>(std::aligned_alloc(detail::direct_alignment, block_size));
+				if (!buffer) throw std::runtime_error("could not allocate io staging buffers");
+				buffers.emplace_back(buffer);
+			}
+
+		#ifdef IO_UTILS_IO_URING
+			if (options.use_io_uring)
+			{
+				// io_uring can be compiled in but disabled or filtered (containers, older kernels)
+				try { backend.reset(new detail::uring_backend(fd, depth)); }
+				catch (const std::exception &) {}
+			}
+		#endif
+			if (!backend) backend.reset(new detail::thread_backend(fd));
+			submit_ready();
+		}
+
+	public:
+		const char * backend_name() const { return backend->name(); }
+		bool is_direct() const { return direct; }
+
+		// Wait for the next block of the range and point 'data' and 'size' at it, the block stays valid until the next
+		// call. Returns false once the whole range has been handed out, throws on read errors or a truncated file
+		bool next(const uint8_t * & data, size_t & size)
+		{
+			// the previous block's slot can take a new read before we wait on this one
+			submit_ready();
+			if (next_hand_out == num_blocks) return false;
+
+			const size_t slot = next_hand_out % buffers.size();
+			while (results[slot] < 0)
+			{
+				const detail::completion c = backend->wait();
+				if (c.result < 0) throw std::runtime_error("read failed: " + std::string(std::strerror(int(-c.result))));
+				results[c.slot] = c.result;
+			}
+
+			const uint64_t offset = block_offset(next_hand_out);
+			const uint64_t block_end = std::min<uint64_t>(offset + block_size, end);
+			uint64_t available = offset + uint64_t(results[slot]);
+			// a short read mid file can happen on some filesystems, finish the block synchronously
+			if (available < block_end)
+			{
+				const int64_t rest = detail::pread_fully(buffered_fd, buffers[slot].get() + (available - offset), size_t(block_end - available), available);
+				if (rest < 0) throw std::runtime_error("read failed: " + std::string(std::strerror(int(-rest))));
+				available += uint64_t(rest);
+			}
+			if (available < block_end) throw std::runtime_error("file ended before the range being read");
+
+			// the first block of a direct read starts at the aligned offset before the range
+			const uint64_t skip = std::max(offset, begin) - offset;
+			data = buffers[slot].get() + skip;
+			size = size_t(block_end - offset - skip);
+			++next_hand_out;
+			return true;
+		}
+	};
+
+	// Hands out fixed size records from a pipelined_reader, as runs of whole records in place in the staging buffers.
+	// A record split across two blocks is stitched together and handed out on its own
+	class record_reader
+	{
+		pipelined_reader reader;
+		size_t record_size;
+		size_t remaining;
+		const uint8_t * block {nullptr};
+		size_t block_left {0};
+		std::vector<uint8_t> straddle;
+
+		void next_block()
+		{
+			if (!reader.next(block, block_left)) throw std::runtime_error("file ended before its last record");
+		}
+
+	public:
+		record_reader(const std::string & path, const uint64_t offset, const size_t record_bytes, const size_t record_count, const read_options & options = read_options())
+			: reader(path, offset, offset + uint64_t(record_bytes) * record_count, options)
+			, record_size(record_bytes)
+			, remaining(record_count)
+			, straddle(record_bytes)
+		{
+		}
+
+		const char * backend_name() const { return reader.backend_name(); }
+		bool is_direct() const { return reader.is_direct(); }
+
+		// Point 'records' at up to 'max_records' consecutive records, valid until the next call. Returns how many,
+		// 0 once every record has been handed out
+		size_t next(const size_t max_records, const uint8_t * & records)
+		{
+			if (!remaining || !max_records) return 0;
+			if (!block_left) next_block();
+
+			if (block_left >= record_size)
+			{
+				const size_t count = std::min({ max_records, remaining, block_left / record_size });
+				records = block;
+				block += count * record_size;
+				block_left -= count * record_size;
+				remaining -= count;
+				return count;
+			}
+
+			size_t filled = 0;
+			while (filled < record_size)
+			{
+				if (!block_left) next_block();
+				const size_t take = std::min(record_size - filled, block_left);
+				std::memcpy(straddle.data() + filled, block, take);
+				block += take;
+				block_left -= take;
+				filled += take;
+			}
+			records = straddle.data();
+			--remaining;
+			return 1;
+		}
+	};
+
+	// A read only, seekable stream buffer over a pipelined_reader, so stream parsers (tinyply) get the same overlapped
+	// reads. Seeking outside the current block restarts the pipeline at the new position
+	class pipelined_streambuf : public std::streambuf
+	{
+		std::string path;
+		read_options options;
+		uint64_t file_size {0};
+		uint64_t block_start {0}; // file offset of eback()
+		std::unique_ptr<pipelined_reader> reader;
+
+		void restart(const uint64_t offset)
+		{
+			reader.reset();
+			reader.reset(new pipelined_reader(path, offset, file_size, options));
+			block_start = offset;
+			setg(nullptr, nullptr, nullptr);
+		}
+
+	protected:
+		int_type underflow() override
+		{
+			if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+			block_start += egptr() - eback();
+			const uint8_t * data = nullptr;
+			size_t size = 0;
+			if (!reader->next(data, size) || !size) return traits_type::eof();
+			char * p = const_cast<char*>(reinterpret_cast<const char*>(data));
+			setg(p, p, p + size);
+			return traits_type::to_int_type(*gptr());
+		}
+
+		pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+		{
+			const int64_t current = int64_t(block_start) + (gptr() - eback());
+			if (dir == std::ios_base::cur && off == 0) return pos_type(current);
+			const int64_t base = (dir == std::ios_base::beg) ? 0 : (dir == std::ios_base::cur) ? current : int64_t(file_size);
+			return seekpos(pos_type(base + off), which);
+		}
+
+		pos_type seekpos(pos_type pos, std::ios_base::openmode which) override
+		{
+			const int64_t target = int64_t(pos);
+			if (!(which & std::ios_base::in) || target < 0 || uint64_t(target) > file_size) return pos_type(off_type(-1));
+			if (uint64_t(target) >= block_start && uint64_t(target) < block_start + (egptr() - eback()))
+			{
+				setg(eback(), eback() + (target - int64_t(block_start)), egptr());
+			}
+			else restart(uint64_t(target));
+			return pos;
+		}
+
+	public:
+		explicit pipelined_streambuf(const std::string & filepath, const read_options & stream_options = read_options())
+			: path(filepath)
+			, options(stream_options)
+		{
+			struct stat file_stat;
+			if (::stat(path.c_str(), &file_stat) != 0) throw std::runtime_error("could not stat " + path);
+			file_size = uint64_t(file_stat.st_size);
+			restart(0);
+		}
+	};
+
+	class pipelined_istream : public std::istream
+	{
+		pipelined_streambuf buffer;
+	public:
+		explicit pipelined_istream(const std::string & filepath, const read_options & options = read_options())
+			: std::istream(nullptr)
+			, buffer(filepath, options)
+		{
+			rdbuf(&buffer);
+		}
+	};
+
+	// Read a whole file into memory through the pipeline, large aligned reads rather than whatever an ifstream does
+	inline std::vector<uint8_t> read_file(const std::string & path, const read_options & options = read_options())
+	{
+		struct stat file_stat;
+		if (::stat(path.c_str(), &file_stat) != 0) throw std::runtime_error("could not stat " + path);
+
+		std::vector<uint8_t> bytes(size_t(file_stat.st_size));
+		pipelined_reader reader(path, 0, bytes.size(), options);
+		size_t filled = 0;
+		const uint8_t * data = nullptr;
+		for (size_t size = 0; reader.next(data, size); filled += size) std::memcpy(bytes.data() + filled, data, size);
+		return bytes;
+	}
+}
+
+#endif // IO_UTILS_H
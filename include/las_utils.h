@@ -0,0 +1,284 @@
+#ifndef LAS_UTILS_H
+#define LAS_UTILS_H
+
+// mapped_file, strided_view, manual_timer and the AVX2 helpers are shared with the ply loader
+#include "ply_utils.h"
+#include "point_format.h"
+
+#include <cmath>
+#include <string>
+
+// Reader for uncompressed ASPRS LAS 1.0 - 1.4 point clouds, point formats 0 - 10. Coordinates are stored as
+// int32 multiples of a per axis scale plus offset, so they're decoded in double precision and made relative to
+// a local origin (the centre of the header bounds) before narrowing to float, which keeps the precision that
+// georeferenced coordinates would otherwise lose. LAZ (compressed) files aren't supported.
+
+namespace las_utils
+{
+	struct mapped_las
+	{
+		std::shared_ptr<ply_utils::mapped_file> file;
+		std::string file_path;
+		uint8_t version_major {0}, version_minor {0};
+		uint8_t point_format {0};
+		size_t record_length {0};
+		size_t point_count {0};
+		const uint8_t * point_data {nullptr};
+		double scale[3] {1.0, 1.0, 1.0};
+		double offset[3] {0.0, 0.0, 0.0};
+		double bounds_min[3] {0.0, 0.0, 0.0};
+		double bounds_max[3] {0.0, 0.0, 0.0};
+		double origin[3] {0.0, 0.0, 0.0}; // subtracted from every position before it's narrowed to float
+		ply_utils::strided_view colours;  // 16 bit rgb, empty for point formats without colour
+		bool colours_are_16_bit {true};
+	};
+
+	namespace detail
+	{
+		template<typename T> inline T load_le(const uint8_t * src)
+		{
+			T value;
+			std::memcpy(&value, src, sizeof(T));
+			return value;
+		}
+
+		// minimum record length, and where the rgb channels start (0 for none), for point formats 0 - 10
+		constexpr size_t format_record_length[11] = { 20, 28, 26, 34, 57, 63, 30, 36, 38, 59, 67 };
+		constexpr size_t format_rgb_offset[11] = { 0, 0, 20, 28, 0, 28, 0, 30, 30, 0, 30 };
+	}
+
+	inline bool is_las_file(const std::string & path)
+	{
+		return point_format::has_magic(path, "LASF", 4);
+	}
+
+	// Map a las file and work out where its point records and their fields are, throws if it can't be decoded
+	inline mapped_las map_las_file(const std::string & filepath)
+	{
+		mapped_las las;
+		las.file = std::make_shared<ply_utils::mapped_file>(filepath);
+		las.file_path = filepath;
+
+		const uint8_t * data = las.file->data();
+		const size_t size = las.file->size();
+		constexpr size_t min_header_size = 227; // versions 1.0 - 1.2
+		if (size < min_header_size || std::memcmp(data, "LASF", 4) != 0) throw std::runtime_error(filepath + " isn't a las file");
+
+		las.version_major = data[24];
+		las.version_minor = data[25];
+		const size_t header_size = detail::load_le<uint16_t>(data + 94);
+		const size_t point_data_offset = detail::load_le<uint32_t>(data + 96);
+		const uint8_t format_byte = data[104];
+		las.record_length = detail::load_le<uint16_t>(data + 105);
+		las.point_count = detail::load_le<uint32_t>(data + 107);
+
+		// 1.4 moved the point count to 64 bits, the legacy field is zero if it didn't fit
+		constexpr size_t header_size_14 = 375;
+		if (las.version_major == 1 && las.version_minor >= 4 && header_size >= header_size_14 && size >= header_size_14)
+		{
+			const uint64_t point_count_64 = detail::load_le<uint64_t>(data + 247);
+			if (point_count_64) las.point_count = point_count_64;
+		}
+
+		// laszip marks compressed files by setting the top bits of the point format
+		if (format_byte & 0xC0) throw std::runtime_error(filepath + " is compressed (laz), decompress it first");
+		las.point_format = format_byte;
+		if (las.point_format > 10) throw std::runtime_error("unsupported las point format " + std::to_string(las.point_format));
+		if (las.record_length < detail::format_record_length[las.point_format])
+			throw std::runtime_error("las point records are " + std::to_string(las.record_length) + " bytes, too short for point format " + std::to_string(las.point_format));
+		if (point_data_offset < min_header_size || point_data_offset + las.point_count * las.record_length > size)
+			throw std::runtime_error(filepath + " is truncated, expected " + std::to_string(las.point_count) + " point records");
+
+		for (size_t k = 0; k < 3; ++k)
+		{
+			las.scale[k] = detail::load_le<double>(data + 131 + 8 * k);
+			las.offset[k] = detail::load_le<double>(data + 155 + 8 * k);
+			// max and min are interleaved per axis
+			las.bounds_max[k] = detail::load_le<double>(data + 179 + 16 * k);
+			las.bounds_min[k] = detail::load_le<double>(data + 187 + 16 * k);
+			// fall back to the offset if the header bounds weren't filled in
+			las.origin[k] = (las.bounds_min[k] <= las.bounds_max[k] && std::isfinite(las.bounds_min[k] + las.bounds_max[k]))
+				? 0.5 * (las.bounds_min[k] + las.bounds_max[k])
+				: las.offset[k];
+		}
+
+		las.point_data = data + point_data_offset;
+		const size_t rgb_offset = detail::format_rgb_offset[las.point_format];
+		if (rgb_offset) las.colours = ply_utils::strided_view { las.point_data + rgb_offset, las.record_length, las.point_count, tinyply::Type::UINT16 };
+
+		// the spec asks for colours normalised to 16 bits, but plenty of writers store 8 bit values as-is. Check a
+		// spread of samples for anything above 255 to tell which this file does
+		if (las.colours && las.point_count)
+		{
+			constexpr size_t num_samples = 1 << 12;
+			const size_t step = std::max<size_t>(1, las.point_count / num_samples);
+			uint16_t max_channel = 0;
+			for (size_t i = 0; i < las.point_count; i += step)
+			{
+				for (size_t k = 0; k < 3; ++k) max_channel = std::max(max_channel, detail::load_le<uint16_t>(las.colours.data + i * las.record_length + 2 * k));
+			}
+			las.colours_are_16_bit = max_channel > 255;
+		}
+
+		std::cout << "\t[las_header] version " << int(las.version_major) << "." << int(las.version_minor) << ", point format " << int(las.point_format)
+			<< ", " << las.point_count << " points of " << las.record_length << " bytes" << std::endl;
+		std::cout << "\t[las_header] origin (" << las.origin[0] << ", " << las.origin[1] << ", " << las.origin[2] << ")"
+			<< (las.colours ? (las.colours_are_16_bit ? ", 16 bit rgb" : ", 8 bit rgb") : ", no rgb") << std::endl;
+
+		return las;
+	}
+
+	namespace detail
+	{
+		inline void decode_positions_scalar(const mapped_las & las, const size_t first, const size_t count, float * positions)
+		{
+			const double shift[3] = { las.offset[0] - las.origin[0], las.offset[1] - las.origin[1], las.offset[2] - las.origin[2] };
+			const uint8_t * src = las.point_data + first * las.record_length;
+			for (size_t i = 0; i < count; ++i, src += las.record_length)
+			{
+				for (size_t k = 0; k < 3; ++k) positions[3 * i + k] = float(double(load_le<int32_t>(src + 4 * k)) * las.scale[k] + shift[k]);
+			}
+		}
+
+		inline void decode_colours_8_bit_scalar(const mapped_las & las, const size_t first, const size_t count, uint8_t * colours)
+		{
+			const uint8_t * src = las.colours.data + first * las.record_length;
+			for (size_t i = 0; i < count; ++i, src += las.record_length)
+			{
+				for (size_t k = 0; k < 3; ++k) colours[3 * i + k] = uint8_t(load_le<uint16_t>(src + 2 * k));
+			}
+		}
+
+	#ifdef PLY_UTILS_AVX2_KERNELS
+		// Gathers 8 records' X, Y, Z at a time into packed xyz order like the ply kernels, then widens each half to
+		// double, scales and shifts it with per lane factors matching its component, and narrows to float. The
+		// multiply and add are separate (no fma) so that results match the scalar path exactly
+		__attribute__((target("avx2")))
+		inline size_t decode_positions_avx2(const mapped_las & las, const size_t first, const size_t count, float * positions)
+		{
+			alignas(32) int32_t offsets[24];
+			for (int j = 0; j < 24; ++j) offsets[j] = int32_t((j / 3) * las.record_length + (j % 3) * sizeof(int32_t));
+			__m256i idx[3];
+			for (int g = 0; g < 3; ++g) idx[g] = _mm256_load_si256((const __m256i*)(offsets + 8 * g));
+
+			// output float j of each block comes from component j % 3, so the factors repeat every 3 lanes
+			__m256d scale[6], shift[6];
+			for (int q = 0; q < 6; ++q)
+			{
+				alignas(32) double s[4], o[4];
+				for (int l = 0; l < 4; ++l)
+				{
+					const int k = (4 * q + l) % 3;
+					s[l] = las.scale[k];
+					o[l] = las.offset[k] - las.origin[k];
+				}
+				scale[q] = _mm256_load_pd(s);
+				shift[q] = _mm256_load_pd(o);
+			}
+
+			const uint8_t * src = las.point_data + first * las.record_length;
+			size_t row = 0;
+			for (; row + 8 <= count; row += 8, src += 8 * las.record_length)
+			{
+				for (int g = 0; g < 3; ++g)
+				{
+					const __m256i v = _mm256_i32gather_epi32((const int*)src, idx[g], 1);
+					const __m256d lo = _mm256_cvtepi32_pd(_mm256_castsi256_si128(v));
+					const __m256d hi = _mm256_cvtepi32_pd(_mm256_extracti128_si256(v, 1));
+					_mm_storeu_ps(positions + 3 * row + 8 * g + 0, _mm256_cvtpd_ps(_mm256_add_pd(_mm256_mul_pd(lo, scale[2 * g + 0]), shift[2 * g + 0])));
+					_mm_storeu_ps(positions + 3 * row + 8 * g + 4, _mm256_cvtpd_ps(_mm256_add_pd(_mm256_mul_pd(hi, scale[2 * g + 1]), shift[2 * g + 1])));
+				}
+			}
+			return row;
+		}
+	#endif // PLY_UTILS_AVX2_KERNELS
+	}
+
+	// Convert 'count' point records starting at record 'first' into packed float xyz and uchar rgb, written to the
+	// start of 'positions' and 'colours'. Point formats without colour decode to white.
+	inline void decode_point_rows(const mapped_las & las, const size_t first, const size_t count, float * positions, uint8_t * colours)
+	{
+		size_t done = 0;
+	#ifdef PLY_UTILS_AVX2_KERNELS
+		if (ply_utils::detail::has_avx2()) done = detail::decode_positions_avx2(las, first, count, positions);
+	#endif
+		detail::decode_positions_scalar(las, first + done, count - done, positions + 3 * done);
+
+		if (!las.colours)
+		{
+			std::memset(colours, 255, 3 * count);
+		}
+		else if (las.colours_are_16_bit)
+		{
+			// keeps the most significant byte of each channel, same as 16 bit ply colours
+			done = 0;
+		#ifdef PLY_UTILS_AVX2_KERNELS
+			if (ply_utils::detail::has_avx2()) done = ply_utils::detail::decode_colours_u16_avx2(las.colours, false, first, count, colours);
+		#endif
+			ply_utils::detail::decode_colours_scalar<uint16_t>(las.colours, false, first + done, count - done, colours + 3 * done);
+		}
+		else
+		{
+			detail::decode_colours_8_bit_scalar(las, first, count, colours);
+		}
+	}
+
+	// Decode every point record across all cores into packed arrays of 3 * point_count floats and bytes
+	inline void decode_points(const mapped_las & las, float * positions, uint8_t * colours)
+	{
+		ply_utils::manual_timer decode_timer;
+		decode_timer.start();
+		parallel_utils::parallel_for(las.point_count, [&](const size_t begin, const size_t end)
+		{
+			decode_point_rows(las, begin, end - begin, positions + 3 * begin, colours + 3 * begin);
+		});
+		decode_timer.stop();
+
+		const float size_mb = las.point_count * las.record_length * float(1e-6);
+		const float decode_time = decode_timer.get() / 1000.f;
+		std::cout << "\tdecoding " << size_mb << "mb in " << decode_time << " seconds [" << (size_mb / decode_time) << " MBps] on "
+			<< parallel_utils::thread_count() << " threads" << std::endl;
+	}
+
+	// Decode 'count' point records that were read into memory at 'records' instead of going through the mapping
+	inline void decode_point_records(const mapped_las & las, const uint8_t * records, const size_t count, float * positions, uint8_t * colours)
+	{
+		mapped_las rebased = las;
+		rebased.point_data = records;
+		rebased.point_count = count;
+		if (las.colours) rebased.colours = ply_utils::strided_view { records + (las.colours.data - las.point_data), las.record_length, count, las.colours.type };
+
+		parallel_utils::parallel_for(count, [&](const size_t begin, const size_t end)
+		{
+			decode_point_rows(rebased, begin, end - begin, positions + 3 * begin, colours + 3 * begin);
+		});
+	}
+
+	// Decodes a mapped las file a batch of points at a time, each batch across all cores
+	class point_batch_reader
+	{
+		mapped_las las;
+		size_t next_row {0};
+
+	public:
+		explicit point_batch_reader(mapped_las mapped) : las(std::move(mapped)) {}
+
+		size_t total_rows() const { return las.point_count; }
+		size_t rows_read() const { return next_row; }
+
+		// Decode up to 'max_rows' of the remaining points, returns how many were written (0 once done)
+		size_t read(const size_t max_rows, float * positions, uint8_t * colours)
+		{
+			const size_t count = std::min(max_rows, las.point_count - next_row);
+			const size_t first = next_row;
+			parallel_utils::parallel_for(count, [&](const size_t begin, const size_t end)
+			{
+				decode_point_rows(las, first + begin, end - begin, positions + 3 * begin, colours + 3 * begin);
+			});
+			next_row += count;
+			return count;
+		}
+	};
+}
+
+#endif // LAS_UTILS_H
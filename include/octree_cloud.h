@@ -0,0 +1,735 @@
+#ifndef OCTREE_CLOUD_H
+#define OCTREE_CLOUD_H
+
+#include "cloud_stats.h"
+#include "ply_utils.h"
+#include "point_format.h"
+#include "point_order.h"
+#include "shuffle_utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+// A level of detail octree over a point cloud, built out of core so that clouds far bigger than memory can be
+// converted. Every point is stored exactly once: a node that would hold more than node_capacity points keeps a
+// sample of them, one point per cell of a sample_grid^3 grid over its cube, and passes the rest down to its
+// eight children. Drawing any set of nodes that's closed under taking parents shows every part of the cloud at
+// the density of the deepest nodes drawn there.
+//
+// The build follows the same plan as Potree's converter. A counting pass bins the points into a coarse grid, and
+// the grid is then merged into chunks of at most chunk_points points. A distribution pass appends every point to
+// its chunk's file on disk, and each chunk is then indexed in memory on its own thread. Finally the levels above
+// the chunks are sampled from the chunk roots. Only one chunk per thread is ever held in memory, and the samples
+// waiting for the levels above are kept on disk, so memory doesn't grow with the number of chunks.
+//
+// The file is a fixed header, then page aligned sections of packed float xyz positions and uchar rgb colours, then
+// a table with an entry per node. Nodes are in breadth first order with each node's points contiguous and in
+// random order, so any prefix of the nodes is the whole cloud at a coarser level of detail, and any prefix of a
+// node's points is a uniform sample of it. Integers and floats are native (little) endian.
+
+namespace octree_cloud
+{
+	constexpr char magic[8] = { 'P', 'C', 'R', 'O', 'C', 'T', 'R', 'E' };
+	constexpr uint32_t current_version = 1;
+	constexpr uint64_t section_alignment = 4096;
+
+	struct header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t node_count;
+		uint64_t point_count;
+		float bounds_min[3]; // the root's cube
+		float size;
+		uint64_t positions_offset; // packed float xyz, point_count * 12 bytes
+		uint64_t colours_offset;   // packed uchar rgb, point_count * 3 bytes
+		uint64_t table_offset;     // node_count node_entry
+	};
+	static_assert(sizeof(header) == 64, "octree header layout changed, bump current_version");
+
+	struct node_entry
+	{
+		float bounds_min[3]; // the node's cube
+		float size;
+		uint64_t first_point;
+		uint32_t point_count;
+		uint32_t level;
+		uint32_t first_child; // children are consecutive, in octant order, one for each bit of child_mask
+		uint32_t child_mask;  // bit i set if the child in octant i (x + 2y + 4z) exists
+	};
+	static_assert(sizeof(node_entry) == 40, "octree node layout changed, bump current_version");
+
+	struct mapped_octree
+	{
+		std::shared_ptr<ply_utils::mapped_file> file;
+		header hdr;
+		const node_entry * nodes {nullptr};
+		const float * positions {nullptr};
+		const uint8_t * colours {nullptr};
+	};
+
+	inline bool is_octree_file(const std::string & path)
+	{
+		return point_format::has_magic(path, magic, sizeof(magic));
+	}
+
+	// Map an octree file and validate its header and node table, throws if it isn't usable
+	inline mapped_octree map_octree_file(const std::string & path)
+	{
+		mapped_octree octree;
+		octree.file = std::make_shared<ply_utils::mapped_file>(path);
+		const uint8_t * data = octree.file->data();
+		const size_t size = octree.file->size();
+		if (size < sizeof(header) || !point_format::has_magic(data, size, magic, sizeof(magic))) throw std::runtime_error(path + " isn't a point octree");
+
+		header & hdr = octree.hdr;
+		std::memcpy(&hdr, data, sizeof(header));
+		if (hdr.version != current_version) throw std::runtime_error(path + " has octree version " + std::to_string(hdr.version) + ", expected " + std::to_string(current_version));
+		if (hdr.positions_offset + 3 * sizeof(float) * hdr.point_count > size || hdr.colours_offset + 3 * sizeof(uint8_t) * hdr.point_count > size ||
+			hdr.table_offset + sizeof(node_entry) * uint64_t(hdr.node_count) > size || hdr.table_offset % alignof(node_entry) || hdr.node_count == 0)
+			throw std::runtime_error(path + " is truncated");
+
+		octree.nodes = reinterpret_cast<const node_entry*>(data + hdr.table_offset);
+		octree.positions = reinterpret_cast<const float*>(data + hdr.positions_offset);
+		octree.colours = data + hdr.colours_offset;
+		for (uint32_t i = 0; i < hdr.node_count; ++i)
+		{
+			const node_entry & node = octree.nodes[i];
+			if (node.first_point + node.point_count > hdr.point_count || (node.child_mask && (node.first_child <= i ||
+				uint64_t(node.first_child) + __builtin_popcount(node.child_mask) > hdr.node_count)))
+				throw std::runtime_error(path + " has a corrupt node table");
+		}
+
+		std::cout << "\t[octree_header] " << hdr.point_count << " points in " << hdr.node_count << " nodes" << std::endl;
+		return octree;
+	}
+
+	using point_format::read_function;
+
+	// Start a fresh pass over the source points, setting 'count' to how many there are. The build reads the
+	// source three times
+	typedef std::function<read_function(uint64_t & count)> open_function;
+
+	struct build_options
+	{
+		uint32_t node_capacity = 1 << 14; // a node with more points than this keeps a sample and splits the rest
+		uint32_t sample_grid = 64;        // which is one point per cell of a sample_grid^3 grid over the node
+		uint32_t max_level = 20;          // nodes this deep keep everything, however many points land in them
+		uint64_t chunk_points = 1 << 23;  // most points a thread indexes in memory at once, 32 bytes each
+		std::string temp_dir;             // for the chunk files, next to the output if empty
+		uint64_t seed = 1;
+	};
+
+	namespace detail
+	{
+		struct point
+		{
+			float position[3];
+			uint8_t colour[3];
+			uint8_t padding;
+		};
+		static_assert(sizeof(point) == 16, "octree build point should pack into 16 bytes");
+
+		// A node during the build. Its points are written to the node data file. For the roots of chunks and the
+		// levels above them, they're first written there as held points, until the levels above have taken their sample
+		struct build_node
+		{
+			float bounds_min[3];
+			float size;
+			uint32_t level;
+			uint64_t data_offset = 0; // in points
+			uint32_t point_count = 0;
+			uint64_t held_offset = 0; // in points
+			uint32_t held_count = 0;
+			uint32_t children[8];
+
+			build_node(const float min[3], const float node_size, const uint32_t node_level) : size(node_size), level(node_level)
+			{
+				std::copy_n(min, 3, bounds_min);
+				std::fill_n(children, 8, UINT32_MAX);
+			}
+
+			uint32_t octant(const float p[3]) const
+			{
+				const float half = 0.5f * size;
+				return uint32_t(p[0] >= bounds_min[0] + half) | (uint32_t(p[1] >= bounds_min[1] + half) << 1) | (uint32_t(p[2] >= bounds_min[2] + half) << 2);
+			}
+
+			void child_min(const uint32_t o, float min[3]) const
+			{
+				for (size_t k = 0; k < 3; ++k) min[k] = bounds_min[k] + ((o >> k) & 1) * 0.5f * size;
+			}
+		};
+
+		// Closes a descriptor however the scope ends
+		struct file_descriptor
+		{
+			int fd;
+			file_descriptor(const std::string & path, const int flags) : fd(::open(path.c_str(), flags, 0644))
+			{
+				if (fd < 0) throw std::runtime_error("could not open " + path);
+			}
+			~file_descriptor() { ::close(fd); }
+			file_descriptor(const file_descriptor &) = delete;
+			file_descriptor & operator=(const file_descriptor &) = delete;
+		};
+
+		inline void pwrite_all(const int fd, const void * data, const size_t size, const uint64_t offset)
+		{
+			for (size_t done = 0; done < size;)
+			{
+				const ssize_t n = ::pwrite(fd, static_cast<const uint8_t*>(data) + done, size - done, offset + done);
+				if (n <= 0) throw std::runtime_error("could not write octree data");
+				done += n;
+			}
+		}
+
+		inline void pread_all(const int fd, void * data, const size_t size, const uint64_t offset)
+		{
+			for (size_t done = 0; done < size;)
+			{
+				const ssize_t n = ::pread(fd, static_cast<uint8_t*>(data) + done, size - done, offset + done);
+				if (n <= 0) throw std::runtime_error("could not read octree data");
+				done += n;
+			}
+		}
+
+		// Feed every point of a fresh pass over the source to fn(positions, colours, n) in batches
+		template<typename Fn>
+		uint64_t for_each_batch(const open_function & open, Fn && fn)
+		{
+			uint64_t count = 0;
+			const read_function read = open(count);
+			constexpr size_t batch_size = 1 << 20;
+			std::vector<float> positions(3 * batch_size);
+			std::vector<uint8_t> colours(3 * batch_size);
+			uint64_t total = 0;
+			for (size_t n = 0; (n = read(batch_size, positions.data(), colours.data())) != 0; total += n) fn(positions.data(), colours.data(), n);
+			return total;
+		}
+
+		inline uint32_t grid_cell(const float v, const float min, const float size, const uint32_t cells)
+		{
+			const float c = (v - min) / size * cells;
+			return c > 0.f ? std::min(uint32_t(c), cells - 1) : 0;
+		}
+
+		// Indexes the points of one chunk into a subtree, writing every node's points to the shared node data file
+		// except the subtree root's, which is held for the levels above
+		struct chunk_indexer
+		{
+			const build_options & options;
+			const int data_fd;
+			std::atomic<uint64_t> & data_end;
+			std::vector<build_node> nodes;
+			std::vector<uint8_t> occupied; // sample_grid^3
+			std::vector<point> scratch;
+
+			chunk_indexer(const build_options & build, const int fd, std::atomic<uint64_t> & end)
+				: options(build), data_fd(fd), data_end(end), occupied(size_t(build.sample_grid) * build.sample_grid * build.sample_grid, 0) {}
+
+			void write_points(build_node & node, const point * points, const size_t count)
+			{
+				node.point_count = uint32_t(count);
+				node.data_offset = data_end.fetch_add(count);
+				pwrite_all(data_fd, points, sizeof(point) * count, sizeof(point) * node.data_offset);
+			}
+
+			void hold_points(build_node & node, const point * points, const size_t count)
+			{
+				node.held_count = uint32_t(count);
+				node.held_offset = data_end.fetch_add(count);
+				pwrite_all(data_fd, points, sizeof(point) * count, sizeof(point) * node.held_offset);
+			}
+
+			// Append the points 'node' holds to 'points'
+			void read_held(const build_node & node, std::vector<point> & points)
+			{
+				const size_t first = points.size();
+				points.resize(first + node.held_count);
+				pread_all(data_fd, points.data() + first, sizeof(point) * node.held_count, sizeof(point) * node.held_offset);
+			}
+
+			// Move one point per occupied cell of the node's sample grid to the front of 'points' (which are in
+			// random order, so that's a random one per cell), keeping the order of both parts. Returns the sample size
+			size_t sample(const build_node & node, point * points, const size_t count)
+			{
+				const uint32_t grid = options.sample_grid;
+				const auto cell_of = [&](const point & p)
+				{
+					size_t cell = 0;
+					for (size_t k = 0; k < 3; ++k) cell = cell * grid + grid_cell(p.position[k], node.bounds_min[k], node.size, grid);
+					return cell;
+				};
+
+				scratch.resize(std::max(scratch.size(), count));
+				size_t sampled = 0, rest = 0;
+				for (size_t i = 0; i < count; ++i)
+				{
+					uint8_t & taken = occupied[cell_of(points[i])];
+					if (!taken)
+					{
+						taken = 1;
+						points[sampled++] = points[i];
+					}
+					else scratch[rest++] = points[i];
+				}
+				for (size_t i = 0; i < sampled; ++i) occupied[cell_of(points[i])] = 0;
+				std::copy_n(scratch.data(), rest, points + sampled);
+				return sampled;
+			}
+
+			// Build the subtree over 'points' below nodes[index], recursively
+			void build(const uint32_t index, point * points, const size_t count, const bool hold)
+			{
+				if (count <= options.node_capacity || nodes[index].level >= options.max_level)
+				{
+					if (hold) hold_points(nodes[index], points, count);
+					else write_points(nodes[index], points, count);
+					return;
+				}
+
+				const size_t sampled = sample(nodes[index], points, count);
+				if (hold) hold_points(nodes[index], points, sampled);
+				else write_points(nodes[index], points, sampled);
+
+				// counting sort the rest by octant, keeping their random order, then recurse into each octant's run
+				point * rest = points + sampled;
+				const size_t rest_count = count - sampled;
+				size_t octant_begin[9] = {};
+				for (size_t i = 0; i < rest_count; ++i) ++octant_begin[nodes[index].octant(rest[i].position) + 1];
+				for (size_t o = 0; o < 8; ++o) octant_begin[o + 1] += octant_begin[o];
+				size_t next[8];
+				std::copy_n(octant_begin, 8, next);
+				scratch.resize(std::max(scratch.size(), rest_count));
+				for (size_t i = 0; i < rest_count; ++i) scratch[next[nodes[index].octant(rest[i].position)]++] = rest[i];
+				std::copy_n(scratch.data(), rest_count, rest);
+
+				for (uint32_t o = 0; o < 8; ++o)
+				{
+					const size_t n = octant_begin[o + 1] - octant_begin[o];
+					if (n == 0) continue;
+					float min[3];
+					nodes[index].child_min(o, min);
+					const uint32_t child = uint32_t(nodes.size());
+					nodes.emplace_back(min, 0.5f * nodes[index].size, nodes[index].level + 1);
+					nodes[index].children[o] = child;
+					build(child, rest + octant_begin[o], n, false);
+				}
+			}
+		};
+
+		// Deletes the build's temporary files however it ends
+		struct temp_directory
+		{
+			std::string path;
+			explicit temp_directory(const std::string & dir) : path(dir)
+			{
+				std::filesystem::create_directories(path);
+			}
+			~temp_directory()
+			{
+				std::error_code error;
+				std::filesystem::remove_all(path, error);
+			}
+		};
+	}
+
+	// Build an octree over the points 'open' reads into a file at 'path'
+	inline void write_octree(const std::string & path, const open_function & open, const build_options & options = build_options())
+	{
+		using namespace detail;
+		if (options.node_capacity == 0 || options.sample_grid == 0 || options.sample_grid > 1024 || options.chunk_points == 0)
+			throw std::runtime_error("invalid octree build options");
+
+		ply_utils::manual_timer build_timer;
+		build_timer.start();
+
+		// pass 1: the bounds, made a cube
+		float bounds_min[3] = { INFINITY, INFINITY, INFINITY };
+		float bounds_max[3] = { -INFINITY, -INFINITY, -INFINITY };
+		const uint64_t count = for_each_batch(open, [&](const float * positions, const uint8_t *, const size_t n)
+		{
+			float batch_min[3], batch_max[3];
+			cloud_stats::bounds(positions, n, batch_min, batch_max);
+			for (size_t k = 0; k < 3; ++k)
+			{
+				bounds_min[k] = std::min(bounds_min[k], batch_min[k]);
+				bounds_max[k] = std::max(bounds_max[k], batch_max[k]);
+			}
+		});
+		if (count == 0) throw std::runtime_error("no points to build an octree over");
+		float size = 0.f;
+		for (size_t k = 0; k < 3; ++k)
+		{
+			if (!std::isfinite(bounds_min[k]) || !std::isfinite(bounds_max[k])) throw std::runtime_error("points have non-finite positions");
+			size = std::max(size, bounds_max[k] - bounds_min[k]);
+		}
+		// a little over, so the points on the far faces still fall inside
+		size = size > 0.f ? size * 1.0001f : 1.f;
+
+		// pass 2: count the points in each cell of the counting grid, indexed by Morton code so that each level
+		// above is just the sums of runs of 8
+		const uint32_t count_bits = count > (uint64_t(1) << 29) ? 8 : 7;
+		const uint32_t count_cells = 1u << count_bits;
+		const auto fine_cell = [&](const float * p)
+		{
+			uint32_t cell[3];
+			for (size_t k = 0; k < 3; ++k) cell[k] = grid_cell(p[k], bounds_min[k], size, count_cells);
+			return point_order::morton_code(cell[0], cell[1], cell[2]);
+		};
+		std::vector<std::vector<uint64_t>> counts(count_bits + 1);
+		counts[count_bits].resize(size_t(1) << (3 * count_bits), 0);
+		{
+			std::vector<std::atomic<uint64_t>> fine_counts(size_t(1) << (3 * count_bits));
+			for_each_batch(open, [&](const float * positions, const uint8_t *, const size_t n)
+			{
+				parallel_utils::parallel_for(n, [&](const size_t begin, const size_t end)
+				{
+					for (size_t i = begin; i < end; ++i) fine_counts[fine_cell(positions + 3 * i)].fetch_add(1, std::memory_order_relaxed);
+				});
+			});
+			for (size_t c = 0; c < fine_counts.size(); ++c) counts[count_bits][c] = fine_counts[c].load(std::memory_order_relaxed);
+		}
+		for (uint32_t l = count_bits; l-- > 0;)
+		{
+			counts[l].resize(size_t(1) << (3 * l), 0);
+			for (size_t c = 0; c < counts[l + 1].size(); ++c) counts[l][c >> 3] += counts[l + 1][c];
+		}
+
+		// merge the grid into chunks, top down, splitting any cell with too many points
+		struct chunk { uint32_t level; uint64_t code; uint64_t count; };
+		std::vector<chunk> chunks;
+		std::vector<uint32_t> chunk_of(counts[count_bits].size());
+		for (std::vector<std::pair<uint32_t, uint64_t>> stack = { { 0, 0 } }; !stack.empty();)
+		{
+			const auto [level, code] = stack.back();
+			stack.pop_back();
+			const uint64_t n = counts[level][code];
+			if (n == 0) continue;
+			if (n <= options.chunk_points || level == count_bits)
+			{
+				const uint32_t shift = 3 * (count_bits - level);
+				std::fill(chunk_of.begin() + (code << shift), chunk_of.begin() + ((code + 1) << shift), uint32_t(chunks.size()));
+				chunks.push_back({ level, code, n });
+				if (n > options.chunk_points) std::cout << "\tan octree chunk has " << n << " points, more than the " << options.chunk_points << " asked for" << std::endl;
+				continue;
+			}
+			for (uint64_t o = 8; o-- > 0;) stack.push_back({ level + 1, (code << 3) | o });
+		}
+		counts = {};
+
+		const temp_directory temp(options.temp_dir.empty() ? path + ".parts" : options.temp_dir);
+		const auto chunk_path = [&](const size_t c) { return temp.path + "/chunk_" + std::to_string(c) + ".bin"; };
+
+		// pass 3: append every point to its chunk's file. Points are buffered per chunk, and a chunk's buffer is
+		// written out once it's full, or every buffer once they hold chunk_points between them, with the chunks'
+		// writes spread across all cores
+		{
+			constexpr size_t flush_points = 1 << 16;
+			std::vector<std::vector<point>> buffers(chunks.size());
+			std::vector<uint32_t> batch_chunks;
+			uint64_t buffered = 0;
+			const auto flush = [&](const bool all)
+			{
+				std::vector<uint32_t> flushed;
+				for (uint32_t c = 0; c < chunks.size(); ++c)
+				{
+					if (!buffers[c].empty() && (all || buffers[c].size() >= flush_points)) flushed.push_back(c);
+				}
+				std::mutex error_mutex;
+				std::string error;
+				parallel_utils::parallel_tasks(flushed.size(), [&](const size_t i)
+				{
+					const uint32_t c = flushed[i];
+					try
+					{
+						const file_descriptor file(chunk_path(c), O_WRONLY | O_CREAT | O_APPEND);
+						const ssize_t bytes = sizeof(point) * buffers[c].size();
+						if (::write(file.fd, buffers[c].data(), bytes) != bytes) throw std::runtime_error("could not write " + chunk_path(c));
+					}
+					catch (const std::exception & e)
+					{
+						const std::lock_guard<std::mutex> lock(error_mutex);
+						if (error.empty()) error = e.what();
+					}
+				});
+				if (!error.empty()) throw std::runtime_error(error);
+				for (const uint32_t c : flushed)
+				{
+					buffered -= buffers[c].size();
+					buffers[c] = {};
+				}
+			};
+			for_each_batch(open, [&](const float * positions, const uint8_t * colours, const size_t n)
+			{
+				batch_chunks.resize(n);
+				parallel_utils::parallel_for(n, [&](const size_t begin, const size_t end)
+				{
+					for (size_t i = begin; i < end; ++i) batch_chunks[i] = chunk_of[fine_cell(positions + 3 * i)];
+				});
+				for (size_t i = 0; i < n; ++i)
+				{
+					point p;
+					std::memcpy(p.position, positions + 3 * i, sizeof(p.position));
+					std::memcpy(p.colour, colours + 3 * i, sizeof(p.colour));
+					p.padding = 0;
+					buffers[batch_chunks[i]].push_back(p);
+				}
+				buffered += n;
+				flush(buffered >= options.chunk_points);
+			});
+			flush(true);
+		}
+		chunk_of = {};
+
+		// pass 4: index each chunk into a subtree on its own thread, the subtree roots held back for the levels above
+		const std::string data_path = temp.path + "/nodes.bin";
+		const file_descriptor data_file(data_path, O_RDWR | O_CREAT | O_TRUNC);
+		const int data_fd = data_file.fd;
+		std::atomic<uint64_t> data_end(0);
+
+		std::vector<std::vector<build_node>> chunk_nodes(chunks.size());
+		{
+			std::mutex error_mutex;
+			std::string error;
+			parallel_utils::parallel_tasks(chunks.size(), [&](const size_t c)
+			{
+				try
+				{
+					std::vector<point> points(chunks[c].count);
+					{
+						const file_descriptor file(chunk_path(c), O_RDONLY);
+						pread_all(file.fd, points.data(), sizeof(point) * points.size(), 0);
+					}
+					::unlink(chunk_path(c).c_str());
+
+					// a random order, so the first point to land in a sample cell is a random one
+					const uint64_t chunk_seed = shuffle_utils::counter_hash(options.seed, c);
+					for (size_t k = points.size(); k > 1; --k) std::swap(points[k - 1], points[shuffle_utils::below(shuffle_utils::counter_hash(chunk_seed, k), k)]);
+
+					float min[3];
+					const float chunk_size = size / float(1u << chunks[c].level);
+					for (size_t k = 0; k < 3; ++k)
+					{
+						uint32_t coord = 0;
+						for (uint32_t bit = 0; bit < chunks[c].level; ++bit) coord |= uint32_t((chunks[c].code >> (3 * bit + k)) & 1) << bit;
+						min[k] = bounds_min[k] + coord * chunk_size;
+					}
+					chunk_indexer indexer(options, data_fd, data_end);
+					indexer.nodes.emplace_back(min, chunk_size, chunks[c].level);
+					indexer.build(0, points.data(), points.size(), true);
+					chunk_nodes[c] = std::move(indexer.nodes);
+				}
+				catch (const std::exception & e)
+				{
+					const std::lock_guard<std::mutex> lock(error_mutex);
+					if (error.empty()) error = e.what();
+				}
+			});
+			if (!error.empty()) throw std::runtime_error(error);
+		}
+
+		// gather the subtrees into one list, with a node for every cell above the chunks that has any below it
+		std::vector<build_node> nodes;
+		std::map<std::pair<uint32_t, uint64_t>, uint32_t> upper; // (level, Morton code) of the nodes above chunks
+		std::vector<uint32_t> chunk_roots(chunks.size());
+		for (size_t c = 0; c < chunks.size(); ++c)
+		{
+			const uint32_t offset = uint32_t(nodes.size());
+			for (build_node & node : chunk_nodes[c])
+			{
+				for (uint32_t & child : node.children) if (child != UINT32_MAX) child += offset;
+				nodes.push_back(std::move(node));
+			}
+			chunk_nodes[c] = {};
+			chunk_roots[c] = offset;
+		}
+		uint32_t root = chunks.size() == 1 && chunks[0].level == 0 ? chunk_roots[0] : UINT32_MAX;
+		for (size_t c = 0; c < chunks.size(); ++c)
+		{
+			uint32_t child = chunk_roots[c];
+			uint64_t code = chunks[c].code;
+			for (uint32_t level = chunks[c].level; level-- > 0;)
+			{
+				const uint32_t octant = code & 7;
+				code >>= 3;
+				auto found = upper.find({ level, code });
+				const bool created = found == upper.end();
+				if (created)
+				{
+					const float node_size = size / float(1u << level);
+					float min[3];
+					for (size_t k = 0; k < 3; ++k)
+					{
+						uint32_t coord = 0;
+						for (uint32_t bit = 0; bit < level; ++bit) coord |= uint32_t((code >> (3 * bit + k)) & 1) << bit;
+						min[k] = bounds_min[k] + coord * node_size;
+					}
+					found = upper.emplace(std::make_pair(level, code), uint32_t(nodes.size())).first;
+					nodes.emplace_back(min, node_size, level);
+					if (level == 0) root = found->second;
+				}
+				nodes[found->second].children[octant] = child;
+				child = found->second;
+				if (!created) break;
+			}
+		}
+
+		// pass 5: the levels above the chunks, deepest first, each sampling from the points its children hold and
+		// handing the rest back to whichever child they came from, which then writes them. Only one node's worth of
+		// held points is read back at a time
+		{
+			chunk_indexer indexer(options, data_fd, data_end);
+			for (auto it = upper.rbegin(); it != upper.rend(); ++it)
+			{
+				build_node & node = nodes[it->second];
+				std::vector<point> gathered;
+				std::vector<uint8_t> from;
+				for (uint32_t o = 0; o < 8; ++o)
+				{
+					if (node.children[o] == UINT32_MAX) continue;
+					indexer.read_held(nodes[node.children[o]], gathered);
+					from.resize(gathered.size(), uint8_t(o));
+				}
+				// shuffle the points and where they came from together, then sample
+				const uint64_t node_seed = shuffle_utils::counter_hash(~options.seed, it->second);
+				for (size_t k = gathered.size(); k > 1; --k)
+				{
+					const size_t j = shuffle_utils::below(shuffle_utils::counter_hash(node_seed, k), k);
+					std::swap(gathered[k - 1], gathered[j]);
+					std::swap(from[k - 1], from[j]);
+				}
+				for (size_t i = 0; i < gathered.size(); ++i) gathered[i].padding = from[i];
+				// always a sample, even of few points: these are only what the children kept, not all below them
+				const size_t sampled = indexer.sample(node, gathered.data(), gathered.size());
+				indexer.hold_points(node, gathered.data(), sampled);
+
+				std::vector<point> returned[8];
+				for (size_t i = sampled; i < gathered.size(); ++i) returned[gathered[i].padding].push_back(gathered[i]);
+				for (uint32_t o = 0; o < 8; ++o)
+				{
+					if (node.children[o] != UINT32_MAX) indexer.write_points(nodes[node.children[o]], returned[o].data(), returned[o].size());
+				}
+			}
+			// what the root holds is already on disk, and is all it keeps
+			nodes[root].data_offset = nodes[root].held_offset;
+			nodes[root].point_count = nodes[root].held_count;
+		}
+
+		// breadth first order, children consecutive in octant order. A node that lost all its points to the levels
+		// above is kept all the same, so that its children stay reachable
+		std::vector<uint32_t> order = { root };
+		std::vector<node_entry> table;
+		uint64_t total = 0;
+		for (size_t q = 0; q < order.size(); ++q)
+		{
+			const build_node & node = nodes[order[q]];
+			node_entry entry = {};
+			std::copy_n(node.bounds_min, 3, entry.bounds_min);
+			entry.size = node.size;
+			entry.first_point = total;
+			entry.point_count = node.point_count;
+			entry.level = node.level;
+			entry.first_child = uint32_t(order.size());
+			for (uint32_t o = 0; o < 8; ++o)
+			{
+				if (node.children[o] == UINT32_MAX) continue;
+				entry.child_mask |= 1u << o;
+				order.push_back(node.children[o]);
+			}
+			if (!entry.child_mask) entry.first_child = 0;
+			table.push_back(entry);
+			total += node.point_count;
+		}
+		if (total != count) throw std::runtime_error("octree holds " + std::to_string(total) + " of " + std::to_string(count) + " points");
+
+		// pass 6: copy each node's points into place, shuffled, across all cores
+		header hdr = {};
+		std::memcpy(hdr.magic, magic, sizeof(magic));
+		hdr.version = current_version;
+		hdr.node_count = uint32_t(table.size());
+		hdr.point_count = count;
+		std::copy_n(bounds_min, 3, hdr.bounds_min);
+		hdr.size = size;
+		const auto align_up = [](const uint64_t v) { return (v + section_alignment - 1) & ~(section_alignment - 1); };
+		hdr.positions_offset = align_up(sizeof(header));
+		hdr.colours_offset = align_up(hdr.positions_offset + 3 * sizeof(float) * count);
+		hdr.table_offset = align_up(hdr.colours_offset + 3 * sizeof(uint8_t) * count);
+		const uint64_t file_size = hdr.table_offset + sizeof(node_entry) * table.size();
+
+		const std::string temp_path = path + ".tmp";
+		const int out_fd = ::open(temp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (out_fd < 0) throw std::runtime_error("could not create " + temp_path);
+		try
+		{
+			if (::ftruncate(out_fd, file_size) != 0) throw std::runtime_error("could not size " + temp_path);
+			std::mutex error_mutex;
+			std::string error;
+			parallel_utils::parallel_tasks(table.size(), [&](const size_t i)
+			{
+				try
+				{
+					const build_node & node = nodes[order[i]];
+					std::vector<point> points(node.point_count);
+					pread_all(data_fd, points.data(), sizeof(point) * points.size(), sizeof(point) * node.data_offset);
+					const uint64_t node_seed = shuffle_utils::counter_hash(options.seed ^ 0x5bd1e995u, i);
+					for (size_t k = points.size(); k > 1; --k) std::swap(points[k - 1], points[shuffle_utils::below(shuffle_utils::counter_hash(node_seed, k), k)]);
+
+					std::vector<float> positions(3 * points.size());
+					std::vector<uint8_t> colours(3 * points.size());
+					for (size_t p = 0; p < points.size(); ++p)
+					{
+						std::memcpy(&positions[3 * p], points[p].position, sizeof(points[p].position));
+						std::memcpy(&colours[3 * p], points[p].colour, sizeof(points[p].colour));
+					}
+					pwrite_all(out_fd, positions.data(), sizeof(float) * positions.size(), hdr.positions_offset + 3 * sizeof(float) * table[i].first_point);
+					pwrite_all(out_fd, colours.data(), colours.size(), hdr.colours_offset + 3 * table[i].first_point);
+				}
+				catch (const std::exception & e)
+				{
+					const std::lock_guard<std::mutex> lock(error_mutex);
+					if (error.empty()) error = e.what();
+				}
+			});
+			if (!error.empty()) throw std::runtime_error(error);
+			pwrite_all(out_fd, table.data(), sizeof(node_entry) * table.size(), hdr.table_offset);
+			pwrite_all(out_fd, &hdr, sizeof(hdr), 0);
+		}
+		catch (const std::exception &)
+		{
+			::close(out_fd);
+			::unlink(temp_path.c_str());
+			throw;
+		}
+		::close(out_fd);
+		if (std::rename(temp_path.c_str(), path.c_str()) != 0)
+		{
+			::unlink(temp_path.c_str());
+			throw std::runtime_error("could not move the octree into place at " + path);
+		}
+
+		build_timer.stop();
+		const float build_time = build_timer.get() / 1000.f;
+		std::cout << "\tbuilding an octree of " << table.size() << " nodes over " << count << " points from " << chunks.size() << " chunks in " << build_time
+			<< " seconds [" << (count / build_time) << " points per second] on " << parallel_utils::thread_count() << " threads" << std::endl;
+	}
+}
+
+#endif // OCTREE_CLOUD_H
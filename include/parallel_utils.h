@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Minimal helpers for splitting loader work across cores, std::thread only so there's nothing to link
+// beyond the platform threading library
+
+namespace parallel_utils
+{
+// Number of worker threads to use, never less than 1 even if the platform can't tell us
+inline size_t thread_count()
+{
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Set whilst a thread is running work handed out by parallel_for or parallel_tasks, so that nested calls run
+// inline on that thread rather than each spawning another full set of threads
+inline bool& in_parallel_region()
+{
+	thread_local bool inside = false;
+	return inside;
+}
+
+namespace detail
+{
+// Run fn on this thread marked as being inside a parallel region, restoring the mark afterwards
+template<typename Fn>
+void run_in_region(Fn&& fn)
+{
+	bool& inside = in_parallel_region();
+	const bool was_inside = inside;
+	inside = true;
+	fn();
+	inside = was_inside;
+}
+} // namespace detail
+
+// Split [0, count) into one contiguous range per thread and call fn(begin, end) on each, blocking until
+// every range is done. Ranges smaller than min_grain aren't worth a thread, so small counts just run inline,
+// as does anything called from inside another parallel_for or parallel_tasks.
+// fn must not throw, there's nowhere to propagate the exception to from a worker
+template<typename Fn>
+void parallel_for(const size_t count, Fn&& fn, const size_t min_grain = 1 << 14)
+{
+	const size_t num_threads = in_parallel_region()
+		? 1
+		: std::min(thread_count(), (count + min_grain - 1) / std::max<size_t>(min_grain, 1));
+	if(num_threads <= 1)
+	{
+		if(count)
+		{
+			fn(size_t(0), count);
+		}
+		return;
+	}
+
+	const size_t per_thread = (count + num_threads - 1) / num_threads;
+	std::vector<std::thread> workers;
+	workers.reserve(num_threads - 1);
+	for(size_t t = 1; t < num_threads; ++t)
+	{
+		const size_t begin = t * per_thread;
+		const size_t end = std::min(count, begin + per_thread);
+		if(begin < end)
+		{
+			workers.emplace_back(
+				[&fn, begin, end]() { detail::run_in_region([&]() { fn(begin, end); }); });
+		}
+	}
+	// the calling thread takes the first range rather than sitting idle
+	detail::run_in_region([&]() { fn(size_t(0), std::min(count, per_thread)); });
+
+	for(auto& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+// Call fn(i) for every i in [0, count) across all threads, handing indices out one at a time so that tasks of
+// uneven size (files of different lengths, say) still balance. Any parallel_for inside fn runs inline on its
+// task's thread. fn must not throw
+template<typename Fn>
+void parallel_tasks(const size_t count, Fn&& fn)
+{
+	std::atomic<size_t> next {0};
+	const auto work = [&]() {
+		detail::run_in_region([&]() {
+			for(size_t i = next++; i < count; i = next++)
+			{
+				fn(i);
+			}
+		});
+	};
+
+	const size_t num_threads = in_parallel_region() ? 1 : std::min(thread_count(), count);
+	std::vector<std::thread> workers;
+	for(size_t t = 1; t < num_threads; ++t)
+	{
+		workers.emplace_back(work);
+	}
+	work();
+
+	for(auto& worker : workers)
+	{
+		worker.join();
+	}
+}
+} // namespace parallel_utils
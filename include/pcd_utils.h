@@ -0,0 +1,437 @@
+#ifndef PCD_UTILS_H
+#define PCD_UTILS_H
+
+// mapped_file, strided_view, manual_timer, the AVX2 kernels and the ascii tokenising helpers are shared with
+// the ply loader
+#include "ply_utils.h"
+
+#include <string>
+
+// Reader for PCL's .pcd point clouds (v0.7 and the v0.6 files without a VERSION line), in all three of its
+// encodings: ascii rows, binary (fixed size records, one per point) and binary_compressed (an LZF compressed
+// block holding each field's values for every point contiguously, one field after another). Positions come from
+// the x, y, z fields and colours from a packed 'rgb' or 'rgba' field, 0x00RRGGBB stored in 4 bytes which PCL
+// usually types as a float.
+
+namespace pcd_utils
+{
+	struct pcd_field
+	{
+		std::string name;
+		char type {'F'};   // F(loat), I(nt) or U(nsigned)
+		size_t size {4};   // bytes per value
+		size_t count {1};  // values per point
+		size_t offset {0}; // within a binary record, or in multiples of the point count for binary_compressed
+	};
+
+	struct mapped_pcd
+	{
+		enum data_encoding { ascii, binary, binary_compressed };
+
+		std::shared_ptr<ply_utils::mapped_file> file;
+		std::string file_path;
+		data_encoding encoding {ascii};
+		std::vector<pcd_field> fields;
+		size_t record_size {0};
+		size_t point_count {0};
+		const uint8_t * body {nullptr}; // everything after the DATA line
+		size_t body_size {0};
+		int position_fields[3] {-1, -1, -1};
+		int colour_field {-1};
+	};
+
+	namespace detail
+	{
+		inline std::vector<std::string> split_words(const std::string & line)
+		{
+			std::vector<std::string> words;
+			std::istringstream stream(line);
+			for (std::string word; stream >> word;) words.push_back(word);
+			return words;
+		}
+
+		inline bool is_header_keyword(const std::string & word)
+		{
+			static const std::vector<std::string> keywords = { "VERSION", "FIELDS", "COLUMNS", "SIZE", "TYPE", "COUNT", "WIDTH", "HEIGHT", "VIEWPOINT", "POINTS", "DATA" };
+			return std::find(keywords.begin(), keywords.end(), word) != keywords.end();
+		}
+	}
+
+	// True if the first line of 'path' that isn't a comment is a pcd header line
+	inline bool is_pcd_file(const std::string & path)
+	{
+		std::ifstream file(path, std::ios::binary);
+		for (std::string line; std::getline(file, line);)
+		{
+			if (line.empty() || line[0] == '#') continue;
+			const auto words = detail::split_words(line);
+			return !words.empty() && detail::is_header_keyword(words[0]);
+		}
+		return false;
+	}
+
+	// Map a pcd file and parse its header, throws if the points can't be decoded
+	inline mapped_pcd map_pcd_file(const std::string & filepath)
+	{
+		mapped_pcd pcd;
+		pcd.file = std::make_shared<ply_utils::mapped_file>(filepath);
+		pcd.file_path = filepath;
+
+		const char * begin = (const char*)pcd.file->data();
+		const char * end = begin + pcd.file->size();
+		const char * p = begin;
+		size_t width = 0, height = 1;
+		bool has_points = false, has_data = false;
+		std::vector<size_t> sizes, counts;
+		std::vector<char> types;
+
+		while (p < end && !has_data)
+		{
+			const char * line_end = ply_utils::detail::next_line(p, end);
+			const auto words = detail::split_words(std::string(p, line_end));
+			p = line_end;
+			if (words.empty() || words[0][0] == '#') continue;
+
+			const std::string & key = words[0];
+			const size_t num_values = words.size() - 1;
+			if (key == "FIELDS" || key == "COLUMNS")
+			{
+				for (size_t i = 1; i < words.size(); ++i) pcd.fields.push_back(pcd_field { words[i] });
+			}
+			else if (key == "SIZE") for (size_t i = 1; i < words.size(); ++i) sizes.push_back(std::stoul(words[i]));
+			else if (key == "TYPE") for (size_t i = 1; i < words.size(); ++i) types.push_back(words[i][0]);
+			else if (key == "COUNT") for (size_t i = 1; i < words.size(); ++i) counts.push_back(std::stoul(words[i]));
+			else if (key == "WIDTH" && num_values) width = std::stoul(words[1]);
+			else if (key == "HEIGHT" && num_values) height = std::stoul(words[1]);
+			else if (key == "POINTS" && num_values)
+			{
+				pcd.point_count = std::stoul(words[1]);
+				has_points = true;
+			}
+			else if (key == "DATA" && num_values)
+			{
+				if (words[1] == "ascii") pcd.encoding = mapped_pcd::ascii;
+				else if (words[1] == "binary") pcd.encoding = mapped_pcd::binary;
+				else if (words[1] == "binary_compressed") pcd.encoding = mapped_pcd::binary_compressed;
+				else throw std::runtime_error("unsupported pcd data encoding " + words[1]);
+				has_data = true;
+			}
+			else if (!detail::is_header_keyword(key)) throw std::runtime_error("unexpected pcd header line starting " + key);
+		}
+
+		if (!has_data) throw std::runtime_error(filepath + " has no DATA line");
+		if (!has_points) pcd.point_count = width * height;
+		if (pcd.fields.empty() || sizes.size() != pcd.fields.size() || types.size() != pcd.fields.size() || (!counts.empty() && counts.size() != pcd.fields.size()))
+			throw std::runtime_error("pcd FIELDS, SIZE, TYPE and COUNT don't line up");
+
+		static const std::vector<std::string> position_keys = { "x", "y", "z" };
+		for (size_t f = 0; f < pcd.fields.size(); ++f)
+		{
+			pcd_field & field = pcd.fields[f];
+			field.size = sizes[f];
+			field.type = types[f];
+			field.count = counts.empty() ? 1 : counts[f];
+			field.offset = pcd.record_size;
+			pcd.record_size += field.size * field.count;
+
+			for (size_t k = 0; k < 3; ++k)
+			{
+				if (field.name != position_keys[k]) continue;
+				if (field.type != 'F' || (field.size != 4 && field.size != 8) || field.count != 1) throw std::runtime_error("unsupported pcd position field " + field.name);
+				pcd.position_fields[k] = int(f);
+			}
+			if (field.name == "rgb" || field.name == "rgba")
+			{
+				if (field.size != 4 || field.count != 1) throw std::runtime_error("unsupported pcd colour field " + field.name);
+				pcd.colour_field = int(f);
+			}
+		}
+		if (pcd.position_fields[0] < 0 || pcd.position_fields[1] < 0 || pcd.position_fields[2] < 0) throw std::runtime_error("pcd has no x, y, z fields");
+
+		pcd.body = (const uint8_t*)p;
+		pcd.body_size = end - p;
+		if (pcd.encoding == mapped_pcd::binary && pcd.body_size < pcd.point_count * pcd.record_size)
+			throw std::runtime_error(filepath + " is truncated, expected " + std::to_string(pcd.point_count) + " binary records");
+
+		static const char * encoding_names[] = { "ascii", "binary", "binary_compressed" };
+		std::cout << "\t[pcd_header] " << pcd.point_count << " points, " << encoding_names[pcd.encoding] << ", fields";
+		for (const auto & field : pcd.fields) std::cout << " " << field.name << "(" << field.type << field.size << (field.count > 1 ? "x" + std::to_string(field.count) : "") << ")";
+		std::cout << std::endl;
+
+		return pcd;
+	}
+
+	namespace detail
+	{
+		// Decompress a complete LZF block (as written by liblzf's lzf_compress), throws unless it expands to exactly
+		// 'out_size' bytes. Each control byte is either a literal run of up to 32 bytes, or a back reference of
+		// 3 - 264 bytes into the output produced so far
+		inline void lzf_decompress(const uint8_t * in, const size_t in_size, uint8_t * out, const size_t out_size)
+		{
+			const uint8_t * ip = in, * in_end = in + in_size;
+			uint8_t * op = out, * out_end = out + out_size;
+			while (ip < in_end)
+			{
+				const size_t ctrl = *ip++;
+				if (ctrl < 32)
+				{
+					const size_t length = ctrl + 1;
+					if (size_t(in_end - ip) < length || size_t(out_end - op) < length) throw std::runtime_error("lzf literal run overflows");
+					std::memcpy(op, ip, length);
+					op += length;
+					ip += length;
+				}
+				else
+				{
+					size_t length = ctrl >> 5;
+					if (length == 7)
+					{
+						if (ip >= in_end) throw std::runtime_error("lzf block ends mid reference");
+						length += *ip++;
+					}
+					if (ip >= in_end) throw std::runtime_error("lzf block ends mid reference");
+					const size_t distance = ((ctrl & 0x1f) << 8) + *ip++ + 1;
+					length += 2;
+					if (distance > size_t(op - out) || size_t(out_end - op) < length) throw std::runtime_error("lzf back reference out of range");
+					// the source and destination can overlap, which repeats the last 'distance' bytes, so copy bytewise
+					const uint8_t * ref = op - distance;
+					for (size_t i = 0; i < length; ++i) op[i] = ref[i];
+					op += length;
+				}
+			}
+			if (op != out_end) throw std::runtime_error("lzf block expanded to " + std::to_string(op - out) + " bytes, expected " + std::to_string(out_size));
+		}
+
+		// where one field's value for point i lives, data + i * stride
+		struct field_view
+		{
+			const uint8_t * data {nullptr};
+			size_t stride {0};
+			size_t size {0};
+		};
+
+		struct point_views
+		{
+			field_view position[3];
+			field_view colour;
+		};
+
+		// records are either interleaved (binary) or one array per field (decompressed binary_compressed)
+		inline point_views make_point_views(const mapped_pcd & pcd, const uint8_t * data, const bool per_field_arrays)
+		{
+			const auto view = [&](const int f)
+			{
+				const pcd_field & field = pcd.fields[f];
+				return per_field_arrays
+					? field_view { data + field.offset * pcd.point_count, field.size * field.count, field.size }
+					: field_view { data + field.offset, pcd.record_size, field.size };
+			};
+			point_views views;
+			for (size_t k = 0; k < 3; ++k) views.position[k] = view(pcd.position_fields[k]);
+			if (pcd.colour_field >= 0) views.colour = view(pcd.colour_field);
+			return views;
+		}
+
+		inline void unpack_rgb(const uint32_t packed, uint8_t * colour)
+		{
+			colour[0] = uint8_t(packed >> 16);
+			colour[1] = uint8_t(packed >> 8);
+			colour[2] = uint8_t(packed);
+		}
+
+		inline void decode_point_rows(const point_views & views, const size_t first, const size_t count, float * positions, uint8_t * colours)
+		{
+			// interleaved float xyz is the same layout the ply kernels gather from
+			size_t done = 0;
+			const field_view & x = views.position[0];
+			const bool packed_xyz = views.position[1].data == x.data + x.size && views.position[2].data == x.data + 2 * x.size &&
+				views.position[1].stride == x.stride && views.position[2].stride == x.stride;
+		#ifdef PLY_UTILS_AVX2_KERNELS
+			if (packed_xyz && ply_utils::detail::has_avx2())
+			{
+				const ply_utils::strided_view xyz { x.data, x.stride, first + count, x.size == 4 ? tinyply::Type::FLOAT32 : tinyply::Type::FLOAT64 };
+				done = (x.size == 4)
+					? ply_utils::detail::decode_positions_f32_avx2(xyz, false, first, count, positions)
+					: ply_utils::detail::decode_positions_f64_avx2(xyz, false, first, count, positions);
+			}
+		#else
+			(void)packed_xyz;
+		#endif
+			for (size_t k = 0; k < 3; ++k)
+			{
+				const field_view & v = views.position[k];
+				const uint8_t * src = v.data + (first + done) * v.stride;
+				if (v.size == 4) for (size_t i = done; i < count; ++i, src += v.stride) positions[3 * i + k] = ply_utils::detail::load_scalar<float>(src, false);
+				else for (size_t i = done; i < count; ++i, src += v.stride) positions[3 * i + k] = float(ply_utils::detail::load_scalar<double>(src, false));
+			}
+
+			if (!views.colour.data)
+			{
+				std::memset(colours, 255, 3 * count);
+				return;
+			}
+			const uint8_t * src = views.colour.data + first * views.colour.stride;
+			for (size_t i = 0; i < count; ++i, src += views.colour.stride) unpack_rgb(ply_utils::detail::load_scalar<uint32_t>(src, false), colours + 3 * i);
+		}
+
+		// Parse one ascii point row starting at 'p', returns the start of the next line
+		inline const char * parse_ascii_row(const mapped_pcd & pcd, const char * p, const char * end, float * position, uint8_t * colour, bool & ok)
+		{
+			using namespace ply_utils::detail;
+			for (size_t f = 0; f < pcd.fields.size(); ++f)
+			{
+				const int field = int(f);
+				if (field == pcd.position_fields[0] || field == pcd.position_fields[1] || field == pcd.position_fields[2])
+				{
+					const size_t k = (field == pcd.position_fields[0]) ? 0 : (field == pcd.position_fields[1]) ? 1 : 2;
+					if (pcd.fields[f].size == 4) p = parse_token(p, end, position[k], ok);
+					else
+					{
+						double value = 0.0;
+						p = parse_token(p, end, value, ok);
+						position[k] = float(value);
+					}
+				}
+				else if (field == pcd.colour_field)
+				{
+					// PCL writes the packed colour as an integer, older writers print the float it aliases
+					p = skip_blanks(p, end);
+					const char * token_end = skip_token(p, end);
+					uint32_t packed = 0;
+					const auto result = std::from_chars(p, token_end, packed);
+					if (result.ec != std::errc() || result.ptr != token_end)
+					{
+						float aliased = 0.0f;
+						parse_token(p, token_end, aliased, ok);
+						std::memcpy(&packed, &aliased, sizeof(packed));
+					}
+					unpack_rgb(packed, colour);
+					p = token_end;
+				}
+				else for (size_t c = 0; c < pcd.fields[f].count; ++c) p = skip_token(p, end);
+			}
+			return next_line(p, end);
+		}
+	}
+
+	// Decode 'count' binary records that were read into memory at 'records' instead of going through the mapping
+	inline void decode_point_records(const mapped_pcd & pcd, const uint8_t * records, const size_t count, float * positions, uint8_t * colours)
+	{
+		const detail::point_views views = detail::make_point_views(pcd, records, false);
+		parallel_utils::parallel_for(count, [&](const size_t begin, const size_t end)
+		{
+			detail::decode_point_rows(views, begin, end - begin, positions + 3 * begin, colours + 3 * begin);
+		});
+	}
+
+	// Hands out the points of a mapped pcd file in consecutive batches, each batch decoded across all cores. A
+	// binary_compressed file is decompressed in one go when the reader is made, since LZF can only be expanded
+	// front to back, the per field arrays are then decoded in parallel like any other batch
+	class point_batch_reader
+	{
+		mapped_pcd pcd;
+		size_t next_row {0};
+		std::vector<uint8_t> decompressed;
+		detail::point_views views;
+		// ascii files only
+		const char * cursor {nullptr};
+		const char * end {nullptr};
+		std::vector<const char*> line_starts;
+
+	public:
+		explicit point_batch_reader(mapped_pcd mapped) : pcd(std::move(mapped))
+		{
+			if (pcd.encoding == mapped_pcd::ascii)
+			{
+				cursor = (const char*)pcd.body;
+				end = cursor + pcd.body_size;
+			}
+			else if (pcd.encoding == mapped_pcd::binary)
+			{
+				views = detail::make_point_views(pcd, pcd.body, false);
+			}
+			else
+			{
+				if (pcd.body_size < 8) throw std::runtime_error("binary_compressed block has no size header");
+				const size_t compressed_size = ply_utils::detail::load_scalar<uint32_t>(pcd.body, false);
+				const size_t uncompressed_size = ply_utils::detail::load_scalar<uint32_t>(pcd.body + 4, false);
+				if (compressed_size > pcd.body_size - 8) throw std::runtime_error("binary_compressed block is truncated");
+				if (uncompressed_size != pcd.point_count * pcd.record_size) throw std::runtime_error("binary_compressed block doesn't hold " + std::to_string(pcd.point_count) + " points");
+
+				ply_utils::manual_timer decompress_timer;
+				decompress_timer.start();
+				decompressed.resize(uncompressed_size);
+				detail::lzf_decompress(pcd.body + 8, compressed_size, decompressed.data(), decompressed.size());
+				decompress_timer.stop();
+				const float size_mb = uncompressed_size * float(1e-6);
+				const float decompress_time = decompress_timer.get() / 1000.f;
+				std::cout << "\tdecompressing " << compressed_size * float(1e-6) << "mb to " << size_mb << "mb in " << decompress_time << " seconds ["
+					<< (size_mb / decompress_time) << " MBps]" << std::endl;
+
+				views = detail::make_point_views(pcd, decompressed.data(), true);
+			}
+		}
+
+		size_t total_rows() const { return pcd.point_count; }
+		size_t rows_read() const { return next_row; }
+
+		// Decode up to 'max_rows' more points into packed positions and colours, returns the number decoded, which is
+		// 0 once the file is exhausted. Throws on malformed ascii rows.
+		size_t read(const size_t max_rows, float * positions, uint8_t * colours)
+		{
+			const size_t count = std::min(max_rows, pcd.point_count - next_row);
+			if (pcd.encoding != mapped_pcd::ascii)
+			{
+				parallel_utils::parallel_for(count, [&](const size_t begin, const size_t last)
+				{
+					detail::decode_point_rows(views, next_row + begin, last - begin, positions + 3 * begin, colours + 3 * begin);
+				});
+			}
+			else
+			{
+				line_starts.resize(count + 1);
+				for (size_t i = 0; i < count; ++i)
+				{
+					line_starts[i] = cursor;
+					cursor = ply_utils::detail::next_line(cursor, end);
+				}
+				line_starts[count] = cursor;
+				if (count && line_starts[count - 1] == end) throw std::runtime_error("ascii body has fewer rows than the point count");
+
+				std::atomic<bool> malformed { false };
+				parallel_utils::parallel_for(count, [&](const size_t begin, const size_t last)
+				{
+					bool ok = true;
+					for (size_t i = begin; i < last; ++i)
+					{
+						if (pcd.colour_field < 0) std::memset(colours + 3 * i, 255, 3);
+						detail::parse_ascii_row(pcd, line_starts[i], line_starts[i + 1], positions + 3 * i, colours + 3 * i, ok);
+					}
+					if (!ok) malformed = true;
+				}, 1 << 12);
+				if (malformed) throw std::runtime_error("malformed token in ascii point rows");
+			}
+			next_row += count;
+			return count;
+		}
+	};
+
+	// Decode every point across all cores into packed arrays of 3 * point_count floats and bytes. Goes through
+	// the batch reader so that ascii files only ever index a batch's worth of lines at a time
+	inline void decode_points(const mapped_pcd & pcd, float * positions, uint8_t * colours)
+	{
+		ply_utils::manual_timer decode_timer;
+		decode_timer.start();
+		point_batch_reader reader(pcd);
+		constexpr size_t batch_size = 1 << 22;
+		for (size_t first = 0, n = 0; (n = reader.read(batch_size, positions + 3 * first, colours + 3 * first)) != 0; first += n) {}
+		decode_timer.stop();
+
+		const float size_mb = pcd.body_size * float(1e-6);
+		const float decode_time = decode_timer.get() / 1000.f;
+		std::cout << "\tdecoding " << size_mb << "mb in " << decode_time << " seconds [" << (size_mb / decode_time) << " MBps] on "
+			<< parallel_utils::thread_count() << " threads" << std::endl;
+	}
+}
+
+#endif // PCD_UTILS_H
@@ -13,6 +13,23 @@
 #include <iostream>
 #include <cstring>
 #include <iterator>
+#include <algorithm>
+#include <stdexcept>
+#include <atomic>
+#include <charconv>
+
+#if defined(__x86_64__) || defined(__i386__)
+	#include <immintrin.h>
+	#define PLY_UTILS_AVX2_KERNELS 1
+#endif
+
+#include "io_utils.h"
+#include "parallel_utils.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace ply_utils
 {
@@ -57,21 +74,685 @@ namespace ply_utils
 		const double & get() { return timestamp; }
 	};
 
-	inline std::vector<uint8_t> read_file_binary(const std::string & pathToFile)
+	// Read-only memory mapping of a whole file. Pages are faulted in lazily and stay evictable, so the mapping
+	// doesn't count towards the resident set the way a heap copy of the file would
+	class mapped_file
+	{
+		uint8_t * bytes {nullptr};
+		size_t num_bytes {0};
+	public:
+		explicit mapped_file(const std::string & pathToFile)
+		{
+			const int fd = ::open(pathToFile.c_str(), O_RDONLY);
+			if (fd < 0) throw std::runtime_error("could not open file descriptor to path " + pathToFile);
+
+			struct stat file_stat;
+			if (::fstat(fd, &file_stat) != 0)
+			{
+				::close(fd);
+				throw std::runtime_error("could not stat path " + pathToFile);
+			}
+			num_bytes = file_stat.st_size;
+
+			void * ptr = num_bytes ? ::mmap(nullptr, num_bytes, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+			::close(fd); // the mapping keeps its own reference to the file
+			if (ptr == MAP_FAILED) throw std::runtime_error("could not mmap path " + pathToFile);
+			bytes = static_cast<uint8_t*>(ptr);
+
+			// the payload is consumed front to back, so ask for aggressive readahead
+			if (bytes) ::madvise(bytes, num_bytes, MADV_SEQUENTIAL);
+		}
+
+		~mapped_file() { if (bytes) ::munmap(bytes, num_bytes); }
+
+		mapped_file(const mapped_file &) = delete;
+		mapped_file & operator=(const mapped_file &) = delete;
+
+		const uint8_t * data() const { return bytes; }
+		size_t size() const { return num_bytes; }
+
+		// Reading the rows out of order (gathering them through a permutation, say) wants random access advice
+		// instead, and the whole file read ahead, as readahead and drop behind would only work against it
+		void advise_random_access() const
+		{
+			if (!bytes) return;
+			::madvise(bytes, num_bytes, MADV_RANDOM);
+			::madvise(bytes, num_bytes, MADV_WILLNEED);
+		}
+	};
+
+	// A run of consecutive, identically typed properties (e.g. x, y, z) repeated every 'stride' bytes
+	struct strided_view
+	{
+		const uint8_t * data {nullptr}; // first byte of the first property of row 0
+		size_t stride {0};
+		size_t count {0};
+		tinyply::Type type {tinyply::Type::INVALID};
+
+		explicit operator bool() const { return data != nullptr; }
+	};
+
+	// The header of a mapped ply file, along with views of the vertex payload, which point into the mapping
+	// and are only valid while 'file' is alive
+	struct mapped_ply
+	{
+		std::shared_ptr<mapped_file> file;
+		std::string file_path;
+		bool is_binary {false};
+		bool is_big_endian {false};
+		size_t payload_offset {0};   // first byte after end_header
+		const uint8_t * vertex_data {nullptr}; // first byte of the vertex element, binary files only
+		size_t vertex_count {0};
+		size_t vertex_stride {0};    // bytes per vertex row, binary files only
+		strided_view positions;      // x, y, z
+		strided_view colours;        // red, green, blue
+		std::vector<tinyply::PlyProperty> vertex_properties;
+		size_t leading_rows {0};     // rows of any elements preceding the vertices, i.e. lines to skip in ascii files
+	};
+
+	inline void print_header(tinyply::PlyFile & file)
+	{
+		std::cout << "\t[ply_header] Type: " << (file.is_binary_file() ? "binary" : "ascii") << std::endl;
+		for (const auto & c : file.get_comments()) std::cout << "\t[ply_header] Comment: " << c << std::endl;
+		for (const auto & c : file.get_info()) std::cout << "\t[ply_header] Info: " << c << std::endl;
+
+		for (const auto & e : file.get_elements())
+		{
+			std::cout << "\t[ply_header] element: " << e.name << " (" << e.size << ")" << std::endl;
+			for (const auto & p : e.properties)
+			{
+				std::cout << "\t[ply_header] \tproperty: " << p.name << " (type=" << tinyply::PropertyTable[p.propertyType].str << ")";
+				if (p.isList) std::cout << " (list_type=" << tinyply::PropertyTable[p.listType].str << ")";
+				std::cout << std::endl;
+			}
+		}
+	}
+
+	// Find 'keys' as a run of consecutive properties sharing one type, returns an empty view if they aren't laid out
+	// that way (or don't exist at all)
+	inline strided_view make_strided_view(const tinyply::PlyElement & element, const std::vector<std::string> & keys,
+		const uint8_t * element_data, const size_t row_stride)
+	{
+		size_t offset = 0;
+		for (size_t i = 0; i < element.properties.size(); ++i)
+		{
+			const auto & first = element.properties[i];
+			if (first.name == keys.front())
+			{
+				if (i + keys.size() > element.properties.size()) return {};
+				for (size_t k = 0; k < keys.size(); ++k)
+				{
+					const auto & p = element.properties[i + k];
+					if (p.name != keys[k] || p.propertyType != first.propertyType || p.isList) return {};
+				}
+				return { element_data + offset, row_stride, element.size, first.propertyType };
+			}
+			offset += tinyply::PropertyTable[first.propertyType].stride;
+		}
+		return {};
+	}
+
+	// Map a ply file and parse its header with tinyply. For binary files with a fixed stride vertex element, the
+	// positions and colours are exposed as strided views straight into the mapping, nothing is copied
+	inline mapped_ply map_ply_file(const std::string & filepath)
 	{
-		std::ifstream file(pathToFile, std::ios::binary);
-		std::vector<uint8_t> fileBufferBytes;
+		mapped_ply ply;
+		ply.file = std::make_shared<mapped_file>(filepath);
+		ply.file_path = filepath;
 
-		if (file.is_open())
+		memory_stream header_stream((const char*)ply.file->data(), ply.file->size());
+		tinyply::PlyFile file;
+		if (!file.parse_header(header_stream)) throw std::runtime_error("unexpected header field in " + filepath);
+		print_header(file);
+
+		ply.is_binary = file.is_binary_file();
+		ply.is_big_endian = file.impl->isBigEndian;
+		ply.payload_offset = header_stream.tellg();
+
+		// skip over any fixed size elements before the vertices, anything containing a list has a variable size
+		// and would need a full parse to step over
+		size_t element_offset = ply.payload_offset;
+		for (const auto & e : file.get_elements())
 		{
-			file.seekg(0, std::ios::end);
-			size_t sizeBytes = file.tellg();
-			file.seekg(0, std::ios::beg);
-			fileBufferBytes.resize(sizeBytes);
-			if (file.read((char*)fileBufferBytes.data(), sizeBytes)) return fileBufferBytes;
+			size_t row_stride = 0;
+			bool has_list = false;
+			for (const auto & p : e.properties)
+			{
+				row_stride += tinyply::PropertyTable[p.propertyType].stride;
+				has_list |= p.isList;
+			}
+
+			if (e.name == "vertex")
+			{
+				ply.vertex_count = e.size;
+				ply.vertex_properties = e.properties;
+				if (!ply.is_binary) break;
+				if (has_list) throw std::runtime_error("vertex element has list properties, rows aren't fixed stride");
+				if (element_offset + e.size * row_stride > ply.file->size()) throw std::runtime_error("vertex payload is truncated in " + filepath);
+
+				ply.vertex_data = ply.file->data() + element_offset;
+				ply.vertex_stride = row_stride;
+				ply.positions = make_strided_view(e, { "x", "y", "z" }, ply.vertex_data, row_stride);
+				ply.colours = make_strided_view(e, { "red", "green", "blue" }, ply.vertex_data, row_stride);
+				break;
+			}
+
+			if (has_list && ply.is_binary) throw std::runtime_error("element " + e.name + " precedes the vertices and has list properties");
+			element_offset += e.size * row_stride;
+			ply.leading_rows += e.size;
 		}
-		else throw std::runtime_error("could not open binary ifstream to path " + pathToFile);
-		return fileBufferBytes;
+
+		return ply;
+	}
+
+	namespace detail
+	{
+		template<typename T> inline T load_scalar(const uint8_t * src, const bool swap)
+		{
+			uint8_t bytes[sizeof(T)];
+			for (size_t b = 0; b < sizeof(T); ++b) bytes[b] = src[swap ? sizeof(T) - 1 - b : b];
+			T value;
+			std::memcpy(&value, bytes, sizeof(T));
+			return value;
+		}
+
+		// the renderer stores 8 bits per channel, wider channels keep their most significant bits
+		inline uint8_t to_colour(const uint8_t value) { return value; }
+		inline uint8_t to_colour(const uint16_t value) { return uint8_t(value >> 8); }
+
+		template<typename T>
+		inline void decode_positions_scalar(const strided_view & view, const bool swap, const size_t first, const size_t count, float * positions)
+		{
+			const uint8_t * src = view.data + first * view.stride;
+			for (size_t i = 0; i < count; ++i, src += view.stride)
+			{
+				for (size_t k = 0; k < 3; ++k) positions[3 * i + k] = float(load_scalar<T>(src + k * sizeof(T), swap));
+			}
+		}
+
+		template<typename T>
+		inline void decode_colours_scalar(const strided_view & view, const bool swap, const size_t first, const size_t count, uint8_t * colours)
+		{
+			const uint8_t * src = view.data + first * view.stride;
+			for (size_t i = 0; i < count; ++i, src += view.stride)
+			{
+				for (size_t k = 0; k < 3; ++k) colours[3 * i + k] = to_colour(load_scalar<T>(src + k * sizeof(T), swap));
+			}
+		}
+
+	#ifdef PLY_UTILS_AVX2_KERNELS
+		// The AVX2 kernels gather 8 rows at a time, with the gather offsets laid out so that the loaded lanes are
+		// already in packed xyz/rgb order, meaning no transpose is needed before the store. Each returns the number of
+		// rows it handled, the scalar path finishes off the remainder.
+
+		// byte reversal within each 32 or 64 bit lane, for big endian payloads
+		__attribute__((target("avx2"))) inline __m256i bswap32_avx2(const __m256i v)
+		{
+			const __m256i mask = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+				3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+			return _mm256_shuffle_epi8(v, mask);
+		}
+
+		__attribute__((target("avx2"))) inline __m256i bswap64_avx2(const __m256i v)
+		{
+			const __m256i mask = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+				7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+			return _mm256_shuffle_epi8(v, mask);
+		}
+
+		__attribute__((target("avx2")))
+		inline size_t decode_positions_f32_avx2(const strided_view & view, const bool swap, const size_t first, const size_t count, float * positions)
+		{
+			// output float j of each block of 8 rows comes from row j / 3, component j % 3
+			alignas(32) int32_t offsets[24];
+			for (int j = 0; j < 24; ++j) offsets[j] = int32_t((j / 3) * view.stride + (j % 3) * sizeof(float));
+			const __m256i idx0 = _mm256_load_si256((const __m256i*)(offsets + 0));
+			const __m256i idx1 = _mm256_load_si256((const __m256i*)(offsets + 8));
+			const __m256i idx2 = _mm256_load_si256((const __m256i*)(offsets + 16));
+
+			const uint8_t * src = view.data + first * view.stride;
+			size_t row = 0;
+			for (; row + 8 <= count; row += 8, src += 8 * view.stride)
+			{
+				__m256i a = _mm256_i32gather_epi32((const int*)src, idx0, 1);
+				__m256i b = _mm256_i32gather_epi32((const int*)src, idx1, 1);
+				__m256i c = _mm256_i32gather_epi32((const int*)src, idx2, 1);
+				if (swap) { a = bswap32_avx2(a); b = bswap32_avx2(b); c = bswap32_avx2(c); }
+				_mm256_storeu_si256((__m256i*)(positions + 3 * row + 0), a);
+				_mm256_storeu_si256((__m256i*)(positions + 3 * row + 8), b);
+				_mm256_storeu_si256((__m256i*)(positions + 3 * row + 16), c);
+			}
+			return row;
+		}
+
+		__attribute__((target("avx2")))
+		inline size_t decode_positions_f64_avx2(const strided_view & view, const bool swap, const size_t first, const size_t count, float * positions)
+		{
+			// 6 gathers of 4 doubles per block of 8 rows, narrowed to float as they're stored
+			alignas(16) int32_t offsets[24];
+			for (int j = 0; j < 24; ++j) offsets[j] = int32_t((j / 3) * view.stride + (j % 3) * sizeof(double));
+			__m128i idx[6];
+			for (int k = 0; k < 6; ++k) idx[k] = _mm_load_si128((const __m128i*)(offsets + 4 * k));
+
+			const uint8_t * src = view.data + first * view.stride;
+			size_t row = 0;
+			for (; row + 8 <= count; row += 8, src += 8 * view.stride)
+			{
+				for (int k = 0; k < 6; ++k)
+				{
+					__m256i v = _mm256_i32gather_epi64((const long long*)src, idx[k], 1);
+					if (swap) v = bswap64_avx2(v);
+					_mm_storeu_ps(positions + 3 * row + 4 * k, _mm256_cvtpd_ps(_mm256_castsi256_pd(v)));
+				}
+			}
+			return row;
+		}
+
+		// the colour gathers read a few bytes past the blue channel, so they stop short of the last row of the
+		// element, which could sit right at the end of the mapping
+		inline size_t overread_safe_rows(const strided_view & view, const size_t first, const size_t count)
+		{
+			return (first + 1 < view.count) ? std::min(count, view.count - 1 - first) : 0;
+		}
+
+		__attribute__((target("avx2")))
+		inline size_t decode_colours_u8_avx2(const strided_view & view, const size_t first, const size_t count, uint8_t * colours)
+		{
+			const int32_t s = int32_t(view.stride);
+			const __m256i idx = _mm256_setr_epi32(0, s, 2 * s, 3 * s, 4 * s, 5 * s, 6 * s, 7 * s);
+			// pack the low 3 bytes of each dword, per 128 bit lane
+			const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+				0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+			const size_t safe_rows = overread_safe_rows(view, first, count);
+			const uint8_t * src = view.data + first * view.stride;
+			size_t row = 0;
+			for (; row + 8 <= safe_rows; row += 8, src += 8 * view.stride)
+			{
+				const __m256i v = _mm256_shuffle_epi8(_mm256_i32gather_epi32((const int*)src, idx, 1), pack);
+				alignas(32) uint8_t packed[32];
+				_mm256_store_si256((__m256i*)packed, v);
+				std::memcpy(colours + 3 * row, packed, 12);
+				std::memcpy(colours + 3 * row + 12, packed + 16, 12);
+			}
+			return row;
+		}
+
+		__attribute__((target("avx2")))
+		inline size_t decode_colours_u16_avx2(const strided_view & view, const bool swap, const size_t first, const size_t count, uint8_t * colours)
+		{
+			const int32_t s = int32_t(view.stride);
+			const __m128i idx0 = _mm_setr_epi32(0, s, 2 * s, 3 * s);
+			const __m128i idx1 = _mm_setr_epi32(4 * s, 5 * s, 6 * s, 7 * s);
+			// keep the most significant byte of each channel, which comes first in big endian files
+			const __m256i pack = swap
+				? _mm256_setr_epi8(0, 2, 4, 8, 10, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+					0, 2, 4, 8, 10, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)
+				: _mm256_setr_epi8(1, 3, 5, 9, 11, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+					1, 3, 5, 9, 11, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+
+			const size_t safe_rows = overread_safe_rows(view, first, count);
+			const uint8_t * src = view.data + first * view.stride;
+			size_t row = 0;
+			for (; row + 8 <= safe_rows; row += 8, src += 8 * view.stride)
+			{
+				alignas(32) uint8_t lanes[64];
+				_mm256_store_si256((__m256i*)(lanes + 0), _mm256_shuffle_epi8(_mm256_i32gather_epi64((const long long*)src, idx0, 1), pack));
+				_mm256_store_si256((__m256i*)(lanes + 32), _mm256_shuffle_epi8(_mm256_i32gather_epi64((const long long*)src, idx1, 1), pack));
+				// each 16 byte lane now starts with 2 packed rgb triplets
+				for (size_t lane = 0; lane < 4; ++lane) std::memcpy(colours + 3 * row + 6 * lane, lanes + 16 * lane, 6);
+			}
+			return row;
+		}
+
+		inline bool has_avx2()
+		{
+			static const bool supported = __builtin_cpu_supports("avx2");
+			return supported;
+		}
+	#endif // PLY_UTILS_AVX2_KERNELS
+	}
+
+	// Throws if the vertex element of 'ply' can't be handled by decode_vertex_rows, call before handing it to workers
+	inline void check_decodable(const mapped_ply & ply)
+	{
+		if (!ply.is_binary || !ply.vertex_data) throw std::runtime_error("vertex payload isn't mapped as fixed stride binary");
+		if (!ply.positions) throw std::runtime_error("vertex element has no consecutive x, y, z properties");
+		if (ply.positions.type != tinyply::Type::FLOAT32 && ply.positions.type != tinyply::Type::FLOAT64)
+			throw std::runtime_error("unsupported position type " + tinyply::PropertyTable[ply.positions.type].str);
+		if (ply.colours && ply.colours.type != tinyply::Type::UINT8 && ply.colours.type != tinyply::Type::UINT16)
+			throw std::runtime_error("unsupported colour type " + tinyply::PropertyTable[ply.colours.type].str);
+	}
+
+	// Convert 'count' vertex rows starting at row 'first' into packed float xyz and uchar rgb, written to the
+	// start of 'positions' and 'colours'. Files without colours decode to white.
+	inline void decode_vertex_rows(const mapped_ply & ply, const size_t first, const size_t count, float * positions, uint8_t * colours)
+	{
+		const bool swap = ply.is_big_endian;
+		size_t done = 0;
+
+		if (ply.positions.type == tinyply::Type::FLOAT32)
+		{
+		#ifdef PLY_UTILS_AVX2_KERNELS
+			if (detail::has_avx2()) done = detail::decode_positions_f32_avx2(ply.positions, swap, first, count, positions);
+		#endif
+			detail::decode_positions_scalar<float>(ply.positions, swap, first + done, count - done, positions + 3 * done);
+		}
+		else
+		{
+		#ifdef PLY_UTILS_AVX2_KERNELS
+			if (detail::has_avx2()) done = detail::decode_positions_f64_avx2(ply.positions, swap, first, count, positions);
+		#endif
+			detail::decode_positions_scalar<double>(ply.positions, swap, first + done, count - done, positions + 3 * done);
+		}
+
+		done = 0;
+		if (!ply.colours)
+		{
+			std::memset(colours, 255, 3 * count);
+		}
+		else if (ply.colours.type == tinyply::Type::UINT8)
+		{
+		#ifdef PLY_UTILS_AVX2_KERNELS
+			if (detail::has_avx2()) done = detail::decode_colours_u8_avx2(ply.colours, first, count, colours);
+		#endif
+			detail::decode_colours_scalar<uint8_t>(ply.colours, swap, first + done, count - done, colours + 3 * done);
+		}
+		else
+		{
+		#ifdef PLY_UTILS_AVX2_KERNELS
+			if (detail::has_avx2()) done = detail::decode_colours_u16_avx2(ply.colours, swap, first, count, colours);
+		#endif
+			detail::decode_colours_scalar<uint16_t>(ply.colours, swap, first + done, count - done, colours + 3 * done);
+		}
+	}
+
+	namespace detail
+	{
+		inline const char * skip_blanks(const char * p, const char * end)
+		{
+			while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+			return p;
+		}
+
+		inline const char * skip_token(const char * p, const char * end)
+		{
+			p = skip_blanks(p, end);
+			while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') ++p;
+			return p;
+		}
+
+		template<typename T> inline const char * parse_token(const char * p, const char * end, T & value, bool & ok)
+		{
+			p = skip_blanks(p, end);
+			// from_chars doesn't take the leading '+' some writers emit, though a second sign after it is still malformed
+			if (end - p > 1 && *p == '+' && p[1] != '-' && p[1] != '+') ++p;
+			const auto result = std::from_chars(p, end, value);
+			ok &= result.ec == std::errc();
+			return result.ptr;
+		}
+
+		inline const char * next_line(const char * p, const char * end)
+		{
+			const char * newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+			return newline ? newline + 1 : end;
+		}
+
+		// what to do with each token of an ascii vertex row
+		struct ascii_property
+		{
+			enum { skip, position, colour } role {skip};
+			size_t component {0};
+			tinyply::PlyProperty property;
+		};
+
+		inline std::vector<ascii_property> make_ascii_properties(const mapped_ply & ply)
+		{
+			static const std::vector<std::string> position_keys = { "x", "y", "z" };
+			static const std::vector<std::string> colour_keys = { "red", "green", "blue" };
+
+			std::vector<ascii_property> properties;
+			for (const auto & p : ply.vertex_properties)
+			{
+				ascii_property a { ascii_property::skip, 0, p };
+				for (size_t k = 0; k < 3; ++k)
+				{
+					if (p.isList) continue;
+					if (p.name == position_keys[k]) a = { ascii_property::position, k, p };
+					if (p.name == colour_keys[k]) a = { ascii_property::colour, k, p };
+				}
+				if (a.role == ascii_property::colour && p.propertyType != tinyply::Type::UINT8 && p.propertyType != tinyply::Type::UINT16)
+					throw std::runtime_error("unsupported colour type " + tinyply::PropertyTable[p.propertyType].str);
+				properties.push_back(a);
+			}
+
+			const size_t num_positions = std::count_if(properties.begin(), properties.end(), [](const ascii_property & a) { return a.role == ascii_property::position; });
+			if (num_positions != 3) throw std::runtime_error("vertex element has no x, y, z properties");
+			return properties;
+		}
+
+		// Parse one vertex row starting at 'p', returns the start of the next line
+		inline const char * parse_ascii_row(const std::vector<ascii_property> & properties, const char * p, const char * end,
+			float * position, uint8_t * colour, bool & ok)
+		{
+			for (const auto & a : properties)
+			{
+				if (a.property.isList)
+				{
+					size_t length = 0;
+					p = parse_token(p, end, length, ok);
+					for (size_t i = 0; i < length; ++i) p = skip_token(p, end);
+				}
+				else if (a.role == ascii_property::position)
+				{
+					if (a.property.propertyType == tinyply::Type::FLOAT32) p = parse_token(p, end, position[a.component], ok);
+					else
+					{
+						double value = 0.0;
+						p = parse_token(p, end, value, ok);
+						position[a.component] = float(value);
+					}
+				}
+				else if (a.role == ascii_property::colour)
+				{
+					// out of range values are clamped to the property type's largest rather than wrapped
+					uint32_t value = 0;
+					p = parse_token(p, end, value, ok);
+					colour[a.component] = (a.property.propertyType == tinyply::Type::UINT16) ? to_colour(uint16_t(std::min<uint32_t>(value, UINT16_MAX)))
+						: uint8_t(std::min<uint32_t>(value, UINT8_MAX));
+				}
+				else p = skip_token(p, end);
+			}
+			return next_line(p, end);
+		}
+	}
+
+	// Parse the vertex rows of an ascii ply file across all cores. The body is split into one chunk per thread on
+	// line boundaries, lines are counted per chunk to find each chunk's first row, then every chunk is parsed
+	// straight into its slice of the packed outputs.
+	inline void parse_ascii_vertices(const mapped_ply & ply, float * positions, uint8_t * colours)
+	{
+		const auto properties = detail::make_ascii_properties(ply);
+		bool has_colours = false;
+		for (const auto & a : properties) has_colours |= a.role == detail::ascii_property::colour;
+
+		// step over the rows of any elements before the vertices
+		const char * end = (const char*)ply.file->data() + ply.file->size();
+		const char * body = (const char*)ply.file->data() + ply.payload_offset;
+		for (size_t i = 0; i < ply.leading_rows; ++i) body = detail::next_line(body, end);
+
+		manual_timer parse_timer;
+		parse_timer.start();
+
+		const size_t num_chunks = std::max<size_t>(1, std::min<size_t>(parallel_utils::thread_count(), (end - body) >> 16));
+		std::vector<const char*> chunk_begin(num_chunks + 1, end);
+		chunk_begin[0] = body;
+		for (size_t c = 1; c < num_chunks; ++c)
+		{
+			const char * guess = std::max(chunk_begin[c - 1], body + (end - body) * c / num_chunks);
+			chunk_begin[c] = (guess == body) ? body : detail::next_line(guess - 1, end);
+		}
+
+		// first pass, count the rows in each chunk to get the row each chunk starts at
+		std::vector<size_t> chunk_row(num_chunks + 1, 0);
+		parallel_utils::parallel_for(num_chunks, [&](const size_t begin, const size_t last)
+		{
+			for (size_t c = begin; c < last; ++c)
+			{
+				const char * first = chunk_begin[c], * stop = chunk_begin[c + 1];
+				size_t rows = std::count(first, stop, '\n');
+				if (stop > first && stop[-1] != '\n') ++rows; // no trailing newline at the end of the file
+				chunk_row[c + 1] = rows;
+			}
+		}, 1);
+		for (size_t c = 0; c < num_chunks; ++c) chunk_row[c + 1] += chunk_row[c];
+		if (chunk_row[num_chunks] < ply.vertex_count) throw std::runtime_error("ascii body has fewer rows than the vertex count");
+
+		// second pass, parse each chunk into place
+		std::atomic<bool> malformed { false };
+		parallel_utils::parallel_for(num_chunks, [&](const size_t begin, const size_t last)
+		{
+			for (size_t c = begin; c < last; ++c)
+			{
+				bool ok = true;
+				const char * p = chunk_begin[c];
+				for (size_t row = chunk_row[c]; row < std::min(chunk_row[c + 1], ply.vertex_count); ++row)
+				{
+					p = detail::parse_ascii_row(properties, p, chunk_begin[c + 1], positions + 3 * row, colours + 3 * row, ok);
+					if (!has_colours) std::memset(colours + 3 * row, 255, 3);
+				}
+				if (!ok) malformed = true;
+			}
+		}, 1);
+		if (malformed) throw std::runtime_error("malformed token in ascii vertex rows");
+
+		parse_timer.stop();
+		const float size_mb = (end - body) * float(1e-6);
+		const float parse_time = parse_timer.get() / 1000.f;
+		std::cout << "\t[ply_header] ascii body: " << size_mb << "mb in " << num_chunks << " chunks" << std::endl;
+		std::cout << "\tparsing " << size_mb << "mb in " << parse_time << " seconds [" << (size_mb / parse_time) << " MBps] on "
+			<< parallel_utils::thread_count() << " threads" << std::endl;
+	}
+
+	// Hands out the vertex rows of a mapped ply file in consecutive batches, so a cloud can be decoded and shown
+	// progressively rather than all at once. Each batch is still decoded across all cores.
+	class vertex_batch_reader
+	{
+		mapped_ply ply;
+		size_t next_row {0};
+		// ascii files only
+		std::vector<detail::ascii_property> properties;
+		bool has_colours {false};
+		const char * cursor {nullptr};
+		const char * end {nullptr};
+		std::vector<const char*> line_starts;
+	public:
+		explicit vertex_batch_reader(mapped_ply mapped) : ply(std::move(mapped))
+		{
+			if (ply.is_binary)
+			{
+				check_decodable(ply);
+				return;
+			}
+
+			properties = detail::make_ascii_properties(ply);
+			for (const auto & a : properties) has_colours |= a.role == detail::ascii_property::colour;
+			end = (const char*)ply.file->data() + ply.file->size();
+			cursor = (const char*)ply.file->data() + ply.payload_offset;
+			for (size_t i = 0; i < ply.leading_rows; ++i) cursor = detail::next_line(cursor, end);
+		}
+
+		size_t total_rows() const { return ply.vertex_count; }
+		size_t rows_read() const { return next_row; }
+
+		// Decode up to 'max_rows' more rows into packed positions and colours, returns the number of rows decoded,
+		// which is 0 once the vertex element is exhausted. Throws on malformed ascii rows.
+		size_t read(const size_t max_rows, float * positions, uint8_t * colours)
+		{
+			const size_t count = std::min(max_rows, ply.vertex_count - next_row);
+			if (ply.is_binary)
+			{
+				parallel_utils::parallel_for(count, [&](const size_t begin, const size_t last)
+				{
+					decode_vertex_rows(ply, next_row + begin, last - begin, positions + 3 * begin, colours + 3 * begin);
+				});
+			}
+			else
+			{
+				// finding line starts is a cheap memchr per row, the parsing is what's worth spreading out
+				line_starts.resize(count + 1);
+				for (size_t i = 0; i < count; ++i)
+				{
+					line_starts[i] = cursor;
+					cursor = detail::next_line(cursor, end);
+				}
+				line_starts[count] = cursor;
+				if (count && line_starts[count - 1] == end) throw std::runtime_error("ascii body has fewer rows than the vertex count");
+
+				std::atomic<bool> malformed { false };
+				parallel_utils::parallel_for(count, [&](const size_t begin, const size_t last)
+				{
+					bool ok = true;
+					for (size_t i = begin; i < last; ++i)
+					{
+						detail::parse_ascii_row(properties, line_starts[i], line_starts[i + 1], positions + 3 * i, colours + 3 * i, ok);
+						if (!has_colours) std::memset(colours + 3 * i, 255, 3);
+					}
+					if (!ok) malformed = true;
+				}, 1 << 12);
+				if (malformed) throw std::runtime_error("malformed token in ascii vertex rows");
+			}
+			next_row += count;
+			return count;
+		}
+	};
+
+	// Decode the whole vertex element across all cores into packed arrays of 3 * vertex_count floats and bytes,
+	// ascii files go through parse_ascii_vertices
+	inline void decode_vertices(const mapped_ply & ply, float * positions, uint8_t * colours)
+	{
+		if (!ply.is_binary) return parse_ascii_vertices(ply, positions, colours);
+
+		check_decodable(ply);
+
+		manual_timer decode_timer;
+		decode_timer.start();
+		parallel_utils::parallel_for(ply.vertex_count, [&](const size_t begin, const size_t end)
+		{
+			decode_vertex_rows(ply, begin, end - begin, positions + 3 * begin, colours + 3 * begin);
+		});
+		decode_timer.stop();
+
+		const float size_mb = ply.vertex_count * ply.vertex_stride * float(1e-6);
+		const float decode_time = decode_timer.get() / 1000.f;
+		std::cout << "\tdecoding " << size_mb << "mb in " << decode_time << " seconds [" << (size_mb / decode_time) << " MBps] on "
+			<< parallel_utils::thread_count() << " threads" << std::endl;
+	}
+
+	// Decode 'count' vertex rows that were read into memory at 'rows' (by an io_utils::record_reader, say) instead of
+	// going through the mapping, the row layout is taken from 'ply'
+	inline void decode_vertex_records(const mapped_ply & ply, const uint8_t * rows, const size_t count, float * positions, uint8_t * colours)
+	{
+		mapped_ply rebased;
+		rebased.is_binary = true;
+		rebased.is_big_endian = ply.is_big_endian;
+		rebased.vertex_data = rows;
+		rebased.vertex_count = count;
+		rebased.vertex_stride = ply.vertex_stride;
+		rebased.positions = { rows + (ply.positions.data - ply.vertex_data), ply.vertex_stride, count, ply.positions.type };
+		if (ply.colours) rebased.colours = { rows + (ply.colours.data - ply.vertex_data), ply.vertex_stride, count, ply.colours.type };
+
+		parallel_utils::parallel_for(count, [&](const size_t begin, const size_t end)
+		{
+			decode_vertex_rows(rebased, begin, end - begin, positions + 3 * begin, colours + 3 * begin);
+		});
+	}
+
+	inline std::vector<uint8_t> read_file_binary(const std::string & pathToFile)
+	{
+		// large aligned reads that overlap with each other, rather than whatever the ifstream decides to do
+		try { return io_utils::read_file(pathToFile); }
+		catch (const std::exception & e) { throw std::runtime_error("could not read binary file " + pathToFile + ": " + e.what()); }
 	}
 
 	void read_ply_file(
@@ -95,7 +776,8 @@ namespace ply_utils
 			}
 			else
 			{
-				file_stream.reset(new std::ifstream(filepath, std::ios::binary));
+				// reads the next blocks in the background while tinyply parses the current one
+				file_stream.reset(new io_utils::pipelined_istream(filepath));
 			}
 
 			if (!file_stream || file_stream->fail()) throw std::runtime_error("file_stream failed to open " + filepath);
@@ -107,20 +789,7 @@ namespace ply_utils
 			tinyply::PlyFile file;
 			file.parse_header(*file_stream);
 
-			std::cout << "\t[ply_header] Type: " << (file.is_binary_file() ? "binary" : "ascii") << std::endl;
-			for (const auto & c : file.get_comments()) std::cout << "\t[ply_header] Comment: " << c << std::endl;
-			for (const auto & c : file.get_info()) std::cout << "\t[ply_header] Info: " << c << std::endl;
-
-			for (const auto & e : file.get_elements())
-			{
-				std::cout << "\t[ply_header] element: " << e.name << " (" << e.size << ")" << std::endl;
-				for (const auto & p : e.properties)
-				{
-					std::cout << "\t[ply_header] \tproperty: " << p.name << " (type=" << tinyply::PropertyTable[p.propertyType].str << ")";
-					if (p.isList) std::cout << " (list_type=" << tinyply::PropertyTable[p.listType].str << ")";
-					std::cout << std::endl;
-				}
-			}
+			print_header(file);
 
 			// Because most people have their own mesh types, tinyply treats parsed data as structured/typed byte buffers.
 			// See examples below on how to marry your own application-specific data structures with this one.
@@ -180,6 +849,39 @@ namespace ply_utils
 			std::cerr << "Caught tinyply exception: " << e.what() << std::endl;
 		}
 	}
+
+	// Cross-check packed positions and colours produced by the fast paths against a full tinyply parse of the same
+	// file, returns the number of vertices that differ
+	inline size_t verify_vertices(const std::string & filepath, const float * positions, const uint8_t * colours, const size_t count)
+	{
+		std::shared_ptr<tinyply::PlyData> vertex_data, colour_data;
+		read_ply_file(filepath, vertex_data, colour_data);
+		if (!vertex_data || vertex_data->count != count)
+		{
+			std::cerr << "\t[verify] tinyply read " << (vertex_data ? vertex_data->count : 0) << " vertices, expected " << count << std::endl;
+			return count;
+		}
+
+		size_t mismatches = 0;
+		for (size_t i = 0; i < count; ++i)
+		{
+			bool same = true;
+			for (size_t k = 0; k < 3; ++k)
+			{
+				const size_t n = 3 * i + k;
+				const float position = (vertex_data->t == tinyply::Type::FLOAT64)
+					? float(reinterpret_cast<const double*>(vertex_data->buffer.get())[n])
+					: reinterpret_cast<const float*>(vertex_data->buffer.get())[n];
+				uint8_t colour = 255;
+				if (colour_data && colour_data->t == tinyply::Type::UINT16) colour = detail::to_colour(reinterpret_cast<const uint16_t*>(colour_data->buffer.get())[n]);
+				else if (colour_data) colour = colour_data->buffer.get()[n];
+				same &= (position == positions[n]) && (colour == colours[n]);
+			}
+			if (!same && mismatches++ < 10) std::cerr << "\t[verify] vertex " << i << " differs from tinyply" << std::endl;
+		}
+		std::cout << "\t[verify] " << (count - mismatches) << " / " << count << " vertices match tinyply" << std::endl;
+		return mismatches;
+	}
 }
 
 #endif // PLY_UTILS_H
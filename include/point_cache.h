@@ -0,0 +1,285 @@
+#ifndef POINT_CACHE_H
+#define POINT_CACHE_H
+
+#include "cloud_stats.h"
+#include "ply_utils.h"
+#include "point_format.h"
+#include "shuffle_utils.h"
+
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A native, ready to upload point format, so a cloud only pays for parsing and shuffling once. The file is a
+// fixed header followed by page aligned sections of packed float xyz positions and uchar rgb colours, already
+// in their final order, so loading it is a mmap and two buffer uploads. Integers and floats are native (little)
+// endian. Caches are written next to their source as '<source>.pcrc', and record the source's size and
+// modification time so that a stale one is ignored (the total size and newest time of all of them, for a cache
+// built from several files), which order their points are in and the seed it was drawn from so that a load
+// asking for a different one doesn't get it.
+
+namespace point_cache
+{
+	constexpr char magic[8] = { 'P', 'C', 'R', 'C', 'A', 'C', 'H', 'E' };
+	constexpr uint32_t current_version = 3;
+	constexpr uint64_t section_alignment = 4096;
+
+	// Exactly one of the order flags is set, plus filtered if the cache doesn't hold every source point
+	enum flags : uint32_t
+	{
+		shuffled = 1 << 0,      // a uniform shuffle
+		morton_blocks = 1 << 1, // see point_order::block_shuffled_morton_order
+		hierarchical = 1 << 2,  // see point_order::hierarchical_order
+		filtered = 1 << 3,      // duplicates or points sharing a voxel were dropped
+	};
+
+	struct header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t flags;
+		uint64_t point_count;
+		float bounds_min[3];
+		float bounds_max[3];
+		uint64_t positions_offset; // packed float xyz, point_count * 12 bytes
+		uint64_t colours_offset;   // packed uchar rgb, point_count * 3 bytes
+		uint64_t source_size;      // of the files the cache was built from, all together
+		int64_t source_mtime;      // the newest of them
+		uint64_t seed;             // the order was drawn from, 0 if it isn't known
+	};
+	static_assert(sizeof(header) == 88, "cache header layout changed, bump current_version");
+
+	inline uint64_t align_up(const uint64_t value) { return (value + section_alignment - 1) & ~(section_alignment - 1); }
+
+	inline std::string sidecar_path(const std::string & source_path) { return source_path + ".pcrc"; }
+
+	struct mapped_cache
+	{
+		std::shared_ptr<ply_utils::mapped_file> file;
+		header hdr;
+		const float * positions {nullptr};
+		const uint8_t * colours {nullptr};
+	};
+
+	// Map a cache file and validate its header, throws if it isn't a usable cache
+	inline mapped_cache map_cache(const std::string & path)
+	{
+		mapped_cache cache;
+		cache.file = std::make_shared<ply_utils::mapped_file>(path);
+		if (cache.file->size() < sizeof(header) || !point_format::has_magic(cache.file->data(), cache.file->size(), magic, sizeof(magic))) throw std::runtime_error(path + " isn't a point cache");
+
+		std::memcpy(&cache.hdr, cache.file->data(), sizeof(header));
+		if (cache.hdr.version != current_version) throw std::runtime_error(path + " has cache version " + std::to_string(cache.hdr.version) + ", expected " + std::to_string(current_version));
+
+		const uint64_t count = cache.hdr.point_count;
+		if (cache.hdr.positions_offset % section_alignment || cache.hdr.colours_offset % section_alignment ||
+			cache.hdr.positions_offset + 3 * sizeof(float) * count > cache.file->size() ||
+			cache.hdr.colours_offset + 3 * sizeof(uint8_t) * count > cache.file->size())
+			throw std::runtime_error(path + " is truncated or has overlapping sections");
+
+		cache.positions = reinterpret_cast<const float*>(cache.file->data() + cache.hdr.positions_offset);
+		cache.colours = cache.file->data() + cache.hdr.colours_offset;
+		return cache;
+	}
+
+	inline bool is_cache_file(const std::string & path)
+	{
+		return point_format::has_magic(path, magic, sizeof(magic));
+	}
+
+	// The total size and newest modification time of 'source_paths', false if any of them can't be stat'd
+	inline bool stat_sources(const std::vector<std::string> & source_paths, uint64_t & size, int64_t & mtime)
+	{
+		size = 0;
+		mtime = 0;
+		for (const std::string & source_path : source_paths)
+		{
+			struct stat source_stat;
+			if (::stat(source_path.c_str(), &source_stat) != 0) return false;
+			size += uint64_t(source_stat.st_size);
+			mtime = std::max(mtime, int64_t(source_stat.st_mtime));
+		}
+		return !source_paths.empty();
+	}
+
+	// True if 'cache_path' is a valid cache built from the current contents of every one of 'source_paths', and
+	// if 'seed' is given (not 0), with its points in the order drawn from that seed
+	inline bool is_current(const std::string & cache_path, const std::vector<std::string> & source_paths, const uint64_t seed = 0)
+	{
+		uint64_t source_size = 0;
+		int64_t source_mtime = 0;
+		if (!stat_sources(source_paths, source_size, source_mtime) || ::access(cache_path.c_str(), R_OK) != 0) return false;
+		try
+		{
+			const header hdr = map_cache(cache_path).hdr;
+			// a sidecar stands in for a plain load of its source, so it has to hold all of it, shuffled
+			return hdr.source_size == source_size && hdr.source_mtime == source_mtime && hdr.flags == shuffled && (seed == 0 || hdr.seed == seed);
+		}
+		catch (const std::exception &) { return false; }
+	}
+
+	inline bool is_current(const std::string & cache_path, const std::string & source_path, const uint64_t seed = 0)
+	{
+		return is_current(cache_path, std::vector<std::string>{ source_path }, seed);
+	}
+
+	namespace detail
+	{
+		// A cache being written through a shared mapping of a temporary path, renamed into place by commit(), so a
+		// failed or interrupted write never leaves a half written cache
+		struct cache_output
+		{
+			header hdr;
+			std::string temp_path, cache_path;
+			uint8_t * out {nullptr};
+			uint64_t file_size {0};
+
+			cache_output(const std::vector<std::string> & source_paths, const uint64_t count, const std::string & path, const uint32_t flags, const uint64_t seed)
+				: cache_path(path)
+			{
+				if (!stat_sources(source_paths, hdr.source_size, hdr.source_mtime)) throw std::runtime_error("could not stat the sources of " + path);
+
+				std::memcpy(hdr.magic, magic, sizeof(magic));
+				hdr.version = current_version;
+				hdr.flags = flags;
+				hdr.point_count = count;
+				hdr.positions_offset = align_up(sizeof(header));
+				hdr.colours_offset = align_up(hdr.positions_offset + 3 * sizeof(float) * count);
+				hdr.seed = seed;
+				file_size = hdr.colours_offset + 3 * sizeof(uint8_t) * count;
+
+				temp_path = cache_path + ".tmp";
+				const int fd = ::open(temp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+				if (fd < 0) throw std::runtime_error("could not create " + temp_path);
+				void * ptr = (::ftruncate(fd, file_size) == 0) ? ::mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+				::close(fd);
+				if (ptr == MAP_FAILED)
+				{
+					::unlink(temp_path.c_str());
+					throw std::runtime_error("could not size and map " + temp_path);
+				}
+				out = static_cast<uint8_t*>(ptr);
+			}
+
+			~cache_output()
+			{
+				if (out)
+				{
+					::munmap(out, file_size);
+					::unlink(temp_path.c_str());
+				}
+			}
+
+			float * positions() { return reinterpret_cast<float*>(out + hdr.positions_offset); }
+			uint8_t * colours() { return out + hdr.colours_offset; }
+
+			void commit(const float bounds_min[3], const float bounds_max[3])
+			{
+				std::memcpy(hdr.bounds_min, bounds_min, sizeof(hdr.bounds_min));
+				std::memcpy(hdr.bounds_max, bounds_max, sizeof(hdr.bounds_max));
+				std::memcpy(out, &hdr, sizeof(header));
+				::munmap(out, file_size);
+				out = nullptr;
+
+				if (std::rename(temp_path.c_str(), cache_path.c_str()) != 0)
+				{
+					::unlink(temp_path.c_str());
+					throw std::runtime_error("could not move the cache into place at " + cache_path);
+				}
+			}
+		};
+
+		inline void print_written(const cache_output & output, const float write_time)
+		{
+			const float size_mb = output.file_size * float(1e-6);
+			std::cout << "\twriting " << size_mb << "mb cache " << output.cache_path << " in " << write_time << " seconds [" << (size_mb / write_time) << " MBps]" << std::endl;
+		}
+	}
+
+	// Write the 'count' points produced by 'read' (decoded from 'source_paths') out as a cache, with the points in
+	// a random order drawn from 'seed'. Each decoded batch is scattered straight into a shared mapping of the
+	// output, so the host only holds a batch and the permutation at any one time.
+	inline void write_cache(const std::vector<std::string> & source_paths, const uint64_t count, const point_format::read_function & read, const std::string & cache_path, const uint64_t seed)
+	{
+		ply_utils::manual_timer write_timer;
+		write_timer.start();
+
+		// dest[permutation[i]] = source[i] gives a uniformly shuffled output just as well as gathering would
+		std::vector<uint32_t> permutation(count);
+		shuffle_utils::random_permutation(permutation.data(), count, seed);
+
+		detail::cache_output output(source_paths, count, cache_path, shuffled, seed);
+		float * out_positions = output.positions();
+		uint8_t * out_colours = output.colours();
+
+		float bounds_min[3] = { INFINITY, INFINITY, INFINITY };
+		float bounds_max[3] = { -INFINITY, -INFINITY, -INFINITY };
+		float batch_min[3], batch_max[3];
+
+		constexpr size_t batch_size = 1 << 20;
+		std::vector<float> positions(3 * batch_size);
+		std::vector<uint8_t> colours(3 * batch_size);
+		size_t first = 0;
+		for (size_t n = 0; first < count && (n = read(std::min<size_t>(batch_size, count - first), positions.data(), colours.data())) != 0; first += n)
+		{
+			for (size_t i = 0; i < n; ++i)
+			{
+				const size_t dest = permutation[first + i];
+				std::memcpy(out_positions + 3 * dest, &positions[3 * i], 3 * sizeof(float));
+				std::memcpy(out_colours + 3 * dest, &colours[3 * i], 3 * sizeof(uint8_t));
+			}
+			cloud_stats::bounds(positions.data(), n, batch_min, batch_max);
+			for (size_t k = 0; k < 3; ++k)
+			{
+				bounds_min[k] = std::min(bounds_min[k], batch_min[k]);
+				bounds_max[k] = std::max(bounds_max[k], batch_max[k]);
+			}
+		}
+		// a short read would leave holes of zeroed points in a cache that then passes as current, the output's
+		// destructor removes the temporary file instead
+		if (first != count) throw std::runtime_error("ran out of points after " + std::to_string(first) + " of " + std::to_string(count));
+		output.commit(bounds_min, bounds_max);
+
+		write_timer.stop();
+		detail::print_written(output, write_timer.get() / 1000.f);
+	}
+
+	// Write 'count' packed points already in memory out as a cache, with point order[i] at position i, for an
+	// order other than a plain shuffle (see point_order.h). Points are gathered across all cores straight into a
+	// shared mapping of the output. 'flags' records which order that is, and 'seed' is the one it was drawn from, if any
+	inline void write_cache(const std::vector<std::string> & source_paths, const uint64_t count, const float * positions, const uint8_t * colours,
+		const uint32_t * order, const uint32_t flags, const std::string & cache_path, const uint64_t seed = 0)
+	{
+		ply_utils::manual_timer write_timer;
+		write_timer.start();
+
+		detail::cache_output output(source_paths, count, cache_path, flags, seed);
+		float * out_positions = output.positions();
+		uint8_t * out_colours = output.colours();
+		parallel_utils::parallel_for(count, [&](const size_t begin, const size_t end)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				std::memcpy(out_positions + 3 * i, positions + 3 * size_t(order[i]), 3 * sizeof(float));
+				std::memcpy(out_colours + 3 * i, colours + 3 * size_t(order[i]), 3 * sizeof(uint8_t));
+			}
+		});
+
+		float bounds_min[3], bounds_max[3];
+		cloud_stats::bounds(positions, count, bounds_min, bounds_max);
+		output.commit(bounds_min, bounds_max);
+
+		write_timer.stop();
+		detail::print_written(output, write_timer.get() / 1000.f);
+	}
+}
+
+#endif // POINT_CACHE_H
@@ -0,0 +1,201 @@
+#pragma once
+
+#include "cloud_stats.h"
+#include "parallel_utils.h"
+#include "point_order.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+// Thinning of packed float xyz positions and uchar rgb colours on the host, before they're uploaded. Points
+// are grouped by sorting on the Morton code of the grid cell they fall in, then each group is reduced in
+// parallel, and the survivors are compacted to the front of the arrays in their original order. Each returns
+// the number of points left
+
+namespace point_filter
+{
+namespace detail
+{
+// Sort the point indices by 'keys', and call fn(range, begin, end) on each run of equal keys, in parallel, with
+// the sorted indices in 'sorted'. Indices within a run stay in increasing order
+template<typename Fn>
+void for_each_group(std::vector<uint64_t>& keys, std::vector<uint32_t>& sorted, Fn&& fn)
+{
+	const size_t count = keys.size();
+	sorted.resize(count);
+	for(size_t i = 0; i < count; ++i)
+	{
+		sorted[i] = uint32_t(i);
+	}
+	point_order::radix_sort(keys, sorted);
+	const size_t num_ranges = std::min(parallel_utils::thread_count(), std::max<size_t>(1, count >> 16));
+	point_order::parallel_runs(keys.data(), count, num_ranges, fn);
+}
+
+// Move the points with 'keep' set to the front, keeping their order. Each range of the points counts its
+// survivors, then copies them out to scratch arrays at its place in the prefix sums of those counts, in
+// parallel, and the scratch arrays are copied back over the front
+inline size_t compact(float* positions, uint8_t* colours, const size_t count, const std::vector<uint8_t>& keep)
+{
+	const size_t num_ranges = std::min(parallel_utils::thread_count(), std::max<size_t>(1, count >> 16));
+	const auto range_begin = [&](const size_t r) { return count * r / num_ranges; };
+	std::vector<size_t> kept_before(num_ranges + 1, 0);
+	parallel_utils::parallel_tasks(num_ranges, [&](const size_t r) {
+		kept_before[r + 1] = size_t(std::count(keep.begin() + range_begin(r), keep.begin() + range_begin(r + 1), uint8_t(1)));
+	});
+	for(size_t r = 0; r < num_ranges; ++r)
+	{
+		kept_before[r + 1] += kept_before[r];
+	}
+	const size_t kept = kept_before[num_ranges];
+
+	std::vector<float> kept_positions(3 * kept);
+	std::vector<uint8_t> kept_colours(3 * kept);
+	parallel_utils::parallel_tasks(num_ranges, [&](const size_t r) {
+		size_t out = kept_before[r];
+		for(size_t i = range_begin(r); i < range_begin(r + 1); ++i)
+		{
+			if(keep[i])
+			{
+				std::memcpy(&kept_positions[3 * out], positions + 3 * i, 3 * sizeof(float));
+				std::memcpy(&kept_colours[3 * out], colours + 3 * i, 3);
+				++out;
+			}
+		}
+	});
+	parallel_utils::parallel_for(kept, [&](const size_t begin, const size_t end) {
+		std::copy(kept_positions.begin() + 3 * begin, kept_positions.begin() + 3 * end, positions + 3 * begin);
+		std::copy(kept_colours.begin() + 3 * begin, kept_colours.begin() + 3 * end, colours + 3 * begin);
+	});
+	return kept;
+}
+} // namespace detail
+
+// Drop every point at exactly the same position as an earlier one, keeping the earlier one's colour
+inline size_t remove_duplicates(float* positions, uint8_t* colours, const size_t count)
+{
+	if(count > UINT32_MAX)
+	{
+		throw std::runtime_error("too many points to filter");
+	}
+
+	// identical positions always share a cell of the finest grid over the bounds, so only points in the same
+	// cell need comparing, and there are rarely more than a few
+	std::vector<uint64_t> keys = point_order::morton_codes(positions, count);
+	std::vector<uint32_t> sorted;
+	std::vector<uint8_t> keep(count, 1);
+	detail::for_each_group(keys, sorted, [&](size_t, const size_t begin, const size_t end) {
+		if(end - begin < 2)
+		{
+			return;
+		}
+		std::vector<uint32_t> group(sorted.begin() + begin, sorted.begin() + end);
+		const auto same_position = [&](const uint32_t a, const uint32_t b) {
+			return std::memcmp(positions + 3 * a, positions + 3 * b, 3 * sizeof(float)) == 0;
+		};
+		// by position bytes, then index, so the first of each equal run is the earliest point
+		std::sort(group.begin(), group.end(), [&](const uint32_t a, const uint32_t b) {
+			const int order = std::memcmp(positions + 3 * a, positions + 3 * b, 3 * sizeof(float));
+			return order < 0 || (order == 0 && a < b);
+		});
+		for(size_t k = 1; k < group.size(); ++k)
+		{
+			if(same_position(group[k], group[k - 1]))
+			{
+				keep[group[k]] = 0;
+			}
+		}
+	});
+	keys = {};
+	sorted = {};
+	return detail::compact(positions, colours, count, keep);
+}
+
+// Keep only the first point in each cube of side 'voxel_size', given the average colour of all the points in it.
+// Points with a NaN coordinate fall in no cube, and are dropped
+inline size_t decimate_to_voxels(float* positions, uint8_t* colours, const size_t count, const float voxel_size)
+{
+	if(!(voxel_size > 0.f))
+	{
+		throw std::runtime_error("voxel size must be positive");
+	}
+	if(count > UINT32_MAX)
+	{
+		throw std::runtime_error("too many points to filter");
+	}
+	if(count == 0)
+	{
+		return 0;
+	}
+
+	float bounds_min[3], bounds_max[3];
+	cloud_stats::bounds(positions, count, bounds_min, bounds_max);
+	for(size_t k = 0; k < 3; ++k)
+	{
+		if(!std::isfinite(bounds_min[k]) || !std::isfinite(bounds_max[k]) ||
+			(bounds_max[k] - bounds_min[k]) / voxel_size >= float(1 << point_order::morton_bits_per_axis))
+		{
+			throw std::runtime_error("voxel size too small for the extent of the cloud");
+		}
+	}
+
+	// Morton codes use 63 bits, so this key sorts after every cell and the non-finite points group together
+	constexpr uint64_t no_cell = UINT64_MAX;
+	std::vector<uint64_t> keys(count);
+	parallel_utils::parallel_for(count, [&](const size_t begin, const size_t end) {
+		for(size_t i = begin; i < end; ++i)
+		{
+			const float* p = positions + 3 * i;
+			// converting NaN to an integer is undefined, the bounds already rule out infinities
+			if(std::isnan(p[0]) || std::isnan(p[1]) || std::isnan(p[2]))
+			{
+				keys[i] = no_cell;
+				continue;
+			}
+			uint32_t cell[3];
+			for(size_t k = 0; k < 3; ++k)
+			{
+				cell[k] = uint32_t((p[k] - bounds_min[k]) / voxel_size);
+			}
+			keys[i] = point_order::morton_code(cell[0], cell[1], cell[2]);
+		}
+	});
+
+	std::vector<uint32_t> sorted;
+	std::vector<uint8_t> keep(count, 0);
+	detail::for_each_group(keys, sorted, [&](size_t, const size_t begin, const size_t end) {
+		if(keys[begin] == no_cell)
+		{
+			return;
+		}
+		// the representative is the earliest point, and only its colour is written, so groups don't overlap
+		const uint32_t representative = sorted[begin];
+		keep[representative] = 1;
+		if(end - begin < 2)
+		{
+			return;
+		}
+		uint64_t sum[3] = {0, 0, 0};
+		for(size_t i = begin; i < end; ++i)
+		{
+			for(size_t k = 0; k < 3; ++k)
+			{
+				sum[k] += colours[3 * sorted[i] + k];
+			}
+		}
+		const uint64_t n = end - begin;
+		for(size_t k = 0; k < 3; ++k)
+		{
+			colours[3 * representative + k] = uint8_t((sum[k] + n / 2) / n);
+		}
+	});
+	keys = {};
+	sorted = {};
+	return detail::compact(positions, colours, count, keep);
+}
+} // namespace point_filter
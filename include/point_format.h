@@ -0,0 +1,35 @@
+#ifndef POINT_FORMAT_H
+#define POINT_FORMAT_H
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string>
+
+// What the point file formats have in common: the batch reader every loader can be wrapped in and every
+// streaming writer consumes, and telling one format from another by the magic bytes it starts with.
+
+namespace point_format
+{
+	// Reads up to max_count packed points into the start of positions and colours, returning how many it wrote,
+	// 0 once the source is exhausted
+	typedef std::function<size_t(size_t max_count, float * positions, uint8_t * colours)> read_function;
+
+	// True if the 'size' bytes at 'data' start with the 'magic_size' bytes of 'magic'
+	inline bool has_magic(const uint8_t * data, const size_t size, const char * magic, const size_t magic_size)
+	{
+		return size >= magic_size && std::memcmp(data, magic, magic_size) == 0;
+	}
+
+	// True if the file at 'path' starts with the 'magic_size' bytes of 'magic'
+	inline bool has_magic(const std::string & path, const char * magic, const size_t magic_size)
+	{
+		char file_magic[16] = {};
+		if (magic_size > sizeof(file_magic)) return false;
+		std::ifstream file(path, std::ios::binary);
+		return file.read(file_magic, magic_size) && std::memcmp(file_magic, magic, magic_size) == 0;
+	}
+}
+
+#endif // POINT_FORMAT_H
@@ -0,0 +1,310 @@
+#pragma once
+
+#include "cloud_stats.h"
+#include "parallel_utils.h"
+#include "shuffle_utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Spatial orderings of packed point positions, each produced as a permutation 'order' where order[i] is the index
+// of the point to put in position i. Built on 63 bit Morton codes (21 bits per axis over the cloud's bounds) and
+// a parallel radix sort
+
+namespace point_order
+{
+// Spread the low 21 bits of v out to every third bit
+inline uint64_t spread_bits(uint64_t v)
+{
+	v &= 0x1fffff;
+	v = (v | v << 32) & 0x1f00000000ffffull;
+	v = (v | v << 16) & 0x1f0000ff0000ffull;
+	v = (v | v << 8) & 0x100f00f00f00f00full;
+	v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+	v = (v | v << 2) & 0x1249249249249249ull;
+	return v;
+}
+
+inline uint64_t morton_code(const uint32_t x, const uint32_t y, const uint32_t z)
+{
+	return spread_bits(x) | (spread_bits(y) << 1) | (spread_bits(z) << 2);
+}
+
+constexpr unsigned morton_bits_per_axis = 21;
+
+// The Morton code of every point, over a 2^21 grid spanning the points' bounds
+inline std::vector<uint64_t> morton_codes(const float* positions, const size_t count)
+{
+	float bounds_min[3], bounds_max[3];
+	cloud_stats::bounds(positions, count, bounds_min, bounds_max);
+
+	constexpr float max_cell = float((1 << morton_bits_per_axis) - 1);
+	float scale[3];
+	for(size_t k = 0; k < 3; ++k)
+	{
+		scale[k] = bounds_max[k] > bounds_min[k] ? max_cell / (bounds_max[k] - bounds_min[k]) : 0.f;
+	}
+
+	std::vector<uint64_t> codes(count);
+	parallel_utils::parallel_for(count, [&](const size_t begin, const size_t end) {
+		for(size_t i = begin; i < end; ++i)
+		{
+			uint32_t cell[3];
+			for(size_t k = 0; k < 3; ++k)
+			{
+				// NaN positions clamp to cell 0 rather than being undefined
+				const float c = (positions[3 * i + k] - bounds_min[k]) * scale[k];
+				cell[k] = c > 0.f ? uint32_t(std::min(c, max_cell)) : 0;
+			}
+			codes[i] = morton_code(cell[0], cell[1], cell[2]);
+		}
+	});
+	return codes;
+}
+
+// Stable LSD radix sort of 'keys' 8 bits at a time, carrying 'values' along. Each pass counts digits over one
+// contiguous range per thread, then scatters each range to the offsets the counts give it, which keeps the
+// sort stable. Passes over digits every key shares are skipped
+template<typename Value>
+void radix_sort(std::vector<uint64_t>& keys, std::vector<Value>& values)
+{
+	const size_t count = keys.size();
+	const size_t num_ranges = std::min(parallel_utils::thread_count(), std::max<size_t>(1, count >> 16));
+	const auto range_begin = [&](const size_t r) { return count * r / num_ranges; };
+
+	std::vector<uint64_t> key_scratch(count);
+	std::vector<Value> value_scratch(count);
+	std::vector<size_t> offsets(num_ranges * 256);
+
+	for(unsigned shift = 0; shift < 64; shift += 8)
+	{
+		std::fill(offsets.begin(), offsets.end(), 0);
+		parallel_utils::parallel_tasks(num_ranges, [&](const size_t r) {
+			size_t* histogram = offsets.data() + r * 256;
+			for(size_t i = range_begin(r); i < range_begin(r + 1); ++i)
+			{
+				++histogram[(keys[i] >> shift) & 0xff];
+			}
+		});
+
+		size_t next = 0;
+		bool all_one_digit = false;
+		for(size_t digit = 0; digit < 256; ++digit)
+		{
+			size_t digit_count = 0;
+			for(size_t r = 0; r < num_ranges; ++r)
+			{
+				const size_t n = offsets[r * 256 + digit];
+				offsets[r * 256 + digit] = next;
+				next += n;
+				digit_count += n;
+			}
+			all_one_digit |= digit_count == count;
+		}
+		if(all_one_digit)
+		{
+			continue;
+		}
+
+		parallel_utils::parallel_tasks(num_ranges, [&](const size_t r) {
+			size_t* next_slot = offsets.data() + r * 256;
+			for(size_t i = range_begin(r); i < range_begin(r + 1); ++i)
+			{
+				const size_t slot = next_slot[(keys[i] >> shift) & 0xff]++;
+				key_scratch[slot] = keys[i];
+				value_scratch[slot] = values[i];
+			}
+		});
+		keys.swap(key_scratch);
+		values.swap(value_scratch);
+	}
+}
+
+// Split sorted 'keys' into runs of equal keys and call fn(range, begin, end) on each, over num_ranges contiguous
+// ranges in parallel. Each range takes the runs that start inside it, so a run is never split between two
+template<typename Fn>
+void parallel_runs(const uint64_t* keys, const size_t count, const size_t num_ranges, Fn&& fn)
+{
+	parallel_utils::parallel_tasks(num_ranges, [&](const size_t r) {
+		const size_t end = count * (r + 1) / num_ranges;
+		size_t i = count * r / num_ranges;
+		while(i > 0 && i < end && keys[i] == keys[i - 1])
+		{
+			++i;
+		}
+		while(i < end)
+		{
+			const size_t begin = i;
+			for(++i; i < count && keys[i] == keys[begin]; ++i)
+			{
+			}
+			fn(r, begin, i);
+		}
+	});
+}
+
+// The point indices sorted into Morton order, with their sorted codes in 'codes'
+inline std::vector<uint32_t> morton_order(const float* positions, const size_t count, std::vector<uint64_t>& codes)
+{
+	codes = morton_codes(positions, count);
+	std::vector<uint32_t> order(count);
+	parallel_utils::parallel_for(count, [&](const size_t begin, const size_t end) {
+		for(size_t i = begin; i < end; ++i)
+		{
+			order[i] = uint32_t(i);
+		}
+	});
+	radix_sort(codes, order);
+	return order;
+}
+
+// Morton order cut into blocks of 'block_size' points, with the blocks in a random order drawn from 'seed'. Any
+// prefix of the result covers the cloud uniformly at block granularity, while each block is a compact patch of
+// neighbouring points, so drawing a range of it fetches and writes coherently
+inline void block_shuffled_morton_order(
+	const float* positions, const size_t count, const size_t block_size, const uint64_t seed, uint32_t* order)
+{
+	if(count == 0)
+	{
+		return;
+	}
+	std::vector<uint64_t> codes;
+	const std::vector<uint32_t> sorted = morton_order(positions, count, codes);
+
+	const size_t num_blocks = (count + block_size - 1) / block_size;
+	std::vector<uint32_t> block_order(num_blocks);
+	shuffle_utils::random_permutation(block_order.data(), num_blocks, seed);
+
+	// only the last block can be short, so where each output block starts only depends on whether the short
+	// one has been placed before it
+	const size_t last_block = num_blocks - 1;
+	const size_t last_block_size = count - last_block * block_size;
+	size_t short_block_position = 0;
+	for(size_t b = 0; b < num_blocks; ++b)
+	{
+		if(block_order[b] == last_block)
+		{
+			short_block_position = b;
+		}
+	}
+
+	parallel_utils::parallel_for(num_blocks, [&](const size_t begin, const size_t end) {
+		for(size_t b = begin; b < end; ++b)
+		{
+			const size_t source = block_order[b] * block_size;
+			const size_t dest = b * block_size - (b > short_block_position ? block_size - last_block_size : 0);
+			const size_t n = block_order[b] == last_block ? last_block_size : block_size;
+			std::copy_n(sorted.data() + source, n, order + dest);
+		}
+	}, 1 << 8);
+}
+
+// Coarse to fine order, a random point from each cell of a 2^l grid over the bounds for l = 0, 1, 2... ahead of
+// everything finer, and random order within each level. Any prefix of the result is a stratified sample of
+// the cloud down to the finest level it reaches, so a partial fill is evenly spread rather than clumped. Every
+// point gets a random priority, and its level is the coarsest one whose cell it has the lowest priority in,
+// which since cells nest makes it the representative of every finer cell it sits in too. Grids go down to
+// around one cell per point on a surface, the points that represent nothing come last
+inline void hierarchical_order(const float* positions, const size_t count, const uint64_t seed, uint32_t* order)
+{
+	if(count == 0)
+	{
+		return;
+	}
+	std::vector<uint64_t> codes;
+	std::vector<uint32_t> sorted = morton_order(positions, count, codes);
+
+	unsigned finest = 1;
+	while(finest < morton_bits_per_axis && (uint64_t(1) << (2 * finest)) < count)
+	{
+		++finest;
+	}
+	const auto priority = [&](const size_t i) { return shuffle_utils::counter_hash(seed, sorted[i]); };
+
+	struct cell
+	{
+		uint64_t key;
+		uint64_t priority;
+		size_t representative; // position in the sorted order
+	};
+
+	// the finest cells are runs of the sorted points with equal codes once cut down to that level
+	std::vector<uint64_t> cell_keys(count);
+	parallel_utils::parallel_for(count, [&](const size_t begin, const size_t end) {
+		for(size_t i = begin; i < end; ++i)
+		{
+			cell_keys[i] = codes[i] >> (3 * (morton_bits_per_axis - finest));
+		}
+	});
+	const size_t num_ranges = std::min(parallel_utils::thread_count(), std::max<size_t>(1, count >> 16));
+	std::vector<std::vector<cell>> range_cells(num_ranges);
+	parallel_runs(cell_keys.data(), count, num_ranges, [&](const size_t r, const size_t begin, const size_t end) {
+		cell c = {cell_keys[begin], priority(begin), begin};
+		for(size_t i = begin + 1; i < end; ++i)
+		{
+			const uint64_t p = priority(i);
+			if(p < c.priority)
+			{
+				c.priority = p;
+				c.representative = i;
+			}
+		}
+		range_cells[r].push_back(c);
+	});
+	cell_keys = {};
+	std::vector<cell> cells;
+	for(auto& range : range_cells)
+	{
+		cells.insert(cells.end(), range.begin(), range.end());
+		range = {};
+	}
+
+	// then each coarser level merges sibling cells into their parent, overwriting the level of whichever
+	// representative wins
+	std::vector<uint8_t> level(count, uint8_t(finest + 1));
+	for(unsigned l = finest + 1; l-- > 0;)
+	{
+		if(l < finest)
+		{
+			size_t parents = 0;
+			for(size_t k = 0; k < cells.size(); ++k)
+			{
+				const uint64_t key = cells[k].key >> 3;
+				if(parents > 0 && cells[parents - 1].key == key)
+				{
+					if(cells[k].priority < cells[parents - 1].priority)
+					{
+						cells[parents - 1].priority = cells[k].priority;
+						cells[parents - 1].representative = cells[k].representative;
+					}
+				}
+				else
+				{
+					cells[parents++] = {key, cells[k].priority, cells[k].representative};
+				}
+			}
+			cells.resize(parents);
+		}
+		for(const cell& c : cells)
+		{
+			level[c.representative] = uint8_t(l);
+		}
+	}
+	cells = {};
+
+	// sort by level, then by a second random number within it. Levels fit in the top 5 bits
+	std::vector<uint64_t>& keys = codes;
+	parallel_utils::parallel_for(count, [&](const size_t begin, const size_t end) {
+		for(size_t i = begin; i < end; ++i)
+		{
+			keys[i] = (uint64_t(level[i]) << 59) | (shuffle_utils::counter_hash(~seed, sorted[i]) >> 5);
+		}
+	});
+	level = {};
+	radix_sort(keys, sorted);
+	std::copy(sorted.begin(), sorted.end(), order);
+}
+} // namespace point_order
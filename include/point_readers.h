@@ -0,0 +1,253 @@
+#ifndef POINT_READERS_H
+#define POINT_READERS_H
+
+#include "chunked_cloud.h"
+#include "io_utils.h"
+#include "las_utils.h"
+#include "pcd_utils.h"
+#include "ply_utils.h"
+#include "point_format.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// One way into every point format the loaders handle, for anything that just wants packed float xyz positions
+// and uchar rgb colours out of a file without caring which it is: the renderer, and the headless tools that
+// share its loading. Only include this from one translation unit, it pulls in the tinyply implementation.
+
+namespace point_readers
+{
+	using point_format::read_function;
+
+	struct reader_options
+	{
+		// read fixed size binary records through a ring of staging buffers rather than the mapping
+		bool pipelined_io = false;
+		// open files O_DIRECT for pipelined reads
+		bool direct_io = false;
+		// make a las file's points relative to this rather than the centre of its own bounds
+		const double * las_origin = nullptr;
+	};
+
+	// Wrap a record_reader over 'count' records of 'record_size' bytes starting at 'offset' in 'path' as a batch
+	// read function, each run of records is decoded by 'decode' straight out of the staging buffers while the
+	// reads after it are in flight
+	template<typename Decode>
+	read_function make_pipelined_reader(const std::string & path, const size_t offset, const size_t record_size, const size_t count,
+		const io_utils::read_options & options, Decode decode)
+	{
+		const auto records = std::make_shared<io_utils::record_reader>(path, offset, record_size, count, options);
+		std::cout << "\treading " << path << " through " << records->backend_name() << (records->is_direct() ? " with O_DIRECT" : "") << "\n";
+		return [records, decode](size_t max_count, float * positions, uint8_t * colours)
+		{
+			const uint8_t * data = nullptr;
+			const size_t n = records->next(max_count, data);
+			if (n) decode(data, n, positions, colours);
+			return n;
+		};
+	}
+
+	// Open a batch reader over a ply, las, pcd or chunked file, setting 'count' to its total number of points.
+	// Throws if the file can't be decoded. With pipelined io, formats made of fixed size binary records are read
+	// through a ring of staging buffers, everything else still decodes from the mapping. The readers are shared so
+	// the function stays copyable
+	inline read_function open_point_reader(const std::string & path, size_t & count, const reader_options & options = reader_options())
+	{
+		io_utils::read_options io;
+		io.direct_io = options.direct_io;
+
+		if (chunked_cloud::is_chunked_file(path))
+		{
+			const auto reader = std::make_shared<chunked_cloud::point_batch_reader>(chunked_cloud::map_chunked_file(path));
+			count = reader->total_rows();
+			return [reader](size_t max_count, float * positions, uint8_t * colours) { return reader->read(max_count, positions, colours); };
+		}
+
+		if (las_utils::is_las_file(path))
+		{
+			const auto las = std::make_shared<las_utils::mapped_las>(las_utils::map_las_file(path));
+			count = las->point_count;
+			if (options.las_origin) std::copy_n(options.las_origin, 3, las->origin);
+			if (options.pipelined_io)
+			{
+				return make_pipelined_reader(path, las->point_data - las->file->data(), las->record_length, count, io,
+					[las](const uint8_t * records, size_t n, float * positions, uint8_t * colours) { las_utils::decode_point_records(*las, records, n, positions, colours); });
+			}
+			const auto reader = std::make_shared<las_utils::point_batch_reader>(*las);
+			return [reader](size_t max_count, float * positions, uint8_t * colours) { return reader->read(max_count, positions, colours); };
+		}
+
+		if (pcd_utils::is_pcd_file(path))
+		{
+			const auto pcd = std::make_shared<pcd_utils::mapped_pcd>(pcd_utils::map_pcd_file(path));
+			count = pcd->point_count;
+			if (options.pipelined_io && pcd->encoding == pcd_utils::mapped_pcd::binary)
+			{
+				return make_pipelined_reader(path, pcd->body - pcd->file->data(), pcd->record_size, count, io,
+					[pcd](const uint8_t * records, size_t n, float * positions, uint8_t * colours) { pcd_utils::decode_point_records(*pcd, records, n, positions, colours); });
+			}
+			const auto reader = std::make_shared<pcd_utils::point_batch_reader>(*pcd);
+			return [reader](size_t max_count, float * positions, uint8_t * colours) { return reader->read(max_count, positions, colours); };
+		}
+
+		const auto ply = std::make_shared<ply_utils::mapped_ply>(ply_utils::map_ply_file(path));
+		count = ply->vertex_count;
+		if (options.pipelined_io && ply->is_binary)
+		{
+			ply_utils::check_decodable(*ply);
+			return make_pipelined_reader(path, ply->vertex_data - ply->file->data(), ply->vertex_stride, count, io,
+				[ply](const uint8_t * records, size_t n, float * positions, uint8_t * colours) { ply_utils::decode_vertex_records(*ply, records, n, positions, colours); });
+		}
+		const auto reader = std::make_shared<ply_utils::vertex_batch_reader>(*ply);
+		return [reader](size_t max_count, float * positions, uint8_t * colours) { return reader->read(max_count, positions, colours); };
+	}
+
+	// Drain exactly 'count' points from 'read' into packed arrays, throws if it runs out first
+	inline void read_points(const read_function & read, const size_t count, float * positions, uint8_t * colours)
+	{
+		for (size_t first = 0, n = 0; first < count; first += n)
+		{
+			n = read(count - first, positions + 3 * first, colours + 3 * first);
+			if (n == 0) throw std::runtime_error("ran out of points after " + std::to_string(first));
+		}
+	}
+
+	// Expand 'path' into the point files it stands for: a directory gives every .ply, .las, .pcd and .pcrz file
+	// directly inside it, sorted by name so the order (and so the point IDs) doesn't depend on the filesystem, and
+	// a '.tiles' manifest gives the paths listed in it one per line, relative to the manifest, skipping blank lines
+	// and '#' comments. Anything else is just itself
+	inline std::vector<std::string> list_point_files(const std::string & path)
+	{
+		namespace fs = std::filesystem;
+		std::error_code error;
+		std::vector<std::string> files;
+
+		if (fs::is_directory(path, error))
+		{
+			for (const auto & entry : fs::directory_iterator(path, error))
+			{
+				std::string extension = entry.path().extension().string();
+				std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+				if (entry.is_regular_file(error) && (extension == ".ply" || extension == ".las" || extension == ".pcd" || extension == ".pcrz"))
+				{
+					files.push_back(entry.path().string());
+				}
+			}
+			std::sort(files.begin(), files.end());
+		}
+		else if (fs::path(path).extension() == ".tiles")
+		{
+			const fs::path directory = fs::path(path).parent_path();
+			std::ifstream manifest(path);
+			for (std::string line; std::getline(manifest, line);)
+			{
+				const size_t first = line.find_first_not_of(" \t\r");
+				if (first == std::string::npos || line[first] == '#') continue;
+				const fs::path file = line.substr(first, line.find_last_not_of(" \t\r") + 1 - first);
+				files.push_back((file.is_absolute() ? file : directory / file).string());
+			}
+		}
+		else
+		{
+			files.push_back(path);
+		}
+		return files;
+	}
+
+	// Each las file is normally made relative to the centre of its own bounds, which would stack tiles on top of
+	// each other, so find the centre of their combined bounds instead. Returns false if none of 'paths' is a las
+	// file. A file whose header bounds are unusable only contributes the origin it would have used
+	inline bool shared_las_origin(const std::vector<std::string> & paths, double origin[3])
+	{
+		double bounds_min[3] = { std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), std::numeric_limits<double>::max() };
+		double bounds_max[3] = { std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest() };
+		bool any_las = false;
+		for (const std::string & path : paths)
+		{
+			if (!las_utils::is_las_file(path)) continue;
+			const las_utils::mapped_las las = las_utils::map_las_file(path);
+			for (size_t k = 0; k < 3; ++k)
+			{
+				const bool valid = las.bounds_min[k] <= las.bounds_max[k] && std::isfinite(las.bounds_min[k] + las.bounds_max[k]);
+				bounds_min[k] = std::min(bounds_min[k], valid ? las.bounds_min[k] : las.origin[k]);
+				bounds_max[k] = std::max(bounds_max[k], valid ? las.bounds_max[k] : las.origin[k]);
+			}
+			any_las = true;
+		}
+		for (size_t k = 0; k < 3; ++k) origin[k] = 0.5 * (bounds_min[k] + bounds_max[k]);
+		return any_las;
+	}
+
+	// Readers over several files that make up one cloud, and where each file's points start in it
+	struct file_set
+	{
+		std::vector<std::string> paths;
+		std::vector<read_function> readers;
+		std::vector<size_t> first_point; // paths.size() + 1 prefix sums of the point counts
+		size_t total() const { return first_point.back(); }
+	};
+
+	// Open every file up front, with las files sharing one origin, throws if any can't be opened. Their counts fix
+	// which range of the combined arrays each one decodes into, and so the IDs of its points
+	inline file_set open_file_set(const std::vector<std::string> & paths, const reader_options & options = reader_options())
+	{
+		file_set set;
+		set.paths = paths;
+		set.readers.resize(paths.size());
+		set.first_point.assign(paths.size() + 1, 0);
+
+		double origin[3];
+		reader_options file_options = options;
+		if (shared_las_origin(paths, origin)) file_options.las_origin = origin;
+		for (size_t i = 0; i < paths.size(); ++i)
+		{
+			size_t count = 0;
+			set.readers[i] = open_point_reader(paths[i], count, file_options);
+			set.first_point[i + 1] = set.first_point[i] + count;
+		}
+		return set;
+	}
+
+	// Decode every file of 'set' into its range of the packed arrays. Files are handed out to threads whole, any
+	// parallelism inside a file's decoder runs inline, so this doesn't oversubscribe the cores. Throws the first
+	// error any file hit
+	inline void read_file_set(file_set & set, float * positions, uint8_t * colours)
+	{
+		ply_utils::manual_timer decode_timer;
+		decode_timer.start();
+
+		std::mutex error_mutex;
+		std::string error;
+		parallel_utils::parallel_tasks(set.paths.size(), [&](const size_t i)
+		{
+			try
+			{
+				const size_t first = set.first_point[i];
+				read_points(set.readers[i], set.first_point[i + 1] - first, positions + 3 * first, colours + 3 * first);
+			}
+			catch (const std::exception & e)
+			{
+				const std::lock_guard<std::mutex> lock(error_mutex);
+				if (error.empty()) error = set.paths[i] + ": " + e.what();
+			}
+		});
+		if (!error.empty()) throw std::runtime_error(error);
+
+		decode_timer.stop();
+		const float decode_time = decode_timer.get() / 1000.f;
+		std::cout << "\tdecoding " << set.total() << " points from " << set.paths.size() << " files in " << decode_time << " seconds ["
+			<< (set.total() / decode_time) << " points per second] on " << std::min(parallel_utils::thread_count(), set.paths.size()) << " threads" << std::endl;
+	}
+}
+
+#endif // POINT_READERS_H
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "parallel_utils.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Random permutations generated across all cores. The result depends only on the seed and the count, never on
+// how many threads drew it, so a fixed seed reproduces the same order on any machine
+
+namespace shuffle_utils
+{
+// splitmix64's output function over seed + counter, a cheap counter based generator: any thread can draw the
+// number for any counter without sharing generator state
+inline uint64_t counter_hash(const uint64_t seed, const uint64_t counter)
+{
+	uint64_t z = seed + (counter + 1) * 0x9e3779b97f4a7c15ull;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+// Map a 64 bit random number onto [0, range), by multiplication rather than modulo
+inline uint64_t below(const uint64_t random, const uint64_t range)
+{
+	return uint64_t((unsigned __int128)random * range >> 64);
+}
+
+// Fill dest[0, count) with a uniformly random permutation of [0, count) drawn from 'seed'. The shuffle swaps
+// within 'dest', so it has to be readable memory, not a write only mapping of a GL buffer. Every index is scattered into a randomly chosen
+// bucket of around 64k indices, counted then scattered in contiguous ranges across the threads so each
+// bucket keeps increasing index order, and then each bucket gets a Fisher-Yates shuffle of its own, buckets
+// in parallel. A uniformly random split into buckets followed by independent uniform shuffles of each is a
+// uniform shuffle of the whole
+template<typename Index>
+void random_permutation(Index* dest, const size_t count, const uint64_t seed)
+{
+	constexpr size_t bucket_target = 1 << 16;
+	const size_t num_buckets = std::max<size_t>(1, count / bucket_target);
+	// the split into ranges only affects the speed, not the result
+	const size_t num_ranges = std::min(parallel_utils::thread_count(), std::max<size_t>(1, count / bucket_target));
+	const auto range_begin = [&](const size_t r) { return count * r / num_ranges; };
+	const auto bucket_of = [&](const size_t i) { return below(counter_hash(seed, i), num_buckets); };
+
+	// each range's count of indices per bucket, then turned into where in 'dest' its indices for that bucket go
+	std::vector<size_t> offsets(num_ranges * num_buckets, 0);
+	parallel_utils::parallel_tasks(num_ranges, [&](const size_t r) {
+		size_t* histogram = offsets.data() + r * num_buckets;
+		for(size_t i = range_begin(r); i < range_begin(r + 1); ++i)
+		{
+			++histogram[bucket_of(i)];
+		}
+	});
+
+	std::vector<size_t> bucket_begin(num_buckets + 1, 0);
+	for(size_t b = 0, next = 0; b < num_buckets; ++b)
+	{
+		bucket_begin[b] = next;
+		for(size_t r = 0; r < num_ranges; ++r)
+		{
+			const size_t n = offsets[r * num_buckets + b];
+			offsets[r * num_buckets + b] = next;
+			next += n;
+		}
+	}
+	bucket_begin[num_buckets] = count;
+
+	parallel_utils::parallel_tasks(num_ranges, [&](const size_t r) {
+		size_t* next = offsets.data() + r * num_buckets;
+		for(size_t i = range_begin(r); i < range_begin(r + 1); ++i)
+		{
+			dest[next[bucket_of(i)]++] = Index(i);
+		}
+	});
+
+	// a separate stream of numbers per bucket, seeded off the other end of the counter space
+	parallel_utils::parallel_tasks(num_buckets, [&](const size_t b) {
+		Index* bucket = dest + bucket_begin[b];
+		const size_t n = bucket_begin[b + 1] - bucket_begin[b];
+		const uint64_t bucket_seed = counter_hash(~seed, b);
+		for(size_t k = n; k > 1; --k)
+		{
+			std::swap(bucket[k - 1], bucket[below(counter_hash(bucket_seed, k), k)]);
+		}
+	});
+}
+} // namespace shuffle_utils
@@ -1,9 +1,12 @@
 #version 430
 
-layout (local_size_x = 1, local_size_y = 1) in;
-
-layout(binding = 0) uniform isampler2D idTexture;
-layout(binding = 1) uniform sampler2D depthTexture;
+// Stream compaction of the visibility bitset into the index buffer the reprojection draws. Each invocation takes
+// one word of the bitset (32 points), a workgroup prefix sums their popcounts in shared memory, makes a single
+// atomicAdd on the draw count for the whole group's range, then every invocation writes its points' indices into
+// its slice of that range. Each group's indices are in ascending order, so the reprojection fetches runs of up to
+// GROUP_SIZE * 32 consecutive points rather than points in whatever order the atomics happened to land
+#define GROUP_SIZE 256
+layout (local_size_x = GROUP_SIZE, local_size_y = 1) in;
 
 layout(std430, binding = 0) buffer visibilityBuffer
 {
@@ -15,74 +18,82 @@ layout (std430, binding = 1) writeonly buffer indexBuffer
 	uint indices[];
 };
 
-uniform uint numElements;
-
-// note: it doesn't matter whether we use atomicCounterIncrement with a bound atomic counter, or atomicAdd with a SSBO,
-// the performance is identical
-
-// // the arguments for glDrawElementsIndirect
-// layout(std430, binding = 2) buffer ssIndirectCommand{
-// 	uint count;
-// 	uint primCount;
-// 	uint firstIndex;
-// 	uint baseVertex;
-// 	uint baseInstance;
-// };
+// the arguments for glDrawElementsIndirect, count is where the visible points are tallied
+layout(std430, binding = 3) buffer indirectCommand
+{
+	uint count;
+	uint primCount;
+	uint firstIndex;
+	uint baseVertex;
+	uint baseInstance;
+};
 
-layout (binding = 0, offset = 0) uniform atomic_uint visibleCount;
+uniform uint numElements;
 
-// void setBufferBitAtIndex(uint i)
-// {
-// 	const uint element = i / 32; // 32 bits per uint?
-// 	const uint remainder = i - 32 * element;
-// 	atomicOr(visibilities[element], (1 << remainder));
-// }
+// With the visibility pass subsampled the buffer has two halves, one the pass is setting bits in over this cycle
+// of sample offsets (currentWords in) and the other the whole of the last cycle's (previousWords in). Both are
+// drawn, so every point seen in the last cycle or so far this one is reprojected. The last frame of a cycle
+// clears the previous half, for the halves to swap over
+uniform bool keepHistory = false;
+uniform uint currentWords = 0u;
+uniform uint previousWords = 0u;
+uniform bool endOfCycle = false;
 
-// bool getBufferBitAtIndex(uint i)
-// {
-// 	uint element = i / 32; // 32 bits per uint?
-// 	uint remainder = i - 32 * element;
-// 	return ((visibilities[element] >> remainder) & 1) == 1;
-// }
+shared uint s_offsets[GROUP_SIZE];
+shared uint s_groupBase;
 
 void main()
 {
-	// get the correct index into the indices buffer, according to the invocation, group count, and group index
-	const uint computeIndex = gl_GlobalInvocationID.x * gl_NumWorkGroups.y + gl_GlobalInvocationID.y;
-
-	// careful not to overflow
-	if (computeIndex >= numElements)
-	{
-		return;
-	}
-
-	const uint indicesIndex = 32 * computeIndex;
-	uint element = visibilities[computeIndex];
-	for (uint i = 0; i < 32; ++i)
+	// groups are dispatched over two dimensions so huge clouds fit under the per dimension group limit, any past
+	// the end still take part in the barriers, with nothing to write
+	const uint group = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+	const uint local = gl_LocalInvocationID.x;
+	const uint wordIndex = group * GROUP_SIZE + local;
+
+	uint word = 0u;
+	if (wordIndex < numElements && keepHistory)
 	{
-		if (((element & 1) == 1)) // || (rand(vec2(seed, element)) > 0.1f))
+		word = visibilities[currentWords + wordIndex] | visibilities[previousWords + wordIndex];
+		if (endOfCycle)
 		{
-			indices[atomicCounterIncrement(visibleCount)] = indicesIndex + i;
+			visibilities[previousWords + wordIndex] = 0u;
 		}
-
-		element >>= 1;
 	}
+	else if (wordIndex < numElements)
+	{
+		word = visibilities[wordIndex];
+		visibilities[wordIndex] = 0u;
+	}
+	const uint wordCount = bitCount(word);
 
-	visibilities[computeIndex] = 0;
-
-	// // get the correct index into the indices buffer, since we invoke 1 shader call per visibility buffer element
-	// const uint index = 32 * gl_GlobalInvocationID.x;
-
-	// uint element = visibilities[gl_GlobalInvocationID.x];
-	// for (uint i = 0; i < 32; ++i)
-	// {
-	// 	if (((element & 1) == 1)) // || (rand(vec2(seed, element)) > 0.1f))
-	// 	{
-	// 		indices[atomicCounterIncrement(visibleCount)] = index + i;
-	// 	}
+	// inclusive Hillis-Steele scan of the popcounts, log2(GROUP_SIZE) steps
+	s_offsets[local] = wordCount;
+	memoryBarrierShared();
+	barrier();
+	for (uint stride = 1u; stride < GROUP_SIZE; stride <<= 1)
+	{
+		const uint add = local >= stride ? s_offsets[local - stride] : 0u;
+		memoryBarrierShared();
+		barrier();
+		s_offsets[local] += add;
+		memoryBarrierShared();
+		barrier();
+	}
 
-	// 	element >>= 1;
-	// }
+	// the last invocation holds the group's total, and reserves its range with the only global atomic
+	if (local == GROUP_SIZE - 1u)
+	{
+		s_groupBase = s_offsets[local] > 0u ? atomicAdd(count, s_offsets[local]) : 0u;
+	}
+	memoryBarrierShared();
+	barrier();
 
-	// visibilities[gl_GlobalInvocationID.x] = 0;
+	// set bits lowest first, so the indices ascend through the word as they do through the group
+	uint next = s_groupBase + s_offsets[local] - wordCount;
+	while (word != 0u)
+	{
+		const int bit = findLSB(word);
+		indices[next++] = 32u * wordIndex + uint(bit);
+		word &= word - 1u;
+	}
 }
@@ -0,0 +1,62 @@
+#version 430
+
+// The procedural fill order, linked into each shader that draws the fill so they all visit points in the same
+// order for the same seed
+
+// lowbias32, a cheap integer hash with good avalanche
+uint hash(uint x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+// A 4 round balanced Feistel network over 2 * halfBits bits, a bijection on [0, 4^halfBits)
+uint feistel(uint x, uint halfBits, uint seed)
+{
+	uint mask = (1u << halfBits) - 1u;
+	uint left = x >> halfBits;
+	uint right = x & mask;
+	for (uint r = 0u; r < 4u; ++r)
+	{
+		uint next = left ^ (hash(right ^ (seed + r * 0x9e3779b9u)) & mask);
+		left = right;
+		right = next;
+	}
+	return (left << halfBits) | right;
+}
+
+// No point to draw, past any number of loaded points so callers cull it
+const uint NO_POINT = 0xffffffffu;
+
+// Permute i within [0, range) by cycle walking: the Feistel network covers the smallest even power of two that
+// holds the range, so anything it maps past the end is fed back in until it lands inside. That's a few steps at
+// most on average, the cap only guards against a pathologically long walk, which gives NO_POINT for this pass
+uint permute(uint i, uint range, uint seed)
+{
+	uint bits = range > 1u ? uint(findMSB(range - 1u)) + 1u : 1u;
+	uint halfBits = (bits + 1u) / 2u;
+	uint x = feistel(i, halfBits, seed);
+	for (int walk = 0; walk < 256 && x >= range; ++walk)
+	{
+		x = feistel(x, halfBits, seed);
+	}
+	return x < range ? x : NO_POINT;
+}
+
+// The point drawn at place i of a fill that starts 'start' points into the current pass over [0, range). Past the
+// end of the pass it carries on in the next pass's order, without ever forming start + i, which would wrap for
+// ranges over 2^31. NO_POINT if it runs past the next pass too
+uint fillPoint(uint i, uint start, uint range, uint seed, uint nextSeed)
+{
+	uint remaining = range - min(start, range);
+	if (i < remaining)
+	{
+		return permute(start + i, range, seed);
+	}
+	i -= remaining;
+	return i < range ? permute(i, range, nextSeed) : NO_POINT;
+}
@@ -0,0 +1,156 @@
+#version 430
+#extension GL_ARB_gpu_shader_int64 : enable
+#extension GL_NV_shader_atomic_int64 : enable
+
+// Compute rasterizer, the alternative to drawing GL_POINTS for clouds of millions of points about a pixel across.
+// Each invocation projects one point to a single pixel and keeps it there if it's the nearest so far, by packing
+// its depth above its ID into 64 bits and taking the atomicMin of those. Without 64 bit atomics the same takes
+// two passes over the points, the first the atomicMin of the depth alone, the second the atomicMin of the IDs
+// of the points at exactly that depth. resolve_frag.glsl then writes the nearest point in every pixel into the
+// ID and depth textures, for the rest of the frame to use just as if the points had been drawn
+#define GROUP_SIZE 256
+layout (local_size_x = GROUP_SIZE, local_size_y = 1) in;
+
+#if defined(GL_ARB_gpu_shader_int64) && defined(GL_NV_shader_atomic_int64)
+#define ATOMIC_INT64
+#endif
+
+// where each invocation gets its point from, see PointCloudScene::PointSource
+#define SOURCE_RANGE 0u // first + i
+#define SOURCE_INDICES 1u // pointIndices[first + i]
+#define SOURCE_RANGES 2u // the i'th point of numRanges ranges in turn, from pointRanges[first]
+#define SOURCE_PROCEDURAL 3u // the procedural fill order, see points_vert.glsl
+
+// the point buffer, packed xyz pulled as in points_vert.glsl
+layout(std430, binding = 2) readonly buffer pointBuffer
+{
+	float pointPositions[];
+};
+
+// the arguments for glDrawElementsIndirect, when drawing the reprojection count is how many points it has
+layout(std430, binding = 3) readonly buffer indirectCommand
+{
+	uint count;
+	uint primCount;
+	uint firstIndex;
+	uint baseVertex;
+	uint baseInstance;
+};
+
+layout(std430, binding = 4) readonly buffer indexBuffer
+{
+	uint pointIndices[];
+};
+
+// the depth and ID of the nearest point in every pixel, rows from the bottom up. As words each pixel's ID comes
+// first and its depth second, so the pair read as one little endian 64 bit value orders by depth then ID
+layout(std430, binding = 5) buffer pixelBuffer
+{
+#ifdef ATOMIC_INT64
+	uint64_t pixels[];
+#else
+	uint pixelWords[];
+#endif
+};
+
+// the first point of each range, and where the range ends in the sequence of its dispatch's points
+layout(std430, binding = 6) readonly buffer rangeBuffer
+{
+	uvec2 pointRanges[];
+};
+
+uniform mat4 modelViewProjection;
+uniform ivec2 framebufferSize;
+
+uniform uint pointSource;
+uniform uint first;
+uniform uint numPoints; // invocations with a point, at most, for the reprojection
+uniform bool countFromCommand;
+uniform uint numRanges;
+uniform uint numPointsLoaded;
+
+// 0 for the depths, 1 for the IDs, without 64 bit atomics
+uniform uint rasterPass;
+
+uniform uint fillStart;
+uniform uint fillRange;
+uniform uint fillSeed;
+uniform uint nextFillSeed;
+
+// the point at place i of the fill, past any loaded point if there's none, see permute.glsl
+uint fillPoint(uint i, uint start, uint range, uint seed, uint nextSeed);
+
+// the point for invocation i, numPointsLoaded or past if there's none
+uint pointIndex(uint i)
+{
+	if (pointSource == SOURCE_INDICES)
+	{
+		return pointIndices[first + i];
+	}
+	if (pointSource == SOURCE_RANGES)
+	{
+		// the first of this dispatch's ranges that ends after i
+		uint low = first;
+		uint high = first + numRanges - 1u;
+		while (low < high)
+		{
+			const uint middle = (low + high) / 2u;
+			if (pointRanges[middle].y > i)
+			{
+				high = middle;
+			}
+			else
+			{
+				low = middle + 1u;
+			}
+		}
+		return pointRanges[low].x + i - (low > first ? pointRanges[low - 1u].y : 0u);
+	}
+	if (pointSource == SOURCE_PROCEDURAL)
+	{
+		return fillPoint(i, fillStart, fillRange, fillSeed, nextFillSeed);
+	}
+	return first + i;
+}
+
+void main()
+{
+	// groups are dispatched over two dimensions, as in element_comp.glsl
+	const uint i = (gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x) * GROUP_SIZE + gl_LocalInvocationID.x;
+	if (i >= (countFromCommand ? min(numPoints, count) : numPoints))
+	{
+		return;
+	}
+	const uint index = pointIndex(i);
+	if (index >= numPointsLoaded)
+	{
+		return;
+	}
+
+	const vec4 clip = modelViewProjection *
+		vec4(pointPositions[3u * index], pointPositions[3u * index + 1u], pointPositions[3u * index + 2u], 1.0f);
+	// the clip volume GL_POINTS are culled to
+	if (!(clip.w > 0.0f) || any(greaterThan(abs(clip.xyz), vec3(clip.w))))
+	{
+		return;
+	}
+	const vec3 ndc = clip.xyz / clip.w;
+	const ivec2 pixel = min(ivec2((ndc.xy * 0.5f + 0.5f) * vec2(framebufferSize)), framebufferSize - 1);
+	const uint p = uint(pixel.y * framebufferSize.x + pixel.x);
+	// window space depth with the default depth range, as the depth texture holds it. Non-negative floats order
+	// the same as their bits
+	const uint depth = floatBitsToUint(max(ndc.z * 0.5f + 0.5f, 0.0f));
+
+#ifdef ATOMIC_INT64
+	atomicMin(pixels[p], (uint64_t(depth) << 32) | uint64_t(index));
+#else
+	if (rasterPass == 0u)
+	{
+		atomicMin(pixelWords[2u * p + 1u], depth);
+	}
+	else if (pixelWords[2u * p + 1u] == depth)
+	{
+		atomicMin(pixelWords[2u * p], index);
+	}
+#endif
+}
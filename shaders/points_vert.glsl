@@ -1,4 +1,4 @@
-#version 330 core
+#version 430 core
 
 layout(location = 0) in vec3 vertexPos;
 layout(location = 1) in uvec3 vertexColour;
@@ -12,6 +12,25 @@ uniform mat4 projection;
 
 uniform float pointSize;
 
+// points past this haven't been streamed in yet, so their buffer contents are undefined
+uniform uint numPointsLoaded;
+
+// The procedural fill draws fillBudget vertices, and maps each one's position in the fill sequence through a
+// pseudo-random permutation of [0, fillRange) to pick which point it draws, so the fill order costs no index
+// memory. Each pass over the range uses a fresh seed, a draw that runs over the end of a pass continues into
+// the next pass's order
+uniform bool proceduralFill = false;
+uniform uint fillStart;
+uniform uint fillRange;
+uniform uint fillSeed;
+uniform uint nextFillSeed;
+
+// the points are pulled from the point buffer by index rather than fetched as attributes, packed xyz
+layout(std430, binding = 2) readonly buffer pointBuffer
+{
+	float pointPositions[];
+};
+
 const float PI =  3.14159265;
 
 vec4 barrel_distort(vec4 p)
@@ -55,9 +74,32 @@ vec4 dome_distort(vec4 p)
 	// return newP;
 }
 
+// the point at place i of the fill, past any loaded point if there's none, see permute.glsl
+uint fillPoint(uint i, uint start, uint range, uint seed, uint nextSeed);
+
 void main()
 {
-	vec4 transformedPos = projection * view * model * vec4(vertexPos.x, vertexPos.y, vertexPos.z, 1.0);
+	uint index = uint(gl_VertexID);
+	vec3 position = vertexPos;
+	if (proceduralFill)
+	{
+		index = fillPoint(index, fillStart, fillRange, fillSeed, nextFillSeed);
+		if (index < numPointsLoaded)
+		{
+			position = vec3(pointPositions[3u * index], pointPositions[3u * index + 1u], pointPositions[3u * index + 2u]);
+		}
+	}
+
+	if (index >= numPointsLoaded)
+	{
+		// outside the clip volume, so it's culled before rasterization
+		gl_Position = vec4(2.0f, 2.0f, 2.0f, 1.0f);
+		gl_PointSize = 1.0f;
+		pointIndex = int(index);
+		return;
+	}
+
+	vec4 transformedPos = projection * view * model * vec4(position.x, position.y, position.z, 1.0);
 	// gl_Position = dome_distort(transformedPos);
 	gl_Position = transformedPos;
 	// gl_Position = vec4(0.5f, 0.5f, 0.0f, 1.0f);
@@ -66,5 +108,5 @@ void main()
 	// gl_PointSize = 1.0f;
 	// this might be the draw ID and not the actual index, which might be a problem when using glDrawElements
 	// pointColour = vertexColour;
-	pointIndex = gl_VertexID;
+	pointIndex = int(index);
 }
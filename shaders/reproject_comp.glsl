@@ -0,0 +1,106 @@
+#version 430
+
+// Pixel driven reprojection, builds the index buffer the reprojection draws straight from the last frame's ID
+// texture, so it costs the same whatever the size of the cloud, where the bitset scan has to read a bit for
+// every point. One workgroup per tile of the framebuffer, each pixel claims its point's bit in the visibility
+// bitset, the atomicOr giving back whether some other pixel got there first, and the tile appends the points
+// it claimed to the index buffer with a single atomicAdd on the draw count. A second dispatch over the same
+// pixels with clearVisited set zeroes only the words the first set, leaving the bitset empty for next frame
+#define TILE_SIZE 32
+layout (local_size_x = TILE_SIZE, local_size_y = TILE_SIZE, local_size_z = 1) in;
+
+layout(binding = 0) uniform isampler2D idTexture;
+layout(binding = 1) uniform sampler2D depthTexture;
+
+layout(std430, binding = 0) buffer visibilityBuffer
+{
+	uint visibilities[];
+};
+
+layout (std430, binding = 1) writeonly buffer indexBuffer
+{
+	uint indices[];
+};
+
+// the arguments for glDrawElementsIndirect, count is where the visible points are tallied
+layout(std430, binding = 3) buffer indirectCommand
+{
+	uint count;
+	uint primCount;
+	uint firstIndex;
+	uint baseVertex;
+	uint baseInstance;
+};
+
+uniform bool clearVisited = false;
+
+shared int s_ids[TILE_SIZE * TILE_SIZE];
+shared uint s_count;
+shared uint s_base;
+
+void main()
+{
+	const ivec2 uv = ivec2(gl_GlobalInvocationID.xy);
+	const ivec2 local = ivec2(gl_LocalInvocationID.xy);
+	const uint localIndex = gl_LocalInvocationIndex;
+
+	// -1 for empty pixels, and those past the edge of the framebuffer in the last row and column of tiles
+	int pointId = -1;
+	if (all(lessThan(uv, textureSize(idTexture, 0))) && texelFetch(depthTexture, uv, 0).r < 1.0f)
+	{
+		pointId = texelFetch(idTexture, uv, 0).r;
+	}
+	s_ids[localIndex] = pointId;
+	if (localIndex == 0u)
+	{
+		s_count = 0u;
+	}
+	memoryBarrierShared();
+	barrier();
+
+	// a point bigger than a pixel covers a patch of the tile, only the pixels whose left and upper neighbours
+	// show some other point go on to the atomics. The first of a point's pixels in row order always does, so
+	// this takes out most repeats without losing any point, and the bitset catches the rest
+	bool claim = pointId >= 0;
+	if (local.x > 0)
+	{
+		claim = claim && s_ids[localIndex - 1u] != pointId;
+	}
+	if (local.y > 0)
+	{
+		claim = claim && s_ids[localIndex - TILE_SIZE] != pointId;
+	}
+
+	const uint element = uint(pointId) / 32u;
+	const uint bit = 1u << (uint(pointId) % 32u);
+	if (clearVisited)
+	{
+		// every pixel that claimed a point last dispatch comes back to the same word
+		if (claim)
+		{
+			visibilities[element] = 0u;
+		}
+		return;
+	}
+
+	claim = claim && (atomicOr(visibilities[element], bit) & bit) == 0u;
+	uint slot = 0u;
+	if (claim)
+	{
+		slot = atomicAdd(s_count, 1u);
+	}
+	memoryBarrierShared();
+	barrier();
+
+	if (localIndex == 0u)
+	{
+		s_base = s_count > 0u ? atomicAdd(count, s_count) : 0u;
+	}
+	memoryBarrierShared();
+	barrier();
+
+	if (claim)
+	{
+		indices[s_base + slot] = uint(pointId);
+	}
+}
@@ -0,0 +1,26 @@
+#version 430
+
+// Resolve the compute rasterizer's pixels (see points_comp.glsl) into the ID and depth textures, as a screen
+// quad over the ID framebuffer. Pixels no point landed in are left as cleared
+
+layout(std430, binding = 5) readonly buffer pixelBuffer
+{
+	uint pixelWords[];
+};
+
+uniform int framebufferWidth;
+
+layout(location = 0) out int fragIndex;
+
+void main()
+{
+	const ivec2 pixel = ivec2(gl_FragCoord.xy);
+	const uint p = uint(pixel.y * framebufferWidth + pixel.x);
+	const uint depth = pixelWords[2u * p + 1u];
+	if (depth == 0xFFFFFFFFu)
+	{
+		discard;
+	}
+	fragIndex = int(pixelWords[2u * p]);
+	gl_FragDepth = uintBitsToFloat(depth);
+}
@@ -12,6 +12,13 @@ layout(std430, binding = 0) buffer visibilityBuffer
 	uint visibilities[];
 };
 
+// Each invocation reads one pixel of a sampleStride x sampleStride block, at sampleOffset within it, which the
+// host rotates every frame so each pixel is read once every sampleStride^2 frames. When subsampling, the bits
+// are set in the half of the buffer currentWords in, see element_comp.glsl for how the halves are used
+uniform int sampleStride = 1;
+uniform ivec2 sampleOffset = ivec2(0);
+uniform uint currentWords = 0u;
+
 // void setBufferBitAtIndex(uint i)
 // {
 // 	const uint element = i / 32; // 32 bits per uint?
@@ -28,7 +35,12 @@ layout(std430, binding = 0) buffer visibilityBuffer
 
 void main()
 {
-	const ivec2 uv = ivec2(gl_GlobalInvocationID.x, gl_GlobalInvocationID.y);
+	const ivec2 uv = ivec2(gl_GlobalInvocationID.xy) * sampleStride + sampleOffset;
+	// the last row and column of tiles hang over the edge of the framebuffer
+	if (any(greaterThanEqual(uv, textureSize(depthTexture, 0))))
+	{
+		return;
+	}
 	const float depth = texelFetch(depthTexture, uv, 0).r;
 	if (depth < 1.0f)
 	{
@@ -37,7 +49,7 @@ void main()
 		// could use modf here?
 		const uint element = pointId / 32; // 32 bits per uint?
 		const uint remainder = pointId - (32 * element);
-		atomicOr(visibilities[element], (1 << remainder));
+		atomicOr(visibilities[currentWords + element], (1u << remainder));
 		// setBufferBitAtIndex(texelFetch(idTexture, uv, 0).r); // this is expensive
 	}
 }
@@ -20,6 +20,7 @@ OrbitalCamera::OrbitalCamera()
 	, m_aspect(1.0f)
 	, m_nearClip(1.0f)
 	, m_farClip(100.0f)
+	, m_sceneRadius(0.0f)
 	, m_projectionMat(std::nullopt)
 {}
 
@@ -47,8 +48,18 @@ void OrbitalCamera::processInput(const SDL_Event& event)
 	}
 	break;
 	case SDL_MOUSEWHEEL: {
-		m_distance -= event.wheel.y * s_scrollSensitivity;
-		m_distance = glm::clamp(m_distance, m_nearClip, m_farClip); // lazy
+		if(m_sceneRadius > 0.0f)
+		{
+			// steps in proportion to the distance, so a scene of any scale zooms at the same rate
+			m_distance *= glm::pow(0.9f, float(event.wheel.y) * s_scrollSensitivity);
+			m_distance = glm::clamp(m_distance, 1e-3f * m_sceneRadius, 100.0f * m_sceneRadius);
+			m_projectionMat.reset();
+		}
+		else
+		{
+			m_distance -= event.wheel.y * s_scrollSensitivity;
+			m_distance = glm::clamp(m_distance, m_nearClip, m_farClip); // lazy
+		}
 		m_viewMat.reset();
 	}
 	default:
@@ -60,10 +71,18 @@ const glm::mat4 OrbitalCamera::calculateView() const
 {
 	glm::vec3 viewPoint(
 		glm::sin(m_theta) * glm::cos(m_phi), glm::sin(m_phi), glm::cos(m_theta) * glm::cos(m_phi));
-	return glm::lookAt(viewPoint * m_distance, m_target, s_worldUp);
+	return glm::lookAt(m_target + viewPoint * m_distance, m_target, s_worldUp);
 }
 
 const glm::mat4 OrbitalCamera::calculateProjection() const
 {
+	if(m_sceneRadius > 0.0f)
+	{
+		// just around the scene, but never so near that the depth buffer's precision all goes on the first few
+		// units in front of the camera
+		const float farClip = m_distance + m_sceneRadius;
+		const float nearClip = glm::max(m_distance - m_sceneRadius, 1e-4f * farClip);
+		return glm::perspective(glm::radians(m_fov), m_aspect, nearClip, farClip);
+	}
 	return glm::perspective(glm::radians(m_fov), m_aspect, m_nearClip, m_farClip);
 }
\ No newline at end of file
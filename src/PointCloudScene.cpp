@@ -6,9 +6,20 @@
 #include <imgui/imgui.h>
 
 #include <tinyply/tinyply.h>
+#include "chunked_cloud.h"
+#include "las_utils.h"
+#include "octree_cloud.h"
+#include "pcd_utils.h"
 #include "ply_utils.h"
+#include "point_cache.h"
+#include "point_filter.h"
+#include "point_order.h"
+#include "point_readers.h"
+#include "shuffle_utils.h"
 
 #include <algorithm>
+#include <array>
+#include <cmath>
 #include <random>
 
 PointCloudScene::PointCloudScene()
@@ -18,14 +29,21 @@ PointCloudScene::PointCloudScene()
 	, m_colourTexture()
 	, m_visComputeShader({{GL_COMPUTE_SHADER, "shaders/visibility_comp.glsl"}})
 	, m_elementComputeShader({{GL_COMPUTE_SHADER, "shaders/element_comp.glsl"}})
+	, m_reprojectComputeShader({{GL_COMPUTE_SHADER, "shaders/reproject_comp.glsl"}})
 	, m_pointsShader({{GL_VERTEX_SHADER, "shaders/points_vert.glsl"},
+		  {GL_VERTEX_SHADER, "shaders/permute.glsl"},
 		  {GL_FRAGMENT_SHADER, "shaders/points_frag.glsl"}})
 	, m_outputShader({{GL_VERTEX_SHADER, "shaders/screenspace_vert.glsl"},
 		  {GL_FRAGMENT_SHADER, "shaders/output_frag.glsl"}})
+	, m_pointsComputeShader({{GL_COMPUTE_SHADER, "shaders/points_comp.glsl"},
+		  {GL_COMPUTE_SHADER, "shaders/permute.glsl"}})
+	, m_resolveShader({{GL_VERTEX_SHADER, "shaders/screenspace_vert.glsl"},
+		  {GL_FRAGMENT_SHADER, "shaders/resolve_frag.glsl"}})
 	, m_pointCloudVAO()
 	, m_modelMat(
 		  glm::translate(glm::rotate(glm::mat4(1.0), 3.14159f / 2.0f, glm::vec3(-1.0f, 0.0f, 0.0f)),
 			  glm::vec3(0.0f, 0.0f, -5.0f)))
+	, m_cloudStats()
 	, m_pointsBuffer()
 	, m_colBuffer()
 	, m_visBuffer()
@@ -33,16 +51,47 @@ PointCloudScene::PointCloudScene()
 	, m_shuffledBuffer()
 	, m_indirectElementsBuffer()
 	, m_indirectComputeBuffer()
+	, m_pixelBuffer()
+	, m_pointRangesBuffer()
 	, m_camera()
+	, m_loadOptions()
 	, m_computeDispatchCount(0)
 	, m_computeGroupCount(0)
+	, m_maxComputeGroupCount(0)
 	, m_numPointsVisible(0)
 	, m_numPointsTotal(0)
+	, m_numPointsLoaded(0)
 	, m_doProgressive(true)
 	, m_doShuffle(true)
+	, m_reprojection(Reprojection::BitsetScan)
+	, m_visibilitySampling(1)
+	, m_visibilityFrame(0)
+	, m_visibilityWords(0)
+	, m_rasterizer(PointRasterizer::GLPoints)
+	, m_hasAtomicInt64(GLEW_ARB_gpu_shader_int64 && GLEW_NV_shader_atomic_int64)
+	, m_pointsPreshuffled(false)
+	, m_guiPointOrder(0)
+	, m_hasShuffledIndices(false)
+	, m_doProceduralFill(false)
 	, m_fillStartIndex(0)
+	, m_fillCycle(0)
+	, m_fillSeed(0)
 	, m_fillRate(10.0f)
 	, m_pointSize(1.0f)
+	, m_octreeNodes()
+	, m_lodFirsts()
+	, m_lodCounts()
+	, m_fillFirsts()
+	, m_fillCounts()
+	, m_lodPointCount(0)
+	, m_lodThreshold(300.0f)
+	, m_lodFillPhase(0.0f)
+	, m_viewportWidth(1024)
+	, m_viewportHeight(768)
+	, m_pointDispatches()
+	, m_pointRanges()
+	, m_streamingLoader()
+	, m_streamStartTime()
 {
 	// enable programmable point size in vertex shaders, no better place to put this?
 	glEnable(GL_PROGRAM_POINT_SIZE);
@@ -61,7 +110,6 @@ PointCloudScene::PointCloudScene()
 	// compute shader bindings
 	m_elementBuffer.bindAs(GL_SHADER_STORAGE_BUFFER);
 	m_elementBuffer.bindAsIndexed(GL_SHADER_STORAGE_BUFFER, 1);
-	m_indirectElementsBuffer.bindAsIndexed(GL_ATOMIC_COUNTER_BUFFER, 0);
 
 	// TODO: map out texture units properly
 	// use texture unit 0 for the depth texture
@@ -78,23 +126,31 @@ PointCloudScene::PointCloudScene()
 	glUniform1i(m_visComputeShader.getUniformLocation("idTexture"), 0);
 	glUniform1i(m_visComputeShader.getUniformLocation("depthTexture"), 1);
 
-	m_elementComputeShader.use();
-	glUniform1i(m_elementComputeShader.getUniformLocation("idTexture"), 0);
-	glUniform1i(m_elementComputeShader.getUniformLocation("depthTexture"), 1);
+	m_reprojectComputeShader.use();
+	glUniform1i(m_reprojectComputeShader.getUniformLocation("idTexture"), 0);
+	glUniform1i(m_reprojectComputeShader.getUniformLocation("depthTexture"), 1);
 
 	m_outputShader.use();
 	glUniform1i(m_outputShader.getUniformLocation("idTexture"), 0);
 	glUniform1i(m_outputShader.getUniformLocation("depthTexture"), 1);
 	glUniform1i(m_outputShader.getUniformLocation("colTexture"), 2);
 
-	// set up indirect drawing parameters buffer, the first element (count) will also be mapped to an atomic
-	// counter in the compute shader
+	// the compute rasterizer's pixels and the point ranges it draws, see points_comp.glsl
+	m_pixelBuffer.bindAsIndexed(GL_SHADER_STORAGE_BUFFER, 5);
+	m_pointRangesBuffer.bindAsIndexed(GL_SHADER_STORAGE_BUFFER, 6);
+	GLint maxGroupCount = 0;
+	glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &maxGroupCount);
+	m_maxComputeGroupCount = std::max(1, maxGroupCount);
+	std::cout << "compute rasterizer " << (m_hasAtomicInt64 ? "has" : "doesn't have")
+			  << " 64 bit atomics, it takes " << (m_hasAtomicInt64 ? "one pass" : "two passes") << "\n";
+
+	// set up indirect drawing parameters buffer, the element compute shader adds each workgroup's visible points
+	// to the first element (count) through an SSBO view of it
 	const DrawElementsIndirectCommand indirectElements = {0, 1, 0, 0, 0};
 	m_indirectElementsBuffer.bindAs(GL_DRAW_INDIRECT_BUFFER);
 	glBufferData(
 		GL_DRAW_INDIRECT_BUFFER, sizeof(indirectElements), &indirectElements, GL_DYNAMIC_DRAW);
-	m_indirectElementsBuffer.bindAsIndexed(GL_ATOMIC_COUNTER_BUFFER, 0);
-	// m_indirectElementsBuffer.bindAsIndexed(GL_SHADER_STORAGE_BUFFER, 2);
+	m_indirectElementsBuffer.bindAsIndexed(GL_SHADER_STORAGE_BUFFER, 3);
 
 	// set up indirect compute parameters buffer
 	// const DispatchIndirectCommand indirectCompute = {m_computeDispatchCountX, m_computeDispatchCountY, 1};
@@ -102,105 +158,1364 @@ PointCloudScene::PointCloudScene()
 	// glBufferData(GL_DISPATCH_INDIRECT_BUFFER, sizeof(indirectCompute), &indirectCompute, GL_DYNAMIC_DRAW);
 }
 
-bool PointCloudScene::loadPointCloud(const char* filepath)
+bool PointCloudScene::loadPointCloud(const char* filepath, const LoadOptions& options)
+{
+	m_loadOptions = options;
+	// the GUI offers to reorder into the order the cloud was loaded in, or shuffled if it wasn't reordered
+	m_guiPointOrder = std::max(0, int(options.pointOrder) - 1);
+	const bool filtering = m_loadOptions.pointFilter != PointFilter::None;
+	m_loadOptions.streaming &= !filtering;
+
+	// we have to bind a VAO to hold the vertex attributes for the buffers, and the element buffer bindings
+	m_pointCloudVAO.bind();
+	m_octreeNodes.clear();
+	m_cloudStats = cloud_stats::summary();
+	m_pointsPreshuffled = false;
+
+	// an octree is already in the order it's drawn in, node by node, so none of the other preparation applies
+	if(octree_cloud::is_octree_file(filepath))
+	{
+		if(!uploadOctreePointCloud(filepath))
+		{
+			std::cout << "failed to load point octree " << filepath << "\n";
+			return false;
+		}
+		m_pointsPreshuffled = true;
+		finishLoad(false);
+		return true;
+	}
+
+	if(!m_loadOptions.compressTo.empty())
+	{
+		writeChunkedPointCloud(filepath, m_loadOptions.compressTo);
+	}
+
+	// a preprocessed cache is already packed and ordered, so loading one is just an upload. Use one if that's
+	// what we were given, or if there's an up to date one next to the source. A streamed load doesn't wait
+	// for a cache to be written, it wants the first batch on screen as soon as possible. A compressed chunked
+	// file is only a fraction of the size of its cache would be, so it's always decoded rather than cached
+	const bool isCache = point_cache::is_cache_file(filepath);
+	const bool isChunked = !isCache && chunked_cloud::is_chunked_file(filepath);
+	// a filtered load ends up with different points than any cache would hold, so it doesn't use one
+	const bool useCache = m_loadOptions.useCache && !isChunked && !filtering;
+	const std::string cachePath = isCache ? std::string(filepath)
+		: useCache							  ? findPointCache(filepath, !m_loadOptions.streaming)
+											  : std::string();
+	if(isCache && filtering)
+	{
+		std::cout << "loading cache " << filepath << " as it is, without filtering\n";
+	}
+
+	// when streaming, the point buffers are only allocated here and filled in batch by batch as frames go by.
+	// Otherwise prefer uploading straight from a mapping of the file, and only parse it through tinyply if
+	// the vertex layout isn't something the shaders can consume as-is
+	bool streaming = false;
+	bool loaded = false;
+	if(!cachePath.empty())
+	{
+		streaming = m_loadOptions.streaming && startStreamingLoad(cachePath.c_str(), true);
+		loaded = streaming || uploadCachedPointCloud(cachePath.c_str());
+		// an uploaded cache works out for itself whether it's drawn in storage order
+		if(streaming)
+		{
+			m_pointsPreshuffled = true;
+		}
+	}
+	if(!loaded && !isCache)
+	{
+		// a filtered load decodes through a batch reader into host arrays, whatever the format
+		streaming = m_loadOptions.streaming && startStreamingLoad(filepath, false);
+		loaded = streaming ||
+			((m_loadOptions.pipelinedIO || filtering) && uploadPipelinedPointCloud(filepath)) ||
+			((isChunked || las_utils::is_las_file(filepath) || pcd_utils::is_pcd_file(filepath))
+					? uploadDecodedPointCloud(filepath)
+					: uploadMappedPointCloud(filepath) || uploadParsedPointCloud(filepath));
+	}
+	if(!loaded)
+	{
+		std::cout << "failed to load point cloud " << filepath << "\n";
+		return false;
+	}
+
+	finishLoad(streaming);
+	return true;
+}
+
+bool PointCloudScene::loadPointCloud(
+	const std::vector<std::string>& filepaths, const LoadOptions& options)
+{
+	std::vector<std::string> tiles;
+	for(const std::string& path : filepaths)
+	{
+		const std::vector<std::string> listed = point_readers::list_point_files(path);
+		tiles.insert(tiles.end(), listed.begin(), listed.end());
+	}
+	if(tiles.empty())
+	{
+		std::cout << "no point files to load\n";
+		return false;
+	}
+	if(tiles.size() == 1)
+	{
+		return loadPointCloud(tiles.front().c_str(), options);
+	}
+
+	m_loadOptions = options;
+	m_guiPointOrder = std::max(0, int(options.pointOrder) - 1);
+	m_loadOptions.streaming &= m_loadOptions.pointFilter == PointFilter::None;
+	m_pointCloudVAO.bind();
+	m_octreeNodes.clear();
+	m_cloudStats = cloud_stats::summary();
+	m_pointsPreshuffled = false;
+
+	bool streaming = false;
+	if(!loadTileSet(tiles, streaming))
+	{
+		std::cout << "failed to load tile set of " << tiles.size() << " files\n";
+		return false;
+	}
+
+	finishLoad(streaming);
+	return true;
+}
+
+bool PointCloudScene::loadTileSet(const std::vector<std::string>& tiles, bool& streaming)
+{
+	std::cout << "loading " << tiles.size() << " tiles as one point cloud\n";
+
+	// open every tile up front, las tiles relative to the centre of their combined bounds so they line up
+	point_readers::reader_options readerOptions;
+	readerOptions.pipelined_io = m_loadOptions.pipelinedIO;
+	readerOptions.direct_io = m_loadOptions.directIO;
+	auto tileSet = std::make_shared<point_readers::file_set>();
+	try
+	{
+		*tileSet = point_readers::open_file_set(tiles, readerOptions);
+	}
+	catch(const std::exception& e)
+	{
+		std::cout << "can't open tile: " << e.what() << "\n";
+		return false;
+	}
+	const size_t total = tileSet->total();
+
+	if(m_loadOptions.streaming)
+	{
+		// batches come from each tile in turn, so every point still lands at the same index as a full load
+		streamPoints(total,
+			[tileSet, tile = size_t(0)](size_t maxCount, float* positions, uint8_t* colours) mutable {
+				for(; tile < tileSet->readers.size(); ++tile)
+				{
+					const size_t n = tileSet->readers[tile](maxCount, positions, colours);
+					if(n)
+					{
+						return n;
+					}
+				}
+				return size_t(0);
+			});
+		streaming = true;
+		return true;
+	}
+
+	// tiles are decoded concurrently, each straight into its own range
+	const auto decode = [&tileSet](float* positions, uint8_t* colours) {
+		point_readers::read_file_set(*tileSet, positions, colours);
+	};
+	return uploadWithDecoder(tiles.front().c_str(), total, decode);
+}
+
+void PointCloudScene::finishLoad(const bool streaming)
+{
+	std::cout << "m_numPointsTotal: " << m_numPointsTotal << "\n";
+
+	const bool octree = !m_octreeNodes.empty();
+	m_doProceduralFill = m_loadOptions.proceduralFill && !octree;
+	m_fillSeed = shuffleSeed();
+
+	// a streamed cloud is framed once its first batch lands
+	if(!streaming)
+	{
+		frameCloud();
+	}
+
+	allocateRenderBuffers();
+	setLoadedPointCount(streaming ? 0 : m_numPointsTotal);
+
+	std::cout << "gl error: " << glGetError() << "\n"; // TODO: A proper macro for glErrors
+}
+
+bool PointCloudScene::reorderPoints(const PointOrder order)
+{
+	if(m_numPointsTotal == 0)
+	{
+		return false;
+	}
+
+	ply_utils::manual_timer reorder_timer;
+	reorder_timer.start();
+
+	// the buffers hold packed positions and colours, a fixed size row per point. Both are read back before
+	// either is written, so a failure part way leaves them still matching
+	const std::array<const GLUtils::Buffer*, 2> buffers = {&m_pointsBuffer, &m_colBuffer};
+	std::array<std::vector<uint8_t>, 2> rows;
+	for(size_t b = 0; b < buffers.size(); ++b)
+	{
+		buffers[b]->bindAs(GL_COPY_WRITE_BUFFER);
+		GLint64 bufferBytes = 0;
+		glGetBufferParameteri64v(GL_COPY_WRITE_BUFFER, GL_BUFFER_SIZE, &bufferBytes);
+		rows[b].resize(bufferBytes);
+		glGetBufferSubData(GL_COPY_WRITE_BUFFER, 0, bufferBytes, rows[b].data());
+	}
+	if(rows[0].size() < 3 * sizeof(float) * size_t(m_numPointsTotal))
+	{
+		GLUtils::Buffer::unbind(GL_COPY_WRITE_BUFFER);
+		return false;
+	}
+
+	const std::vector<GLuint> permutation =
+		pointPermutation(order, rows[0].data(), 3 * sizeof(float), m_numPointsTotal);
+
+	// put the first 'written' buffers back in their original order
+	const auto restore = [&](const size_t written) {
+		for(size_t b = 0; b < written; ++b)
+		{
+			buffers[b]->bindAs(GL_COPY_WRITE_BUFFER);
+			glBufferSubData(GL_COPY_WRITE_BUFFER, 0, rows[b].size(), rows[b].data());
+		}
+		GLUtils::Buffer::unbind(GL_COPY_WRITE_BUFFER);
+	};
+
+	for(size_t b = 0; b < buffers.size(); ++b)
+	{
+		if(rows[b].empty())
+		{
+			continue;
+		}
+		const size_t rowBytes = rows[b].size() / m_numPointsTotal;
+		buffers[b]->bindAs(GL_COPY_WRITE_BUFFER);
+		uint8_t* reordered = static_cast<uint8_t*>(glMapBufferRange(GL_COPY_WRITE_BUFFER,
+			0,
+			rows[b].size(),
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+		if(!reordered)
+		{
+			std::cout << "can't map point buffers to reorder them, gl error: " << glGetError() << "\n";
+			restore(b);
+			return false;
+		}
+		parallel_utils::parallel_for(m_numPointsTotal, [&](const size_t begin, const size_t end) {
+			for(size_t i = begin; i < end; ++i)
+			{
+				std::memcpy(reordered + i * rowBytes, rows[b].data() + permutation[i] * rowBytes, rowBytes);
+			}
+		});
+		if(glUnmapBuffer(GL_COPY_WRITE_BUFFER) != GL_TRUE)
+		{
+			// the storage was lost while mapped, so the contents are undefined
+			restore(b + 1);
+			return false;
+		}
+	}
+	GLUtils::Buffer::unbind(GL_COPY_WRITE_BUFFER);
+
+	reorder_timer.stop();
+	const float size_mb = (rows[0].size() + rows[1].size()) * float(1e-6);
+	const float reorder_time = reorder_timer.get() / 1000.f;
+	const char* orderName = "shuffled order";
+	if(order == PointOrder::MortonBlocks)
+	{
+		orderName = "shuffled Morton blocks";
+	}
+	else if(order == PointOrder::Hierarchical)
+	{
+		orderName = "coarse to fine order";
+	}
+	std::cout << "\treordering " << size_mb << "mb of points into " << orderName << " in " << reorder_time
+			  << " seconds [" << (size_mb / reorder_time) << " MBps] on " << parallel_utils::thread_count()
+			  << " threads\n";
+	return true;
+}
+
+std::vector<GLuint> PointCloudScene::pointPermutation(
+	const PointOrder order, const uint8_t* positions, const size_t stride, const size_t count) const
+{
+	std::vector<GLuint> permutation(count);
+	const uint64_t seed = shuffleSeed();
+	if(!isSpatialOrder(order))
+	{
+		shuffle_utils::random_permutation(permutation.data(), count, seed);
+		return permutation;
+	}
+
+	// the spatial orders take packed positions, so rows with anything else in them are copied out of first
+	std::vector<float> packed;
+	const float* xyz = reinterpret_cast<const float*>(positions);
+	if(stride != 3 * sizeof(float))
+	{
+		packed.resize(3 * count);
+		parallel_utils::parallel_for(count, [&](const size_t begin, const size_t end) {
+			for(size_t i = begin; i < end; ++i)
+			{
+				std::memcpy(&packed[3 * i], positions + i * stride, 3 * sizeof(float));
+			}
+		});
+		xyz = packed.data();
+	}
+	if(order == PointOrder::MortonBlocks)
+	{
+		point_order::block_shuffled_morton_order(
+			xyz, count, std::max<size_t>(1, m_loadOptions.orderBlockSize), seed, permutation.data());
+	}
+	else
+	{
+		point_order::hierarchical_order(xyz, count, seed, permutation.data());
+	}
+	return permutation;
+}
+
+bool PointCloudScene::isSpatialOrder(const PointOrder order)
+{
+	return order == PointOrder::MortonBlocks || order == PointOrder::Hierarchical;
+}
+
+PointCloudScene::PointOrder PointCloudScene::uploadOrder() const
+{
+	// the procedural fill makes up its own order, so what the points are stored in doesn't matter to it
+	return m_loadOptions.proceduralFill ? PointOrder::Unchanged : m_loadOptions.pointOrder;
+}
+
+void PointCloudScene::gatherIntoBuffer(const GLenum target,
+	const uint8_t* rows,
+	const size_t stride,
+	const size_t rowBytes,
+	const GLuint* permutation,
+	const size_t count)
+{
+	// row i of the buffer is the source row permutation[i], or just row i without a permutation
+	const size_t bufferBytes = rowBytes * count;
+	const auto gather = [&](uint8_t* dest) {
+		parallel_utils::parallel_for(count, [&](const size_t begin, const size_t end) {
+			for(size_t i = begin; i < end; ++i)
+			{
+				std::memcpy(dest + i * rowBytes, rows + (permutation ? permutation[i] : i) * stride, rowBytes);
+			}
+		});
+	};
+	glBufferData(target, bufferBytes, nullptr, GL_STATIC_DRAW);
+	uint8_t* mapped = static_cast<uint8_t*>(
+		glMapBufferRange(target, 0, bufferBytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+	if(mapped)
+	{
+		gather(mapped);
+	}
+	if(!mapped || glUnmapBuffer(target) != GL_TRUE)
+	{
+		std::vector<uint8_t> hostRows(bufferBytes);
+		gather(hostRows.data());
+		glBufferSubData(target, 0, bufferBytes, hostRows.data());
+	}
+}
+
+uint64_t PointCloudScene::shuffleSeed() const
+{
+	if(m_loadOptions.shuffleSeed)
+	{
+		return m_loadOptions.shuffleSeed;
+	}
+	std::random_device rd;
+	return (uint64_t(rd()) << 32) | rd();
+}
+
+void PointCloudScene::allocateVisibilityBuffer()
+{
+	// we want 'm_numPointsTotal' bits to be allocated for the visibility buffer, but this has to be
+	// allocated in whole uints, twice over if the last cycle of a subsampled visibility pass is kept
+	m_visibilityWords = (m_numPointsTotal + 31) / 32;
+	const size_t numVertsBytes =
+		sizeof(GLuint) * size_t(m_visibilityWords) * (m_visibilitySampling > 1 ? 2 : 1);
+	std::cout << "visibility buffer num bytes: " << numVertsBytes << "\n";
+	std::cout << "visibility buffer num uints: " << numVertsBytes / sizeof(GLuint) << "\n";
+
+	// generate an SSBO for the visibility
+	m_visBuffer.bindAs(GL_SHADER_STORAGE_BUFFER);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, numVertsBytes, nullptr, GL_DYNAMIC_COPY);
+	m_visBuffer.bindAsIndexed(GL_SHADER_STORAGE_BUFFER, 0);
+	// start with nothing visible, a streamed cloud only scans the part that has loaded so far
+	const GLuint zero = 0;
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	m_visibilityFrame = 0;
+}
+
+void PointCloudScene::allocateRenderBuffers()
+{
+	allocateVisibilityBuffer();
+
+	// Generate an element buffer for the point indices to redraw
+	m_elementBuffer.bindAs(GL_ELEMENT_ARRAY_BUFFER);
+	// give it enough elements for a full draw
+	glBufferData(
+		GL_ELEMENT_ARRAY_BUFFER, m_numPointsTotal * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+	// Also bind it as a SSBO so we can use it in the compute shader
+	m_elementBuffer.bindAs(GL_SHADER_STORAGE_BUFFER);
+	m_elementBuffer.bindAsIndexed(GL_SHADER_STORAGE_BUFFER, 1);
+
+	// pre-shuffled points are drawn straight out of the point buffers, and the procedural fill makes up its
+	// own order, so neither needs the index buffer
+	m_hasShuffledIndices = false;
+	if(m_pointsPreshuffled || m_loadOptions.proceduralFill)
+	{
+		return;
+	}
+
+	// generate a buffer of shuffled indices
+	// we double the size of it and repeat it so we can loop through the range with glDrawElements
+	// this introduces a lot of storage overhead, but it means we can get consistent framerates, as the shuffled draw
+	// can draw the full fillBudget at the end of the element buffer's range
+	const size_t shuffledBytes = size_t(m_numPointsTotal) * sizeof(GLuint);
+	m_shuffledBuffer.bindAs(GL_ELEMENT_ARRAY_BUFFER);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, 2 * shuffledBytes, nullptr, GL_STATIC_DRAW);
+
+	const uint64_t seed = shuffleSeed();
+	ply_utils::manual_timer shuffle_timer;
+	shuffle_timer.start();
+
+	// the permutation is generated across all cores on the host, as the shuffle reads back what it has written,
+	// which a write only mapping can't do (or only very slowly). It's uploaded into the first half, and the
+	// repeat is copied on the GPU
+	{
+		std::vector<GLuint> hostIndices(m_numPointsTotal);
+		shuffle_utils::random_permutation(hostIndices.data(), m_numPointsTotal, seed);
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, shuffledBytes, hostIndices.data());
+	}
+	m_shuffledBuffer.bindAs(GL_COPY_READ_BUFFER);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_ELEMENT_ARRAY_BUFFER, 0, shuffledBytes, shuffledBytes);
+	GLUtils::Buffer::unbind(GL_COPY_READ_BUFFER);
+
+	m_hasShuffledIndices = true;
+
+	shuffle_timer.stop();
+	std::cout << "shuffling " << m_numPointsTotal << " indices with seed " << seed << " in "
+			  << shuffle_timer.get() / 1000.f << " seconds on " << parallel_utils::thread_count()
+			  << " threads\n";
+}
+
+void PointCloudScene::setLoadedPointCount(const GLuint count)
+{
+	m_numPointsLoaded = count;
+
+	// get the limits for the compute shader invocation
+	int work_grp_cnt, work_grp_size;
+	glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &work_grp_cnt);
+	glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 0, &work_grp_size);
+
+	// set the compute dispatch parameters
+	m_elementComputeShader.use();
+	// determine the number of elements in the visibility buffer, or number of uints in the buffer at 4 bytes each,
+	// only the loaded points can have had their bits set, so that's all that needs scanning
+	const unsigned int elementCount = (count + 31) / 32;
+	glUniform1ui(m_elementComputeShader.getUniformLocation("numElements"), elementCount);
+	// each workgroup compacts GROUP_SIZE elements (see element_comp.glsl), the groups are laid out over x then
+	// y, so clouds with more groups than the x limit still fit in one dispatch
+	constexpr unsigned int elementGroupSize = 256;
+	const unsigned int numGroups = std::max(1u, (elementCount + elementGroupSize - 1) / elementGroupSize);
+	m_computeDispatchCount = std::min(numGroups, unsigned(work_grp_cnt));
+	m_computeGroupCount = (numGroups + m_computeDispatchCount - 1) / m_computeDispatchCount;
+
+	// the fill pass indexes the whole cloud, the vertex shader culls anything that hasn't landed yet
+	m_pointsShader.use();
+	glUniform1ui(m_pointsShader.getUniformLocation("numPointsLoaded"), count);
+	m_pointsComputeShader.use();
+	glUniform1ui(m_pointsComputeShader.getUniformLocation("numPointsLoaded"), count);
+
+	if(count == m_numPointsTotal)
+	{
+		std::cout << "work_grp_cnt: " << work_grp_cnt << "\n";
+		std::cout << "work_grp_size: " << work_grp_size << "\n";
+		std::cout << "m_computeGroupCount: " << m_computeGroupCount << "\n";
+		std::cout << "m_computeDispatchCount: " << m_computeDispatchCount << "\n";
+	}
+}
+
+std::string PointCloudScene::findPointCache(const char* filepath, const bool allowWrite)
+{
+	const std::string cachePath = point_cache::sidecar_path(filepath);
+	// a cache shuffled with some other seed than the one asked for is rewritten, so runs can be reproduced
+	if(point_cache::is_current(cachePath, filepath, m_loadOptions.shuffleSeed))
+	{
+		return cachePath;
+	}
+	if(!allowWrite)
+	{
+		return std::string();
+	}
+
+	// a failed write isn't fatal (e.g. a read only directory), the source just gets loaded directly
+	try
+	{
+		size_t count = 0;
+		const StreamingLoader::ReadFunction read = openPointReader(filepath, count);
+		point_cache::write_cache({filepath}, count, read, cachePath, shuffleSeed());
+	}
+	catch(const std::exception& e)
+	{
+		std::cout << "can't write a point cache for " << filepath << ": " << e.what() << "\n";
+		return std::string();
+	}
+	return cachePath;
+}
+
+void PointCloudScene::writeChunkedPointCloud(const char* filepath, const std::string& outputPath)
+{
+	// like a cache write, failing to write isn't fatal, the source still gets loaded
+	try
+	{
+		size_t count = 0;
+		const StreamingLoader::ReadFunction read = openPointReader(filepath, count);
+		chunked_cloud::write_chunked(outputPath, count, read);
+	}
+	catch(const std::exception& e)
+	{
+		std::cout << "can't write a chunked point file for " << filepath << ": " << e.what() << "\n";
+	}
+}
+
+bool PointCloudScene::uploadCachedPointCloud(const char* cachePath)
+{
+	point_cache::mapped_cache cache;
+	try
+	{
+		cache = point_cache::map_cache(cachePath);
+	}
+	catch(const std::exception& e)
+	{
+		std::cout << "can't map " << cachePath << ": " << e.what() << "\n";
+		return false;
+	}
+
+	ply_utils::manual_timer upload_timer;
+	upload_timer.start();
+
+	// the sections are already in the layout bindPackedPoints expects, so upload straight from the mapping. A
+	// cache already in the order asked for is drawn as it is. Otherwise a shuffled load keeps the cache's order
+	// and draws through the shuffled index buffer, and a spatial order is gathered on the way up
+	const PointOrder requested = uploadOrder();
+	const uint32_t flags = cache.hdr.flags;
+	const bool inOrder = requested == PointOrder::Unchanged ||
+		(requested == PointOrder::Shuffled && (flags & point_cache::shuffled)) ||
+		(requested == PointOrder::MortonBlocks && (flags & point_cache::morton_blocks)) ||
+		(requested == PointOrder::Hierarchical && (flags & point_cache::hierarchical));
+	const PointOrder order = inOrder || requested == PointOrder::Shuffled ? PointOrder::Unchanged : requested;
+	if(order != PointOrder::Unchanged)
+	{
+		cache.file->advise_random_access();
+	}
+	uploadPackedPoints(cache.positions, cache.colours, cache.hdr.point_count, order);
+	m_pointsPreshuffled = inOrder || order != PointOrder::Unchanged;
+
+	upload_timer.stop();
+	const float upload_time = upload_timer.get() / 1000.f;
+	const float size_mb = cache.hdr.point_count * (3 * sizeof(float) + 3) * float(1e-6);
+	std::cout << "\tuploading " << size_mb << "mb from cache " << cachePath << " in " << upload_time
+			  << " seconds [" << (size_mb / upload_time) << " MBps]\n";
+	return true;
+}
+
+bool PointCloudScene::uploadOctreePointCloud(const char* filepath)
+{
+	octree_cloud::mapped_octree octree;
+	try
+	{
+		octree = octree_cloud::map_octree_file(filepath);
+	}
+	catch(const std::exception& e)
+	{
+		std::cout << "can't map " << filepath << ": " << e.what() << "\n";
+		return false;
+	}
+
+	// nodes are breadth first with their points in the same order, so the nodes that fit the budget are a
+	// prefix of both, and always include every ancestor of each of them. Always keep the root
+	const size_t budget = m_loadOptions.octreePointBudget;
+	uint32_t resident = 1;
+	size_t residentPoints = octree.nodes[0].point_count;
+	while(resident < octree.hdr.node_count && residentPoints + octree.nodes[resident].point_count <= budget)
+	{
+		residentPoints += octree.nodes[resident++].point_count;
+	}
+	if(residentPoints > UINT32_MAX)
+	{
+		std::cout << filepath << ": " << residentPoints << " points won't fit in the point buffers\n";
+		return false;
+	}
+
+	m_octreeNodes.resize(resident);
+	for(uint32_t i = 0; i < resident; ++i)
+	{
+		const octree_cloud::node_entry& entry = octree.nodes[i];
+		OctreeNode& node = m_octreeNodes[i];
+		node.boundsMin = glm::vec3(entry.bounds_min[0], entry.bounds_min[1], entry.bounds_min[2]);
+		node.size = entry.size;
+		node.firstPoint = GLint(entry.first_point);
+		node.pointCount = GLsizei(entry.point_count);
+		node.firstChild = entry.first_child;
+		// children past the budget were never uploaded, and they're the last of their siblings if any are
+		node.childMask = 0;
+		for(GLuint o = 0, child = entry.first_child; o < 8; ++o)
+		{
+			if(entry.child_mask & (1u << o))
+			{
+				node.childMask |= child++ < resident ? 1u << o : 0u;
+			}
+		}
+	}
+
+	ply_utils::manual_timer upload_timer;
+	upload_timer.start();
+
+	// an octree's points have to stay in their nodes, and it draws them in its own order
+	uploadPackedPoints(octree.positions, octree.colours, residentPoints, PointOrder::Unchanged);
+
+	upload_timer.stop();
+	const float upload_time = upload_timer.get() / 1000.f;
+	const float size_mb = residentPoints * (3 * sizeof(float) + 3) * float(1e-6);
+	std::cout << "\tuploading " << size_mb << "mb of " << resident << " / " << octree.hdr.node_count
+			  << " octree nodes from " << filepath << " in " << upload_time << " seconds ["
+			  << (size_mb / upload_time) << " MBps]\n";
+	return true;
+}
+
+void PointCloudScene::selectOctreeNodes(const glm::mat4& view)
+{
+	m_lodFirsts.clear();
+	m_lodCounts.clear();
+	m_lodPointCount = 0;
+
+	const glm::mat4 modelView = view * m_modelMat;
+	const glm::mat4 projection = m_camera.getProjection();
+	const glm::mat4 mvp = projection * modelView;
+	// pixels per unit of size at unit distance along the view axis
+	const float pixelScale = 0.5f * m_viewportHeight * projection[1][1];
+
+	std::vector<GLuint> stack = {0};
+	while(!stack.empty())
+	{
+		const OctreeNode& node = m_octreeNodes[stack.back()];
+		stack.pop_back();
+
+		// outside the frustum if every corner is outside the same clip plane
+		unsigned int outside[6] = {0, 0, 0, 0, 0, 0};
+		for(unsigned int c = 0; c < 8; ++c)
+		{
+			const glm::vec3 corner =
+				node.boundsMin + node.size * glm::vec3(c & 1, (c >> 1) & 1, (c >> 2) & 1);
+			const glm::vec4 clip = mvp * glm::vec4(corner, 1.0f);
+			for(unsigned int k = 0; k < 3; ++k)
+			{
+				outside[2 * k] += clip[k] < -clip.w;
+				outside[2 * k + 1] += clip[k] > clip.w;
+			}
+		}
+		if(std::any_of(outside, outside + 6, [](const unsigned int n) { return n == 8; }))
+		{
+			continue;
+		}
+
+		if(node.pointCount > 0)
+		{
+			m_lodFirsts.push_back(node.firstPoint);
+			m_lodCounts.push_back(node.pointCount);
+			m_lodPointCount += node.pointCount;
+		}
+
+		// the children are worth drawing when this node's spread of points is big on screen, judged from the
+		// nearest its bounding sphere gets to the camera
+		const float radius = 0.8660254f * node.size;
+		const glm::vec4 centre = glm::vec4(node.boundsMin + glm::vec3(0.5f * node.size), 1.0f);
+		const float distance = std::max(glm::length(glm::vec3(modelView * centre)) - radius, 1e-3f);
+		if(node.size * pixelScale / distance <= m_lodThreshold)
+		{
+			continue;
+		}
+		// the resident children are always the first of their siblings
+		for(GLuint o = 0, child = node.firstChild; o < 8; ++o)
+		{
+			if(node.childMask & (1u << o))
+			{
+				stack.push_back(child++);
+			}
+		}
+	}
+}
+
+StreamingLoader::ReadFunction PointCloudScene::openPointReader(const char* filepath, size_t& count)
+{
+	point_readers::reader_options options;
+	options.pipelined_io = m_loadOptions.pipelinedIO;
+	options.direct_io = m_loadOptions.directIO;
+	return point_readers::open_point_reader(filepath, count, options);
+}
+
+bool PointCloudScene::startStreamingLoad(const char* filepath, const bool fromCache)
+{
+	size_t count = 0;
+	StreamingLoader::ReadFunction read;
+	try
+	{
+		if(fromCache)
+		{
+			// a cache is read in storage order, which is already shuffled, so every batch is a random subset
+			const auto cache =
+				std::make_shared<point_cache::mapped_cache>(point_cache::map_cache(filepath));
+			count = cache->hdr.point_count;
+			read = [cache, next = size_t(0)](
+					   size_t maxCount, float* positions, uint8_t* colours) mutable {
+				const size_t n = std::min<size_t>(maxCount, cache->hdr.point_count - next);
+				std::copy_n(cache->positions + 3 * next, 3 * n, positions);
+				std::copy_n(cache->colours + 3 * next, 3 * n, colours);
+				next += n;
+				return n;
+			};
+		}
+		else
+		{
+			read = openPointReader(filepath, count);
+		}
+	}
+	catch(const std::exception& e)
+	{
+		std::cout << "can't stream " << filepath << ": " << e.what() << "\n";
+		return false;
+	}
+
+	streamPoints(count, std::move(read));
+	return true;
+}
+
+void PointCloudScene::streamPoints(const size_t count, StreamingLoader::ReadFunction read)
+{
+	// allocate the full size storage up front, batches are written into it as they land
+	m_pointsBuffer.bindAs(GL_ARRAY_BUFFER);
+	glBufferData(GL_ARRAY_BUFFER, 3 * sizeof(float) * count, nullptr, GL_STATIC_DRAW);
+	m_colBuffer.bindAs(GL_TEXTURE_BUFFER);
+	glBufferData(GL_TEXTURE_BUFFER, 3 * sizeof(uint8_t) * count, nullptr, GL_STATIC_DRAW);
+	bindPackedPoints(count);
+
+	// a handful of batches in flight is enough to keep the reader busy while the render thread uploads
+	constexpr size_t maxQueuedBatches = 4;
+	m_streamStartTime = std::chrono::steady_clock::now();
+	m_streamingLoader = std::make_unique<StreamingLoader>(
+		std::move(read), m_loadOptions.streamBatchSize, maxQueuedBatches);
+}
+
+void PointCloudScene::updateStreamingLoad()
+{
+	if(!m_streamingLoader)
+	{
+		return;
+	}
+
+	// upload whatever has been decoded since the last frame
+	GLuint loaded = m_numPointsLoaded;
+	StreamingLoader::Batch batch;
+	while(m_streamingLoader->tryPop(batch))
+	{
+		if(m_cloudStats.count == 0 && batch.count > 0)
+		{
+			// frame the view on the first batch rather than waiting for them all. From a cache it's a random
+			// sample of the whole cloud, a sparser one than the cloud itself
+			summarisePoints(batch.positions.data(), batch.count, 3 * sizeof(float));
+			if(m_pointsPreshuffled)
+			{
+				m_cloudStats.spacing *= std::sqrt(float(batch.count) / m_numPointsTotal);
+			}
+			frameCloud();
+		}
+		m_pointsBuffer.bindAs(GL_ARRAY_BUFFER);
+		glBufferSubData(GL_ARRAY_BUFFER,
+			3 * sizeof(float) * batch.first,
+			3 * sizeof(float) * batch.count,
+			batch.positions.data());
+		m_colBuffer.bindAs(GL_TEXTURE_BUFFER);
+		glBufferSubData(GL_TEXTURE_BUFFER,
+			3 * sizeof(uint8_t) * batch.first,
+			3 * sizeof(uint8_t) * batch.count,
+			batch.colours.data());
+		loaded = batch.first + batch.count;
+		m_streamingLoader->recycle(std::move(batch));
+	}
+
+	if(loaded != m_numPointsLoaded)
+	{
+		setLoadedPointCount(loaded);
+	}
+
+	if(m_streamingLoader->isFinished())
+	{
+		const std::chrono::duration<float> elapsed =
+			std::chrono::steady_clock::now() - m_streamStartTime;
+		std::cout << "streamed " << m_numPointsLoaded << " / " << m_numPointsTotal << " points in "
+				  << elapsed.count() << " seconds\n";
+		m_streamingLoader.reset();
+	}
+}
+
+bool PointCloudScene::uploadMappedPointCloud(const char* filepath)
+{
+	ply_utils::mapped_ply ply;
+	try
+	{
+		ply = ply_utils::map_ply_file(filepath);
+	}
+	catch(const std::exception& e)
+	{
+		std::cout << "can't map " << filepath << ": " << e.what() << "\n";
+		return false;
+	}
+
+	// the GPU reads little endian float positions and uchar colours, anything else (including ascii) is
+	// decoded into packed arrays across all cores first
+	const PointOrder order = uploadOrder();
+	if(!ply.is_binary || ply.is_big_endian || !ply.positions ||
+		ply.positions.type != tinyply::Type::FLOAT32 || !ply.colours ||
+		ply.colours.type != tinyply::Type::UINT8)
+	{
+		// a spatial order is worked out from the decoded positions, so it decodes through host arrays. Any other
+		// decodes straight into the point buffers in file order, and a shuffled fill goes through the index buffer
+		if(m_loadOptions.decodeIntoMappedBuffers && !isSpatialOrder(order) &&
+			decodeIntoMappedBuffers(ply.vertex_count, [&ply](float* positions, uint8_t* colours) {
+				ply_utils::decode_vertices(ply, positions, colours);
+			}))
+		{
+#ifdef PCR_VERIFY_LOADERS
+			// read the buffers back, slow, but this is only a debug option
+			std::vector<float> readPositions(3 * ply.vertex_count);
+			std::vector<uint8_t> readColours(3 * ply.vertex_count);
+			m_pointsBuffer.bindAs(GL_ARRAY_BUFFER);
+			glGetBufferSubData(GL_ARRAY_BUFFER, 0, readPositions.size() * sizeof(float), readPositions.data());
+			m_colBuffer.bindAs(GL_TEXTURE_BUFFER);
+			glGetBufferSubData(GL_TEXTURE_BUFFER, 0, readColours.size(), readColours.data());
+			ply_utils::verify_vertices(filepath, readPositions.data(), readColours.data(), ply.vertex_count);
+#endif
+			return true;
+		}
+
+		// either disabled, or the driver couldn't map buffers this size, so decode on the host instead
+		std::vector<float> positions(3 * ply.vertex_count);
+		std::vector<uint8_t> colours(3 * ply.vertex_count);
+		try
+		{
+			ply_utils::decode_vertices(ply, positions.data(), colours.data());
+		}
+		catch(const std::exception& e)
+		{
+			std::cout << "can't decode " << filepath << ": " << e.what() << "\n";
+			return false;
+		}
+#ifdef PCR_VERIFY_LOADERS
+		ply_utils::verify_vertices(filepath, positions.data(), colours.data(), ply.vertex_count);
+#endif
+		uploadPackedPoints(positions.data(), colours.data(), ply.vertex_count, order);
+		return true;
+	}
+
+	ply_utils::manual_timer upload_timer;
+	upload_timer.start();
+
+	// the positions and colours are gathered out of the interleaved rows across all cores, straight from the
+	// mapping into the packed point buffers, leaving behind any other properties the vertices have. To put the
+	// points in some order, the rows are gathered in it instead
+	if(order != PointOrder::Unchanged)
+	{
+		ply.file->advise_random_access();
+	}
+	const std::vector<GLuint> permutation = order == PointOrder::Unchanged
+		? std::vector<GLuint>()
+		: pointPermutation(order, ply.positions.data, ply.vertex_stride, ply.vertex_count);
+	const GLuint* gatherOrder = permutation.empty() ? nullptr : permutation.data();
+	m_pointsBuffer.bindAs(GL_ARRAY_BUFFER);
+	gatherIntoBuffer(
+		GL_ARRAY_BUFFER, ply.positions.data, ply.vertex_stride, 3 * sizeof(float), gatherOrder, ply.vertex_count);
+	m_colBuffer.bindAs(GL_TEXTURE_BUFFER);
+	gatherIntoBuffer(
+		GL_TEXTURE_BUFFER, ply.colours.data, ply.vertex_stride, 3 * sizeof(uint8_t), gatherOrder, ply.vertex_count);
+	m_pointsPreshuffled = gatherOrder != nullptr;
+	bindPackedPoints(ply.vertex_count);
+	summarisePoints(ply.positions.data, ply.vertex_count, ply.vertex_stride);
+
+	upload_timer.stop();
+	const float upload_time = upload_timer.get() / 1000.f;
+	const float size_mb = ply.vertex_count * (3 * sizeof(float) + 3 * sizeof(uint8_t)) * float(1e-6);
+	std::cout << "\tuploading " << size_mb << "mb from mapping in " << upload_time << " seconds ["
+			  << (size_mb / upload_time) << " MBps]\n";
+	return true;
+}
+
+bool PointCloudScene::uploadParsedPointCloud(const char* filepath)
 {
 	// read the vertex positions and colours from the ply file
 	std::shared_ptr<tinyply::PlyData> plyPositions, plyColours;
 	ply_utils::read_ply_file(filepath, plyPositions, plyColours);
-	m_numPointsTotal = plyPositions ? plyPositions->count : 0;
-	std::cout << "m_numPointsTotal: " << m_numPointsTotal << "\n";
+	if(!plyPositions || !plyColours)
+	{
+		return false;
+	}
 
-	// TODO: check this is all correct, and that it rounds up to the nearest uint
-	// we want 'm_numPointsTotal' bits to be allocated for the visibility buffer, but this has to be
-	// allocated in bytes
-	const size_t numVertsBytes = ceil(m_numPointsTotal / 8.0f); // 8 bits per byte
-	std::cout << "visibility buffer num bytes: " << numVertsBytes << "\n";
-	std::cout << "visibility buffer num uints: " << ceil(numVertsBytes / 4.0f) << "\n";
+	uploadPackedPoints(reinterpret_cast<const float*>(plyPositions->buffer.get()),
+		plyColours->buffer.get(),
+		plyPositions->count,
+		uploadOrder());
+	return true;
+}
 
-	// get the limits for the compute shader invocation
-	int work_grp_cnt, work_grp_size;
-	glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &work_grp_cnt);
-	glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 0, &work_grp_size);
-	std::cout << "work_grp_cnt: " << work_grp_cnt << "\n";
-	std::cout << "work_grp_size: " << work_grp_size << "\n";
+bool PointCloudScene::uploadDecodedPointCloud(const char* filepath)
+{
+	size_t count = 0;
+	std::function<void(float*, uint8_t*)> decode;
+	try
+	{
+		if(chunked_cloud::is_chunked_file(filepath))
+		{
+			const auto chunked = std::make_shared<chunked_cloud::mapped_chunked>(
+				chunked_cloud::map_chunked_file(filepath));
+			count = chunked->hdr.point_count;
+			decode = [chunked](float* positions, uint8_t* colours) {
+				chunked_cloud::decode_points(*chunked, positions, colours);
+			};
+		}
+		else if(las_utils::is_las_file(filepath))
+		{
+			const auto las = std::make_shared<las_utils::mapped_las>(las_utils::map_las_file(filepath));
+			count = las->point_count;
+			decode = [las](float* positions, uint8_t* colours) {
+				las_utils::decode_points(*las, positions, colours);
+			};
+		}
+		else
+		{
+			const auto pcd = std::make_shared<pcd_utils::mapped_pcd>(pcd_utils::map_pcd_file(filepath));
+			count = pcd->point_count;
+			decode = [pcd](float* positions, uint8_t* colours) {
+				pcd_utils::decode_points(*pcd, positions, colours);
+			};
+		}
+	}
+	catch(const std::exception& e)
+	{
+		std::cout << "can't map " << filepath << ": " << e.what() << "\n";
+		return false;
+	}
 
-	// set the compute dispatch parameters
-	m_elementComputeShader.use();
-	// determine the number of elements in the visibility buffer, or number of uints in the buffer at 4 bytes each
-	unsigned int elementCount = ceil(numVertsBytes / 4.0f);
-	glUniform1ui(m_elementComputeShader.getUniformLocation("numElements"), elementCount);
-	// determine the number of elements to process in each shader invocation
-	m_computeGroupCount = floor(elementCount / work_grp_cnt) + 1;
-	std::cout<<"m_computeGroupCount: "<<m_computeGroupCount<<"\n";
-	// determine the number of compute shaders to dispatch, this should always be less than work_grp_cnt
-	m_computeDispatchCount = ceil(elementCount / m_computeGroupCount);
-	std::cout<<"m_computeDispatchCount: "<<m_computeDispatchCount<<"\n";
+	return uploadWithDecoder(filepath, count, decode);
+}
 
-	// we have to bind a VAO to hold the vertex attributes for the buffers, and the element buffer bindings
-	m_pointCloudVAO.bind();
-	// generate buffers for verts, set the VAO attributes
+bool PointCloudScene::uploadPipelinedPointCloud(const char* filepath)
+{
+	size_t count = 0;
+	StreamingLoader::ReadFunction read;
+	try
+	{
+		read = openPointReader(filepath, count);
+	}
+	catch(const std::exception& e)
+	{
+		std::cout << "can't open " << filepath << " for pipelined reads: " << e.what() << "\n";
+		return false;
+	}
+
+	// drain the reader into the destination, each block is decoded while the next reads are in flight
+	const auto decode = [&read, count](float* positions, uint8_t* colours) {
+		ply_utils::manual_timer read_timer;
+		read_timer.start();
+		point_readers::read_points(read, count, positions, colours);
+		read_timer.stop();
+		const float read_time = read_timer.get() / 1000.f;
+		std::cout << "\treading and decoding " << count << " points in " << read_time << " seconds ["
+				  << (count / read_time) << " points per second]\n";
+	};
+	return uploadWithDecoder(filepath, count, decode);
+}
+
+bool PointCloudScene::uploadWithDecoder(
+	const char* filepath, const size_t count, const std::function<void(float*, uint8_t*)>& decode)
+{
+	// filtering and the spatial orders both need the decoded points on the host first. A shuffled load decodes
+	// in file order straight into the point buffers and draws through the shuffled index buffer instead, so
+	// it never holds the cloud on the host
+	const bool filtering = m_loadOptions.pointFilter != PointFilter::None;
+	const PointOrder order = uploadOrder();
+	if(m_loadOptions.decodeIntoMappedBuffers && !filtering && !isSpatialOrder(order) &&
+		decodeIntoMappedBuffers(count, decode))
+	{
+		return true;
+	}
+
+	std::vector<float> positions(3 * count);
+	std::vector<uint8_t> colours(3 * count);
+	size_t kept = count;
+	try
+	{
+		decode(positions.data(), colours.data());
+		if(filtering)
+		{
+			kept = filterPoints(positions.data(), colours.data(), count);
+		}
+	}
+	catch(const std::exception& e)
+	{
+		std::cout << "can't decode " << filepath << ": " << e.what() << "\n";
+		return false;
+	}
+	uploadPackedPoints(positions.data(), colours.data(), kept, order);
+	return true;
+}
+
+size_t PointCloudScene::filterPoints(float* positions, uint8_t* colours, const size_t count)
+{
+	ply_utils::manual_timer filter_timer;
+	filter_timer.start();
+
+	const bool voxels = m_loadOptions.pointFilter == PointFilter::Voxels;
+	const size_t kept = voxels
+		? point_filter::decimate_to_voxels(positions, colours, count, m_loadOptions.voxelSize)
+		: point_filter::remove_duplicates(positions, colours, count);
+
+	filter_timer.stop();
+	const float filter_time = filter_timer.get() / 1000.f;
+	std::cout << "\tfiltering " << count << " points "
+			  << (voxels ? "to one per voxel of " + std::to_string(m_loadOptions.voxelSize)
+						 : std::string("for duplicates"))
+			  << ", removed " << (count - kept) << " ("
+			  << (count ? (count - kept) * 100.0f / count : 0.0f) << "%) in " << filter_time
+			  << " seconds on " << parallel_utils::thread_count() << " threads\n";
+	return kept;
+}
+
+bool PointCloudScene::decodeIntoMappedBuffers(
+	const size_t count, const std::function<void(float*, uint8_t*)>& decode)
+{
+	const size_t positionBytes = 3 * sizeof(float) * count;
+	const size_t colourBytes = 3 * sizeof(uint8_t) * count;
+
+	// allocate the storage up front, then let the decoder threads write straight into it
+	m_pointsBuffer.bindAs(GL_ARRAY_BUFFER);
+	glBufferData(GL_ARRAY_BUFFER, positionBytes, nullptr, GL_STATIC_DRAW);
+	m_colBuffer.bindAs(GL_TEXTURE_BUFFER);
+	glBufferData(GL_TEXTURE_BUFFER, colourBytes, nullptr, GL_STATIC_DRAW);
+
+	constexpr GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT;
+	float* positions =
+		static_cast<float*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, positionBytes, access));
+	uint8_t* colours =
+		static_cast<uint8_t*>(glMapBufferRange(GL_TEXTURE_BUFFER, 0, colourBytes, access));
+
+	bool decoded = positions && colours;
+	if(!decoded)
+	{
+		std::cout << "can't map point buffers for writing, gl error: " << glGetError() << "\n";
+	}
+	else
+	{
+		try
+		{
+			decode(positions, colours);
+		}
+		catch(const std::exception& e)
+		{
+			std::cout << "can't decode into mapped point buffers: " << e.what() << "\n";
+			decoded = false;
+		}
+	}
+
+	// unmapping fails if the storage was lost while mapped, in which case the contents are undefined
+	if(colours)
+	{
+		decoded &= glUnmapBuffer(GL_TEXTURE_BUFFER) == GL_TRUE;
+	}
+	if(positions)
+	{
+		decoded &= glUnmapBuffer(GL_ARRAY_BUFFER) == GL_TRUE;
+	}
+	if(!decoded)
+	{
+		return false;
+	}
+
+	bindPackedPoints(count);
+	summariseBufferSample(count);
+	return true;
+}
+
+void PointCloudScene::uploadPackedPoints(
+	const float* positions, const uint8_t* colours, const size_t count, const PointOrder order)
+{
+	if(order != PointOrder::Unchanged)
+	{
+		// the points are gathered into the buffers in order, so the fill can draw contiguous ranges of them
+		// rather than going through a shuffled index buffer
+		const std::vector<GLuint> permutation =
+			pointPermutation(order, reinterpret_cast<const uint8_t*>(positions), 3 * sizeof(float), count);
+		m_pointsBuffer.bindAs(GL_ARRAY_BUFFER);
+		gatherIntoBuffer(GL_ARRAY_BUFFER,
+			reinterpret_cast<const uint8_t*>(positions),
+			3 * sizeof(float),
+			3 * sizeof(float),
+			permutation.data(),
+			count);
+		m_colBuffer.bindAs(GL_TEXTURE_BUFFER);
+		gatherIntoBuffer(
+			GL_TEXTURE_BUFFER, colours, 3 * sizeof(uint8_t), 3 * sizeof(uint8_t), permutation.data(), count);
+		m_pointsPreshuffled = true;
+	}
+	else
+	{
+		// generate buffers for verts
+		m_pointsBuffer.bindAs(GL_ARRAY_BUFFER);
+		glBufferData(GL_ARRAY_BUFFER, 3 * sizeof(float) * count, positions, GL_STATIC_DRAW);
+
+		// generate buffers for colours
+		m_colBuffer.bindAs(GL_TEXTURE_BUFFER);
+		glBufferData(GL_TEXTURE_BUFFER, 3 * sizeof(uint8_t) * count, colours, GL_STATIC_DRAW);
+	}
+
+	bindPackedPoints(count);
+	summarisePoints(positions, count, 3 * sizeof(float));
+}
+
+void PointCloudScene::summarisePoints(const void* positions, const size_t count, const size_t stride)
+{
+	ply_utils::manual_timer stats_timer;
+	stats_timer.start();
+	m_cloudStats = cloud_stats::summarise(positions, count, stride);
+	stats_timer.stop();
+	std::cout << "\tsummarising " << count << " points in " << stats_timer.get() / 1000.f << " seconds on "
+			  << parallel_utils::thread_count() << " threads\n";
+}
+
+void PointCloudScene::summariseBufferSample(const size_t count)
+{
+	// reading back every point would cost as much as the upload did, so read runs of them, each a single small
+	// transfer. A run sits inside one cell of the grid the spacing is estimated on, so runs sample the
+	// occupied cells as well as single points would
+	constexpr size_t numRuns = 4096;
+	constexpr size_t runLength = 64;
+	const size_t runs = count > numRuns * runLength ? numRuns : 1;
+	const size_t length = runs == 1 ? count : runLength;
+	std::vector<float> sample(3 * runs * length);
 	m_pointsBuffer.bindAs(GL_ARRAY_BUFFER);
-	glBufferData(GL_ARRAY_BUFFER,
-		plyPositions->buffer.size_bytes(),
-		plyPositions->buffer.get(),
-		GL_STATIC_DRAW);
+	for(size_t r = 0; r < runs; ++r)
+	{
+		const size_t first = runs == 1 ? 0 : r * (count - length) / (runs - 1);
+		glGetBufferSubData(GL_ARRAY_BUFFER,
+			3 * sizeof(float) * first,
+			3 * sizeof(float) * length,
+			sample.data() + 3 * r * length);
+	}
+
+	summarisePoints(sample.data(), runs * length, 3 * sizeof(float));
+	// the bounds are only the sample's, and the cloud is denser than it by the sampling rate
+	m_cloudStats.spacing *= std::sqrt(float(runs * length) / count);
+	m_cloudStats.count = count;
+}
+
+void PointCloudScene::frameCloud()
+{
+	const cloud_stats::summary& stats = m_cloudStats;
+	if(stats.count == 0)
+	{
+		return;
+	}
+
+	// centre the robust bounds at the origin and scale them to a fixed radius, so outliers can't pull the view
+	// off the cloud and the camera and point size controls behave the same whatever units it's in. The cloud is
+	// assumed to be Z up, like most scans
+	constexpr float framedRadius = 10.0f;
+	glm::vec3 centre, extent, reach;
+	for(int k = 0; k < 3; ++k)
+	{
+		centre[k] = 0.5f * (stats.robust_min[k] + stats.robust_max[k]);
+		extent[k] = stats.robust_max[k] - stats.robust_min[k];
+		reach[k] = std::max(centre[k] - stats.bounds_min[k], stats.bounds_max[k] - centre[k]);
+	}
+	const float radius = 0.5f * glm::length(extent);
+	const float scale = radius > 0.0f && std::isfinite(radius) ? framedRadius / radius : 1.0f;
+	m_modelMat = glm::rotate(glm::mat4(1.0), 3.14159f / 2.0f, glm::vec3(-1.0f, 0.0f, 0.0f)) *
+		glm::scale(glm::mat4(1.0), glm::vec3(scale)) * glm::translate(glm::mat4(1.0), -centre);
+	m_pointsShader.use();
+	glUniformMatrix4fv(
+		m_pointsShader.getUniformLocation("model"), 1, GL_FALSE, glm::value_ptr(m_modelMat));
+
+	// back far enough to fit the robust bounds in view, with the clip planes around every point, bar strays so
+	// far out that the depth range would be mostly empty space
+	const float halfFov = 0.5f * glm::radians(m_camera.getFOV());
+	const float distance = framedRadius / std::sin(halfFov);
+	const float sceneRadius = std::min(glm::length(reach) * scale, 10.0f * framedRadius);
+	m_camera.setCenter(glm::vec3(0.0f));
+	m_camera.setDistance(distance);
+	m_camera.setSceneRadius(std::isfinite(sceneRadius) ? sceneRadius : framedRadius);
+
+	// the vertex shader sizes points at pointSize * 100 / depth pixels, and a point should about cover the gap
+	// to its neighbours on screen, at any depth
+	const float pixelsPerUnit = 0.5f * m_viewportHeight / std::tan(halfFov);
+	if(stats.spacing > 0.0f)
+	{
+		m_pointSize = glm::clamp(1.5f * stats.spacing * scale * pixelsPerUnit / 100.0f, 0.01f, 10.0f);
+	}
 
+	std::cout << "framing " << stats.count << " points around (" << centre.x << ", " << centre.y << ", "
+			  << centre.z << "), robust extent (" << extent.x << ", " << extent.y << ", " << extent.z
+			  << "), spacing " << stats.spacing << ", point size " << m_pointSize << "\n";
+}
+
+void PointCloudScene::bindPackedPoints(const size_t count)
+{
+	// set the VAO attributes
+	m_pointsBuffer.bindAs(GL_ARRAY_BUFFER);
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), nullptr);
+	// and as a storage buffer, for the procedural fill to pull positions from
+	m_pointsBuffer.bindAsIndexed(GL_SHADER_STORAGE_BUFFER, 2);
 
-	// generate buffers for colours
-	m_colBuffer.bindAs(GL_TEXTURE_BUFFER);
-	glBufferData(GL_TEXTURE_BUFFER,
-		plyColours->buffer.size_bytes(),
-		plyColours->buffer.get(),
-		GL_STATIC_DRAW);
-	// map it to a texture
-	glActiveTexture(GL_TEXTURE2);
-	m_colourTexture.bindAs(GL_TEXTURE_BUFFER);
-	m_colBuffer.attachToTextureBuffer(GL_R8UI);
+	attachColourTexture(count);
 
 	// optionally, enable it as a vertex attribute
 	// m_colBuffer.bindAs(GL_ARRAY_BUFFER);
 	// glEnableVertexAttribArray(1);
 	// glVertexAttribIPointer(1, 3, GL_UNSIGNED_BYTE, 3 * sizeof(unsigned char), nullptr); // sized type
 
-	// generate an SSBO for the visibility
-	m_visBuffer.bindAs(GL_SHADER_STORAGE_BUFFER);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, numVertsBytes, nullptr, GL_DYNAMIC_COPY);
-	m_visBuffer.bindAsIndexed(GL_SHADER_STORAGE_BUFFER, 0);
+	m_numPointsTotal = count;
+}
 
-	// Generate an element buffer for the point indices to redraw
-	m_elementBuffer.bindAs(GL_ELEMENT_ARRAY_BUFFER);
-	// give it enough elements for a full draw
-	glBufferData(
-		GL_ELEMENT_ARRAY_BUFFER, m_numPointsTotal * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
-	// Also bind it as a SSBO so we can use it in the compute shader
-	m_elementBuffer.bindAs(GL_SHADER_STORAGE_BUFFER);
-	m_elementBuffer.bindAsIndexed(GL_SHADER_STORAGE_BUFFER, 1);
+void PointCloudScene::attachColourTexture(const size_t count)
+{
+	// a texel per colour channel, which the output shader reads three of for each point
+	GLint maxTexels = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+	if(3 * count > size_t(maxTexels))
+	{
+		std::cout << "warning: " << count << " points' colours are more than the " << maxTexels
+				  << " texels a texture buffer can hold here, points past " << maxTexels / 3
+				  << " will be drawn black\n";
+	}
 
-	// generate a buffer of shuffled indices
-	std::vector<GLuint> shuffledIndices(m_numPointsTotal);
-	std::iota(shuffledIndices.begin(), shuffledIndices.end(), 0);
-	std::random_device rd;
-	std::mt19937 g(rd());
-	std::shuffle(shuffledIndices.begin(), shuffledIndices.end(), g);
+	// map the colours to a texture
+	glActiveTexture(GL_TEXTURE2);
+	m_colourTexture.bindAs(GL_TEXTURE_BUFFER);
+	m_colBuffer.attachToTextureBuffer(GL_R8UI);
+}
 
-	// we double the size of it and repeat it so we can loop through the range with glDrawElements
-	// this introduces a lot of storage overhead, but it means we can get consistent framerates, as the shuffled draw
-	// can draw the full fillBudget at the end of the element buffer's range
-	const auto indicesCopy = shuffledIndices;
-	shuffledIndices.reserve(shuffledIndices.size() * 2);
-	shuffledIndices.insert(shuffledIndices.end(), indicesCopy.begin(), indicesCopy.end());
+void PointCloudScene::drawPointRange(const GLint first, const GLsizei count)
+{
+	if(m_rasterizer == PointRasterizer::Compute)
+	{
+		m_pointDispatches.push_back({PointSource::Range, GLuint(first), GLuint(count), 0, nullptr, false});
+		return;
+	}
+	glDrawArrays(GL_POINTS, first, count);
+}
+
+void PointCloudScene::drawPointRanges(const std::vector<GLint>& firsts, const std::vector<GLsizei>& counts)
+{
+	if(m_rasterizer != PointRasterizer::Compute)
+	{
+		glMultiDrawArrays(GL_POINTS, firsts.data(), counts.data(), GLsizei(firsts.size()));
+		return;
+	}
+	// the shader finds each invocation's range by where they end, one after the other
+	const GLuint firstRange = GLuint(m_pointRanges.size() / 2);
+	GLuint end = 0;
+	for(size_t i = 0; i < firsts.size(); ++i)
+	{
+		end += counts[i];
+		m_pointRanges.push_back(firsts[i]);
+		m_pointRanges.push_back(end);
+	}
+	m_pointDispatches.push_back({PointSource::Ranges, firstRange, end, GLuint(firsts.size()), nullptr, false});
+}
 
+void PointCloudScene::drawShuffledPoints(const GLuint first, const GLsizei count)
+{
+	if(m_rasterizer == PointRasterizer::Compute)
+	{
+		m_pointDispatches.push_back({PointSource::Indices, first, GLuint(count), 0, &m_shuffledBuffer, false});
+		return;
+	}
 	m_shuffledBuffer.bindAs(GL_ELEMENT_ARRAY_BUFFER);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-		shuffledIndices.size() * sizeof(GLuint),
-		shuffledIndices.data(),
-		GL_STATIC_DRAW);
+	// this is ugly, the last one is a size offset into the index buffer
+	glDrawElements(GL_POINTS, count, GL_UNSIGNED_INT, (GLvoid*)(sizeof(GLuint) * first));
+}
 
-	std::cout << "gl error: " << glGetError() << "\n"; // TODO: A proper macro for glErrors
+void PointCloudScene::drawReprojectedPoints()
+{
+	if(m_rasterizer == PointRasterizer::Compute)
+	{
+		// each of a frame's visible points comes from a different pixel, so there can't be more than there are
+		// pixels, or twice that with a subsampled visibility pass, which reprojects the last cycle's points too
+		const size_t maxVisible =
+			size_t(m_visibilitySampling > 1 ? 2 : 1) * m_viewportWidth * m_viewportHeight;
+		const GLuint maxCount = GLuint(std::min<size_t>(maxVisible, m_numPointsLoaded));
+		m_pointDispatches.push_back({PointSource::Indices, 0, maxCount, 0, &m_elementBuffer, true});
+		return;
+	}
+	m_elementBuffer.bindAs(GL_ELEMENT_ARRAY_BUFFER);
+	glDrawElementsIndirect(GL_POINTS, GL_UNSIGNED_INT, nullptr);
+}
 
-	return true;
+void PointCloudScene::rasterizeQueuedPoints()
+{
+	GLUtils::scopedTimer(computeRasterTimer);
+
+	// every pixel starts empty, at a depth beyond any point's and with no point
+	m_pixelBuffer.bindAs(GL_SHADER_STORAGE_BUFFER);
+	static const GLuint empty = 0xFFFFFFFF;
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &empty);
+	if(!m_pointRanges.empty())
+	{
+		m_pointRangesBuffer.bindAs(GL_SHADER_STORAGE_BUFFER);
+		glBufferData(GL_SHADER_STORAGE_BUFFER,
+			m_pointRanges.size() * sizeof(GLuint),
+			m_pointRanges.data(),
+			GL_STREAM_DRAW);
+	}
+
+	m_pointsComputeShader.use();
+	const GLuint numPasses = m_hasAtomicInt64 ? 1 : 2;
+	for(GLuint pass = 0; pass < numPasses; ++pass)
+	{
+		glUniform1ui(m_pointsComputeShader.getUniformLocation("rasterPass"), pass);
+		for(const PointDispatch& dispatch : m_pointDispatches)
+		{
+			if(dispatch.count == 0)
+			{
+				continue;
+			}
+			if(dispatch.indices)
+			{
+				dispatch.indices->bindAsIndexed(GL_SHADER_STORAGE_BUFFER, 4);
+			}
+			glUniform1ui(m_pointsComputeShader.getUniformLocation("pointSource"), GLuint(dispatch.source));
+			glUniform1ui(m_pointsComputeShader.getUniformLocation("first"), dispatch.first);
+			glUniform1ui(m_pointsComputeShader.getUniformLocation("numPoints"), dispatch.count);
+			glUniform1ui(m_pointsComputeShader.getUniformLocation("numRanges"), dispatch.numRanges);
+			glUniform1i(
+				m_pointsComputeShader.getUniformLocation("countFromCommand"), dispatch.countFromCommand);
+			// laid out over x then y as for the element pass, 256 points a group (see points_comp.glsl)
+			const GLuint numGroups = (dispatch.count + 255) / 256;
+			const GLuint groupsX = std::min(numGroups, m_maxComputeGroupCount);
+			glDispatchCompute(groupsX, (numGroups + groupsX - 1) / groupsX, 1);
+		}
+		// the second pass compares against the nearest depths, and the resolve reads the lot
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+	m_pointDispatches.clear();
+	m_pointRanges.clear();
+
+	// write the nearest point in each pixel into the ID framebuffer, which is bound and cleared. The depth test
+	// has to pass everything for the depths to be written
+	m_resolveShader.use();
+	glDepthFunc(GL_ALWAYS);
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+	glDepthFunc(GL_LESS);
 }
 
 void PointCloudScene::processEvent(const SDL_Event& event)
@@ -227,31 +1542,49 @@ void PointCloudScene::setFramebufferParams(const unsigned int& width, const unsi
 		std::cout << "error resizing index framebuffer\n";
 	}
 
-	// set up indirect compute parameters buffer, dispatch in tiles
+	// set up indirect compute parameters buffer, dispatch in tiles. The visibility pass can read one pixel of
+	// each 1x1, 2x2 or 4x4 block (see visibility_comp.glsl), so there's a set of parameters for each, the tiles
+	// covering that many times the pixels
 	// constexpr float tileSize = 1.0f;
 	// constexpr float tileSize = 8.0f;
 	constexpr float tileSize = 32.0f;
-	const DispatchIndirectCommand indirectCompute = {
-		GLuint(ceil(width / tileSize)),
-		GLuint(ceil(height / tileSize)),
-		1
-	};
+	std::array<DispatchIndirectCommand, 3> indirectCompute;
+	for(size_t i = 0; i < indirectCompute.size(); ++i)
+	{
+		const float blockTileSize = tileSize * (1 << i);
+		indirectCompute[i] = {GLuint(ceil(width / blockTileSize)), GLuint(ceil(height / blockTileSize)), 1};
+	}
 
 	m_indirectComputeBuffer.bindAs(GL_DISPATCH_INDIRECT_BUFFER);
-	glBufferData(
-		GL_DISPATCH_INDIRECT_BUFFER, sizeof(indirectCompute), &indirectCompute, GL_DYNAMIC_DRAW);
+	glBufferData(GL_DISPATCH_INDIRECT_BUFFER,
+		sizeof(indirectCompute),
+		indirectCompute.data(),
+		GL_DYNAMIC_DRAW);
 
 	// m_computeDispatchCountX = width;
 	// m_computeDispatchCountY = height;
 
+	// the compute rasterizer keeps a depth and point ID per pixel, 8 bytes
+	m_pixelBuffer.bindAs(GL_SHADER_STORAGE_BUFFER);
+	glBufferData(
+		GL_SHADER_STORAGE_BUFFER, size_t(width) * height * 2 * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+	m_pointsComputeShader.use();
+	glUniform2i(m_pointsComputeShader.getUniformLocation("framebufferSize"), width, height);
+	m_resolveShader.use();
+	glUniform1i(m_resolveShader.getUniformLocation("framebufferWidth"), width);
+
 	GLUtils::Framebuffer::bindDefault();
 	glViewport(0, 0, width, height);
+	m_viewportWidth = width;
+	m_viewportHeight = height;
 }
 
 void PointCloudScene::drawScene()
 {
 	GLUtils::scopedTimer(newFrameTimer);
 
+	updateStreamingLoad();
+
 	// ID Pass
 	{
 		GLUtils::scopedTimer(idPassTimer);
@@ -259,14 +1592,39 @@ void PointCloudScene::drawScene()
 		if(m_doProgressive)
 		{
 			GLUtils::scopedTimer(indexComputeTimer);
+			const bool scanBitset = m_reprojection == Reprojection::BitsetScan;
+			// a subsampled visibility pass reads a different pixel of each block every frame, visiting them all
+			// over a cycle, and sets bits in the half of the bitset for this cycle
+			const GLuint cycleLength = m_visibilitySampling * m_visibilitySampling;
+			const GLuint phase = m_visibilityFrame % cycleLength;
+			const GLuint currentHalf = (m_visibilityFrame / cycleLength) % 2;
+			const bool keepHistory = m_visibilitySampling > 1;
 			// first pass goes over the last frames ID texture and flip a bit for each element in the visbility buffer
+			if(scanBitset)
 			{
 				GLUtils::scopedTimer(visibilityComputeDispatchTimer);
 				m_visComputeShader.use();
-				// TODO: could dispatch 1/4 count here? only read 1 pixel from a 2x2 reigon, rotating sequentially
-				// uses the 0th set of parameters in the bound GL_DISPATCH_INDIRECT_BUFFER, which is just the
-				// framebuffer dimensions
-				glDispatchComputeIndirect(0);
+				// the pixels are visited in the order of a Bayer matrix, so each frame's are far from the last's.
+				// Each pair of bits of the phase places the pixel in a quadrant, coarsest first
+				GLuint levels = 0;
+				GLint offsetX = 0, offsetY = 0;
+				while((1u << levels) < m_visibilitySampling)
+				{
+					++levels;
+				}
+				for(GLuint level = 0; level < levels; ++level)
+				{
+					const GLuint low = (phase >> (2 * level)) & 1, high = (phase >> (2 * level + 1)) & 1;
+					offsetX |= (low ^ high) << (levels - 1 - level);
+					offsetY |= low << (levels - 1 - level);
+				}
+				glUniform1i(m_visComputeShader.getUniformLocation("sampleStride"), m_visibilitySampling);
+				glUniform2i(m_visComputeShader.getUniformLocation("sampleOffset"), offsetX, offsetY);
+				glUniform1ui(m_visComputeShader.getUniformLocation("currentWords"),
+					keepHistory ? currentHalf * m_visibilityWords : 0);
+				// uses the set of parameters in the bound GL_DISPATCH_INDIRECT_BUFFER for this block size, the
+				// framebuffer dimensions over it
+				glDispatchComputeIndirect(sizeof(DispatchIndirectCommand) * levels);
 			}
 			// read the last frame's visible count a frame later just to update the ui, but careful as this can cause a
 			// stall depending on where it's placed
@@ -280,12 +1638,32 @@ void PointCloudScene::drawScene()
 				static const GLuint zero = 0;
 				glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(GLuint), &zero);
 			}
+			if(scanBitset)
 			{
 				GLUtils::scopedTimer(elementComputeDispatchTimer);
 				m_elementComputeShader.use();
+				glUniform1i(m_elementComputeShader.getUniformLocation("keepHistory"), keepHistory);
+				glUniform1ui(m_elementComputeShader.getUniformLocation("currentWords"),
+					currentHalf * m_visibilityWords);
+				glUniform1ui(m_elementComputeShader.getUniformLocation("previousWords"),
+					(1 - currentHalf) * m_visibilityWords);
+				glUniform1i(m_elementComputeShader.getUniformLocation("endOfCycle"), phase == cycleLength - 1);
+				++m_visibilityFrame;
 				// glDispatchCompute(m_computeDispatchCount, 1, 1);
 				glDispatchCompute(m_computeDispatchCount, m_computeGroupCount, 1);
 			}
+			else
+			{
+				GLUtils::scopedTimer(pixelReprojectDispatchTimer);
+				// the same tiles as the visibility pass, each appending the points it's first to see to the index
+				// buffer, then again to clear just the bits that were set, which has to wait for them all to be
+				m_reprojectComputeShader.use();
+				glUniform1i(m_reprojectComputeShader.getUniformLocation("clearVisited"), GL_FALSE);
+				glDispatchComputeIndirect(0);
+				glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+				glUniform1i(m_reprojectComputeShader.getUniformLocation("clearVisited"), GL_TRUE);
+				glDispatchComputeIndirect(0);
+			}
 		}
 
 		// ID Draw Pass
@@ -298,52 +1676,150 @@ void PointCloudScene::drawScene()
 			// update point shader uniforms
 			m_pointsShader.use();
 			// view matrix
-			glUniformMatrix4fv(m_pointsShader.getUniformLocation("view"),
+			const glm::mat4 view = m_camera.getView();
+			glUniformMatrix4fv(m_pointsShader.getUniformLocation("view"), 1, GL_FALSE, glm::value_ptr(view));
+			// the clip planes follow the camera's distance from the cloud
+			glUniformMatrix4fv(m_pointsShader.getUniformLocation("projection"),
 				1,
 				GL_FALSE,
-				glm::value_ptr(m_camera.getView()));
+				glm::value_ptr(m_camera.getProjection()));
+			// an octree draws only the nodes that matter from here, both for the fill and a full draw
+			if(!m_octreeNodes.empty())
+			{
+				selectOctreeNodes(view);
+			}
 			// point size
 			glUniform1f(m_pointsShader.getUniformLocation("pointSize"), m_pointSize);
+			const bool computeRaster = m_rasterizer == PointRasterizer::Compute;
+			if(computeRaster)
+			{
+				m_pointsComputeShader.use();
+				glUniformMatrix4fv(m_pointsComputeShader.getUniformLocation("modelViewProjection"),
+					1,
+					GL_FALSE,
+					glm::value_ptr(m_camera.getProjection() * view * m_modelMat));
+				m_pointsShader.use();
+			}
 
 			// dispatch point draw
 			if(m_doProgressive)
 			{
 				{
 					GLUtils::scopedTimer(reprojectDrawTimer);
+					// the count is read as draw parameters now, and back to the host next frame
 					glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_ELEMENT_ARRAY_BARRIER_BIT |
-						GL_ATOMIC_COUNTER_BARRIER_BIT);
+						GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
 					m_pointsShader.use();
-					m_elementBuffer.bindAs(GL_ELEMENT_ARRAY_BUFFER);
-					glDrawElementsIndirect(GL_POINTS, GL_UNSIGNED_INT, nullptr);
+					drawReprojectedPoints();
 				}
 				{
 					GLUtils::scopedTimer(randomFillDrawTimer);
-					const unsigned int fillBudget = m_fillRate * 0.01f * m_numPointsTotal;
-					if(m_doShuffle)
+					// the shuffled indices span the whole cloud, whereas drawing in storage order can stick to
+					// whatever has loaded so far. Pre-shuffled points are already in a random order, so they're
+					// always drawn in storage order
+					const bool drawShuffledIndices =
+						m_doShuffle && m_hasShuffledIndices && !m_doProceduralFill;
+					const unsigned int fillRange = drawShuffledIndices ? m_numPointsTotal : m_numPointsLoaded;
+					const unsigned int fillBudget = m_fillRate * 0.01f * fillRange;
+					if(drawShuffledIndices)
 					{
-						m_shuffledBuffer.bindAs(GL_ELEMENT_ARRAY_BUFFER);
 						// make sure this doesn't overflow...
-						// this is ugly, the last one is a size offset into the index buffer
-						glDrawElements(
-							GL_POINTS,
-							fillBudget,
-							GL_UNSIGNED_INT,
-							(GLvoid*)(sizeof(GLuint) * m_fillStartIndex)
-						);
+						drawShuffledPoints(m_fillStartIndex, fillBudget);
+
+						m_fillStartIndex = ((m_fillStartIndex + fillBudget) > fillRange)
+							? 0
+							: m_fillStartIndex + fillBudget;
 					}
-					else
+					else if(!m_octreeNodes.empty())
 					{
-						glDrawArrays(GL_POINTS, m_fillStartIndex, fillBudget);
+						// the same fraction of every selected node from the same place in each, so the fill
+						// spreads evenly over the view. Each node's points are in random order, so any run of
+						// them is a uniform sample of it
+						const float rate = m_fillRate * 0.01f;
+						m_fillFirsts.clear();
+						m_fillCounts.clear();
+						for(size_t i = 0; i < m_lodFirsts.size(); ++i)
+						{
+							const GLsizei count = m_lodCounts[i];
+							const GLsizei n = std::min(count, GLsizei(std::ceil(rate * count)));
+							const GLsizei begin = std::min(count - 1, GLsizei(m_lodFillPhase * count));
+							const GLsizei head = std::min(n, count - begin);
+							if(head > 0)
+							{
+								m_fillFirsts.push_back(m_lodFirsts[i] + begin);
+								m_fillCounts.push_back(head);
+							}
+							if(head < n)
+							{
+								m_fillFirsts.push_back(m_lodFirsts[i]);
+								m_fillCounts.push_back(n - head);
+							}
+						}
+						drawPointRanges(m_fillFirsts, m_fillCounts);
+						m_lodFillPhase = std::fmod(m_lodFillPhase + rate, 1.0f);
+					}
+					else if(m_doProceduralFill && fillRange > 0)
+					{
+						// each vertex works out which point it draws from its place in the fill sequence, so
+						// running over the end of a pass is still one draw, with the rest in the next pass's order
+						m_fillStartIndex = m_fillStartIndex < fillRange ? m_fillStartIndex : 0;
+						// the compute rasterizer follows the same order, see permute.glsl
+						const GLUtils::ShaderProgram& fillShader =
+							computeRaster ? m_pointsComputeShader : m_pointsShader;
+						fillShader.use();
+						glUniform1ui(fillShader.getUniformLocation("fillStart"), m_fillStartIndex);
+						glUniform1ui(fillShader.getUniformLocation("fillRange"), fillRange);
+						glUniform1ui(fillShader.getUniformLocation("fillSeed"),
+							GLuint(shuffle_utils::counter_hash(m_fillSeed, m_fillCycle)));
+						glUniform1ui(fillShader.getUniformLocation("nextFillSeed"),
+							GLuint(shuffle_utils::counter_hash(m_fillSeed, m_fillCycle + 1)));
+						if(computeRaster)
+						{
+							m_pointDispatches.push_back(
+								{PointSource::Procedural, 0, fillBudget, 0, nullptr, false});
+						}
+						else
+						{
+							glUniform1i(m_pointsShader.getUniformLocation("proceduralFill"), GL_TRUE);
+							glDrawArrays(GL_POINTS, 0, fillBudget);
+							glUniform1i(m_pointsShader.getUniformLocation("proceduralFill"), GL_FALSE);
+						}
+
+						// in 64 bits, since a start and budget over 2^31 points each would wrap
+						const uint64_t fillEnd = uint64_t(m_fillStartIndex) + fillBudget;
+						if(fillEnd >= fillRange)
+						{
+							++m_fillCycle;
+						}
+						m_fillStartIndex = unsigned(fillEnd % fillRange);
+					}
+					else if(fillRange > 0)
+					{
+						// wrap around the end of the range with a second draw, so every frame gets its whole
+						// budget without needing a repeated index buffer
+						m_fillStartIndex = m_fillStartIndex < fillRange ? m_fillStartIndex : 0;
+						const unsigned int headCount = std::min(fillBudget, fillRange - m_fillStartIndex);
+						drawPointRange(m_fillStartIndex, headCount);
+						if(headCount < fillBudget)
+						{
+							drawPointRange(0, fillBudget - headCount);
+						}
+						m_fillStartIndex = (m_fillStartIndex + fillBudget) % fillRange;
 					}
-
-					m_fillStartIndex = ((m_fillStartIndex + fillBudget) > m_numPointsTotal)
-						? 0
-						: m_fillStartIndex + fillBudget;
 				}
 			}
+			else if(!m_octreeNodes.empty())
+			{
+				drawPointRanges(m_lodFirsts, m_lodCounts);
+			}
 			else
 			{
-				glDrawArrays(GL_POINTS, 0, m_numPointsTotal);
+				drawPointRange(0, m_numPointsLoaded);
+			}
+
+			if(computeRaster)
+			{
+				rasterizeQueuedPoints();
 			}
 		}
 	}
@@ -370,25 +1846,109 @@ void PointCloudScene::drawGUI()
 		return;
 	}
 
+	if(m_numPointsLoaded < m_numPointsTotal)
+	{
+		ImGui::Text("Loading %u / %u points (%.2f%%)",
+			m_numPointsLoaded,
+			m_numPointsTotal,
+			m_numPointsLoaded * 100.0f / m_numPointsTotal);
+		ImGui::Separator();
+	}
+
 	ImGui::Checkbox("Progressive Render", &m_doProgressive);
 
 	if(m_doProgressive)
 	{
-		ImGui::Checkbox("Shuffle Fill", &m_doShuffle);
+		if(m_octreeNodes.empty())
+		{
+			ImGui::Checkbox("Shuffle Fill", &m_doShuffle);
+			ImGui::Checkbox("Procedural Fill Order", &m_doProceduralFill);
+		}
 		// TODO: change this to 'fill budget', as a percentage
 		ImGui::Text("Fill Budget (per frame):");
 		ImGui::SliderFloat("%##fill", &m_fillRate, 0.0f, 100.0f, "%.3f", 3.0f); // 3.0f is a power curve
+
+		// both leave the visibility bitset empty, so they can be switched between on any frame, unless the
+		// visibility pass is subsampled, which keeps the last cycle's bits
+		int reprojection = int(m_reprojection);
+		ImGui::Text("Reprojection:");
+		if(ImGui::Combo("##reprojection", &reprojection, "Bitset Scan\0Pixel Driven\0"))
+		{
+			m_reprojection = Reprojection(reprojection);
+			if(m_visibilitySampling > 1)
+			{
+				allocateVisibilityBuffer();
+			}
+		}
+		// trade a few frames of latency in picking up newly visible points for less atomic traffic
+		if(m_reprojection == Reprojection::BitsetScan)
+		{
+			// indexes log2 of m_visibilitySampling
+			int sampling = m_visibilitySampling == 4 ? 2 : m_visibilitySampling == 2 ? 1 : 0;
+			ImGui::Text("Visibility sampling:");
+			if(ImGui::Combo(
+				   "##sampling", &sampling, "Every pixel\0One in 4 (2x2)\0One in 16 (4x4)\0"))
+			{
+				m_visibilitySampling = 1u << sampling;
+				allocateVisibilityBuffer();
+			}
+		}
+
+		// reorder the loaded points on the spot, to compare the frame time of each order at the same fill budget
+		if(m_numPointsLoaded == m_numPointsTotal && m_numPointsTotal > 0 && !m_doProceduralFill &&
+			m_octreeNodes.empty())
+		{
+			// Unchanged isn't offered, it can't be gone back to
+			ImGui::Combo("##order", &m_guiPointOrder, "Shuffled\0Morton Blocks\0Hierarchical\0");
+			ImGui::SameLine();
+			if(ImGui::Button("Reorder Points") && reorderPoints(PointOrder(m_guiPointOrder + 1)))
+			{
+				// the fill can now draw straight out of the point buffers. Point IDs have moved, so start from
+				// nothing visible rather than reprojecting whichever points the old IDs now name
+				m_pointsPreshuffled = true;
+				m_fillStartIndex = 0;
+				m_idFBO.bind();
+				glClear(GL_DEPTH_BUFFER_BIT);
+				GLUtils::Framebuffer::bindDefault();
+				allocateRenderBuffers();
+				setLoadedPointCount(m_numPointsTotal);
+			}
+		}
 	}
 
 	ImGui::Text("Point size:");
 	ImGui::SliderFloat("%##size", &m_pointSize, 0.01f, 10.0f, "%.3f", 3.0f);
 
+	// switch on the spot, to compare the two on the same view
+	int rasterizer = int(m_rasterizer);
+	ImGui::Text("Rasterizer:");
+	if(ImGui::Combo("##rasterizer", &rasterizer, "GL_POINTS\0Compute\0"))
+	{
+		m_rasterizer = PointRasterizer(rasterizer);
+	}
+	if(m_rasterizer == PointRasterizer::Compute)
+	{
+		ImGui::Text(m_hasAtomicInt64 ? "A pixel per point, 64 bit atomics"
+									 : "A pixel per point, two passes (no 64 bit atomics)");
+	}
+
+	if(!m_octreeNodes.empty())
+	{
+		ImGui::Separator();
+		ImGui::Text("Octree: %zu nodes resident, %zu selected (%u points)",
+			m_octreeNodes.size(),
+			m_lodFirsts.size(),
+			m_lodPointCount);
+		ImGui::Text("Split nodes bigger than (pixels):");
+		ImGui::SliderFloat("##lod", &m_lodThreshold, 16.0f, 4096.0f, "%.0f", 3.0f);
+	}
+
 	ImGui::Separator();
 
 	ImGui::Text("Drawing %u / %u points (%.2f%%)",
-		m_doProgressive ? m_numPointsVisible : m_numPointsTotal, // doesn't account for fill rate
+		m_doProgressive ? m_numPointsVisible : m_numPointsLoaded, // doesn't account for fill rate
 		m_numPointsTotal,
-		m_doProgressive ? (m_numPointsVisible * 100.0f / m_numPointsTotal) : 100.0f);
+		(m_doProgressive ? m_numPointsVisible : m_numPointsLoaded) * 100.0f / m_numPointsTotal);
 
 	ImGui::Separator();
 
@@ -429,14 +1989,25 @@ void PointCloudScene::drawGUI()
 	if(m_doProgressive)
 	{
 		ImGui::Text("\t\tIndex Compute time: %.1f ms", GLUtils::getElapsed(indexComputeTimer));
-		ImGui::Text("\t\t\tVisibility Compute time: %.1f ms",
-			GLUtils::getElapsed(visibilityComputeDispatchTimer));
+		if(m_reprojection == Reprojection::BitsetScan)
+		{
+			ImGui::Text("\t\t\tVisibility Compute time: %.1f ms",
+				GLUtils::getElapsed(visibilityComputeDispatchTimer));
+		}
 		ImGui::Text(
 			"\t\t\tIndex Counter Read time: %.1f ms", GLUtils::getElapsed(indexCounterReadTimer));
 		ImGui::Text(
 			"\t\t\tIndex Counter Reset time: %.1f ms", GLUtils::getElapsed(indexCounterResetTimer));
-		ImGui::Text("\t\t\tElement Buffer Compute time: %.1f ms",
-			GLUtils::getElapsed(elementComputeDispatchTimer));
+		if(m_reprojection == Reprojection::BitsetScan)
+		{
+			ImGui::Text("\t\t\tElement Buffer Compute time: %.1f ms",
+				GLUtils::getElapsed(elementComputeDispatchTimer));
+		}
+		else
+		{
+			ImGui::Text("\t\t\tPixel Reprojection Compute time: %.1f ms",
+				GLUtils::getElapsed(pixelReprojectDispatchTimer));
+		}
 	}
 	ImGui::Text("\t\tPoints Draw time: %.1f ms", GLUtils::getElapsed(pointsDrawTimer));
 	if(m_doProgressive)
@@ -445,6 +2016,10 @@ void PointCloudScene::drawGUI()
 		ImGui::Text(
 			"\t\t\tRandom Fill Draw time: %.1f ms", GLUtils::getElapsed(randomFillDrawTimer));
 	}
+	if(m_rasterizer == PointRasterizer::Compute)
+	{
+		ImGui::Text("\t\t\tCompute Raster time: %.1f ms", GLUtils::getElapsed(computeRasterTimer));
+	}
 	ImGui::Text("\tOutput Pass time: %.1f ms", GLUtils::getElapsed(outputPassTimer));
 
 	ImGui::End();
@@ -0,0 +1,104 @@
+#include "StreamingLoader.h"
+
+#include <iostream>
+
+StreamingLoader::StreamingLoader(ReadFunction read, size_t batchSize, size_t maxQueuedBatches)
+	: m_read(std::move(read))
+	, m_batchSize(batchSize)
+	, m_maxQueuedBatches(maxQueuedBatches)
+	, m_mutex()
+	, m_spaceAvailable()
+	, m_ready()
+	, m_spare()
+	, m_readerDone(false)
+	, m_stopRequested(false)
+	, m_thread(&StreamingLoader::run, this)
+{
+}
+
+StreamingLoader::~StreamingLoader()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopRequested = true;
+	}
+	m_spaceAvailable.notify_all();
+	m_thread.join();
+}
+
+bool StreamingLoader::tryPop(Batch& batch)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(m_ready.empty())
+		{
+			return false;
+		}
+		batch = std::move(m_ready.front());
+		m_ready.pop_front();
+	}
+	m_spaceAvailable.notify_one();
+	return true;
+}
+
+void StreamingLoader::recycle(Batch&& batch)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_spare.push_back(std::move(batch));
+}
+
+bool StreamingLoader::isFinished() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_readerDone && m_ready.empty();
+}
+
+void StreamingLoader::run()
+{
+	size_t first = 0;
+	while(true)
+	{
+		// wait for room in the queue, reusing a returned batch's storage if there is one
+		Batch batch;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_spaceAvailable.wait(lock,
+				[this]() { return m_stopRequested || m_ready.size() < m_maxQueuedBatches; });
+			if(m_stopRequested)
+			{
+				break;
+			}
+			if(!m_spare.empty())
+			{
+				batch = std::move(m_spare.back());
+				m_spare.pop_back();
+			}
+		}
+
+		batch.positions.resize(3 * m_batchSize);
+		batch.colours.resize(3 * m_batchSize);
+		try
+		{
+			batch.count = m_read(m_batchSize, batch.positions.data(), batch.colours.data());
+		}
+		catch(const std::exception& e)
+		{
+			std::cout << "StreamingLoader: reader failed after " << first << " points: " << e.what()
+					  << "\n";
+			batch.count = 0;
+		}
+
+		if(batch.count == 0)
+		{
+			break;
+		}
+
+		batch.first = first;
+		first += batch.count;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_ready.push_back(std::move(batch));
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_readerDone = true;
+}
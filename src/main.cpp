@@ -1,4 +1,8 @@
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
+#include <string>
+#include <vector>
 
 #include <GL/glew.h> // load glew before SDL_opengl
 
@@ -60,7 +64,97 @@ int main(int argc, char* argv[])
 	std::cout << "Starting PointCloudRendering\n";
 
 	// Get command line arguments, we should really bail / print a help message here
-	const char* filepath = (argc > 1) ? argv[1] : "res/richmond-azaelias.ply";
+	// anything starting with '--' is a loading option, everything else is a file, directory or '.tiles'
+	// manifest to load, several of which are loaded together as one tile set
+	std::vector<std::string> filepaths;
+	PointCloudScene::LoadOptions loadOptions;
+	for(int i = 1; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+		if(arg == "--host-decode")
+		{
+			loadOptions.decodeIntoMappedBuffers = false;
+		}
+		else if(arg == "--stream")
+		{
+			loadOptions.streaming = true;
+		}
+		else if(arg.rfind("--stream-batch=", 0) == 0)
+		{
+			loadOptions.streaming = true;
+			loadOptions.streamBatchSize = std::max(1ul, std::strtoul(arg.c_str() + 15, nullptr, 10));
+		}
+		else if(arg == "--pipelined-io")
+		{
+			loadOptions.pipelinedIO = true;
+		}
+		else if(arg == "--direct-io")
+		{
+			loadOptions.pipelinedIO = true;
+			loadOptions.directIO = true;
+		}
+		else if(arg == "--no-cache")
+		{
+			loadOptions.useCache = false;
+		}
+		else if(arg.rfind("--compress-to=", 0) == 0)
+		{
+			loadOptions.compressTo = arg.substr(14);
+		}
+		else if(arg == "--procedural-fill")
+		{
+			loadOptions.proceduralFill = true;
+		}
+		else if(arg == "--no-reorder")
+		{
+			loadOptions.pointOrder = PointCloudScene::PointOrder::Unchanged;
+		}
+		else if(arg == "--point-order=shuffled")
+		{
+			loadOptions.pointOrder = PointCloudScene::PointOrder::Shuffled;
+		}
+		else if(arg == "--point-order=morton-blocks")
+		{
+			loadOptions.pointOrder = PointCloudScene::PointOrder::MortonBlocks;
+		}
+		else if(arg == "--point-order=hierarchical")
+		{
+			loadOptions.pointOrder = PointCloudScene::PointOrder::Hierarchical;
+		}
+		else if(arg.rfind("--order-block-size=", 0) == 0)
+		{
+			loadOptions.orderBlockSize = std::strtoull(arg.c_str() + 19, nullptr, 10);
+		}
+		else if(arg == "--dedup")
+		{
+			loadOptions.pointFilter = PointCloudScene::PointFilter::Duplicates;
+		}
+		else if(arg.rfind("--voxel-size=", 0) == 0)
+		{
+			loadOptions.pointFilter = PointCloudScene::PointFilter::Voxels;
+			loadOptions.voxelSize = std::strtof(arg.c_str() + 13, nullptr);
+		}
+		else if(arg.rfind("--octree-budget=", 0) == 0)
+		{
+			loadOptions.octreePointBudget = std::strtoull(arg.c_str() + 16, nullptr, 10);
+		}
+		else if(arg.rfind("--seed=", 0) == 0)
+		{
+			loadOptions.shuffleSeed = std::strtoull(arg.c_str() + 7, nullptr, 10);
+		}
+		else if(arg.rfind("--", 0) == 0)
+		{
+			std::cout << "Ignoring unknown option " << arg << "\n";
+		}
+		else
+		{
+			filepaths.push_back(argv[i]);
+		}
+	}
+	if(filepaths.empty())
+	{
+		filepaths.push_back("res/richmond-azaelias.ply");
+	}
 
 	// initialize SDL
 	if(SDL_Init(SDL_INIT_VIDEO) != 0)
@@ -124,7 +218,7 @@ int main(int argc, char* argv[])
 	{
 		// TODO: just hand over execution to PointCloudScene
 		PointCloudScene scene;
-		scene.loadPointCloud(filepath); // TODO: handle failure to load file?
+		scene.loadPointCloud(filepaths, loadOptions); // TODO: handle failure to load file?
 		scene.setFramebufferParams(DEFAULT_SCREEN_WIDTH, DEFAULT_SCREEN_HEIGHT);
 
 		SDL_Event event;
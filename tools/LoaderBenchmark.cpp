@@ -0,0 +1,486 @@
+// Headless loader benchmark, times each stage of getting a point cloud ready for upload (io, header, decode,
+// shuffle and buffer preparation) through the ply_utils decoders and through tinyply, with the file preloaded
+// or streamed, and prints the results as JSON. Without any files it generates a synthetic cloud in every
+// encoding the loaders handle: binary little and big endian and ascii, with float and double positions.
+//
+// pcr-bench [--points=N] [--repeats=N] [--dir=PATH] [--cold] [--out=FILE] [file.ply ...]
+
+#include "ply_utils.h"
+#include "shuffle_utils.h"
+
+#include <malloc.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+struct BenchOptions
+{
+	size_t points = 2000000;
+	size_t repeats = 3;
+	std::string dir = (std::filesystem::temp_directory_path() / "pcr-bench").string();
+	bool cold = false; // evict the file from the page cache before every run
+	std::string out;
+	std::vector<std::string> files;
+};
+
+struct Stages
+{
+	double io = 0.0;
+	double header = 0.0;
+	double decode = 0.0;
+	double shuffle = 0.0;
+	double buffer = 0.0;
+
+	double total() const { return io + header + decode + shuffle + buffer; }
+};
+
+struct RunResult
+{
+	Stages stages;
+	double peakRssMb = 0.0; // above the resident set the run started with
+	double checksum = 0.0;
+};
+
+// The packed arrays every loader produces, which is what PointCloudScene uploads
+struct PackedPoints
+{
+	std::vector<float> positions;
+	std::vector<uint8_t> colours;
+};
+
+template<typename Fn>
+double timeSeconds(Fn&& fn)
+{
+	ply_utils::manual_timer timer;
+	timer.start();
+	fn();
+	timer.stop();
+	return timer.get() / 1000.0;
+}
+
+// A field of /proc/self/status in mb, or -1 if it isn't there
+double statusMb(const char* field)
+{
+	std::ifstream status("/proc/self/status");
+	const size_t length = std::strlen(field);
+	for(std::string line; std::getline(status, line);)
+	{
+		if(line.compare(0, length, field) == 0)
+		{
+			return std::strtod(line.c_str() + length, nullptr) / 1024.0;
+		}
+	}
+	return -1.0;
+}
+
+// Hand heap kept from earlier runs back to the kernel and reset its high water mark of the resident set, so
+// each run's peak is its own. Returns the resident set the run starts from
+double resetPeakRss()
+{
+	malloc_trim(0);
+	std::ofstream clearRefs("/proc/self/clear_refs");
+	clearRefs << "5";
+	clearRefs.close();
+	return std::max(statusMb("VmRSS:"), 0.0);
+}
+
+// Peak resident set since the last resetPeakRss, or since the process started where it can't be reset
+double peakRssMb()
+{
+	const double peak = statusMb("VmHWM:");
+	if(peak >= 0.0)
+	{
+		return peak;
+	}
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss / 1024.0;
+}
+
+void evictFromPageCache(const std::string& path)
+{
+	const int fd = ::open(path.c_str(), O_RDONLY);
+	if(fd >= 0)
+	{
+		::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		::close(fd);
+	}
+}
+
+// Write a synthetic cloud, a noisy sheet with a colour gradient, in the given ply encoding
+void writeSyntheticPly(
+	const std::string& path, const size_t count, const std::string& format, const bool doubles)
+{
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	const char* type = doubles ? "double" : "float";
+	out << "ply\nformat " << format << " 1.0\nelement vertex " << count << "\n";
+	out << "property " << type << " x\nproperty " << type << " y\nproperty " << type << " z\n";
+	out << "property uchar red\nproperty uchar green\nproperty uchar blue\nend_header\n";
+
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	const bool swap = format == "binary_big_endian";
+	const auto writeScalar = [&](const auto value) {
+		char bytes[sizeof(value)];
+		std::memcpy(bytes, &value, sizeof(value));
+		if(swap)
+		{
+			std::reverse(bytes, bytes + sizeof(value));
+		}
+		out.write(bytes, sizeof(value));
+	};
+
+	std::ostringstream line;
+	line.precision(doubles ? 17 : 9);
+	for(size_t i = 0; i < count; ++i)
+	{
+		const double x = 100.0 * unit(rng);
+		const double y = 100.0 * unit(rng);
+		const double xyz[3] = {x, y, 0.5 * std::sin(0.1 * x) + 0.01 * unit(rng)};
+		const uint8_t rgb[3] = {uint8_t(2.5 * x), uint8_t(2.5 * y), uint8_t(255 * unit(rng))};
+		if(format == "ascii")
+		{
+			line.str("");
+			line << xyz[0] << " " << xyz[1] << " " << xyz[2] << " " << int(rgb[0]) << " " << int(rgb[1])
+				 << " " << int(rgb[2]) << "\n";
+			out << line.str();
+			continue;
+		}
+		for(const double v : xyz)
+		{
+			doubles ? writeScalar(v) : writeScalar(float(v));
+		}
+		out.write(reinterpret_cast<const char*>(rgb), 3);
+	}
+	if(!out)
+	{
+		throw std::runtime_error("could not write " + path);
+	}
+}
+
+// Fault every page of the file in through a mapping, the io a preloading decoder pays before it starts
+void touchFile(const std::string& path)
+{
+	const ply_utils::mapped_file file(path);
+	::madvise(const_cast<uint8_t*>(file.data()), file.size(), MADV_WILLNEED);
+	volatile uint8_t sink = 0;
+	for(size_t offset = 0; offset < file.size(); offset += 4096)
+	{
+		sink = sink + file.data()[offset];
+	}
+}
+
+void decodeWithPlyUtils(const std::string& path, const bool stream, Stages& stages, PackedPoints& points)
+{
+	if(!stream)
+	{
+		stages.io = timeSeconds([&]() { touchFile(path); });
+	}
+
+	ply_utils::mapped_ply ply;
+	stages.header = timeSeconds([&]() { ply = ply_utils::map_ply_file(path); });
+
+	stages.decode = timeSeconds([&]() {
+		points.positions.resize(3 * ply.vertex_count);
+		points.colours.resize(3 * ply.vertex_count);
+		if(!stream)
+		{
+			ply_utils::decode_vertices(ply, points.positions.data(), points.colours.data());
+			return;
+		}
+
+		// the batches the streaming loader hands to the render thread, the reads happen inside them
+		constexpr size_t batchSize = 1 << 20;
+		ply_utils::vertex_batch_reader reader(ply);
+		for(size_t first = 0, n = 0; first < ply.vertex_count; first += n)
+		{
+			n = reader.read(
+				batchSize, points.positions.data() + 3 * first, points.colours.data() + 3 * first);
+			if(n == 0)
+			{
+				throw std::runtime_error("ran out of vertices after " + std::to_string(first));
+			}
+		}
+	});
+}
+
+void decodeWithTinyply(const std::string& path, const bool stream, Stages& stages, PackedPoints& points)
+{
+	std::vector<uint8_t> bytes;
+	std::unique_ptr<std::istream> fileStream;
+	if(stream)
+	{
+		fileStream.reset(new io_utils::pipelined_istream(path));
+	}
+	else
+	{
+		stages.io = timeSeconds([&]() { bytes = ply_utils::read_file_binary(path); });
+		fileStream.reset(new ply_utils::memory_stream((char*)bytes.data(), bytes.size()));
+	}
+
+	tinyply::PlyFile file;
+	std::shared_ptr<tinyply::PlyData> vertexData, colourData;
+	stages.header = timeSeconds([&]() {
+		if(!file.parse_header(*fileStream))
+		{
+			throw std::runtime_error("unexpected header field in " + path);
+		}
+		vertexData = file.request_properties_from_element("vertex", {"x", "y", "z"});
+		colourData = file.request_properties_from_element("vertex", {"red", "green", "blue"});
+	});
+
+	stages.decode = timeSeconds([&]() {
+		file.read(*fileStream);
+
+		// tinyply hands back the file's own types, narrow them to what the renderer uploads
+		const size_t count = vertexData->count;
+		points.positions.resize(3 * count);
+		points.colours.resize(3 * count);
+		if(vertexData->t == tinyply::Type::FLOAT64)
+		{
+			const double* source = reinterpret_cast<const double*>(vertexData->buffer.get());
+			std::transform(source, source + 3 * count, points.positions.begin(), [](const double v) {
+				return float(v);
+			});
+		}
+		else
+		{
+			std::memcpy(points.positions.data(), vertexData->buffer.get(), 3 * sizeof(float) * count);
+		}
+		std::memcpy(points.colours.data(), colourData->buffer.get(), 3 * count);
+	});
+}
+
+// The same work PointCloudScene does once the points are decoded: a shuffled index permutation written into
+// the first half of the doubled index buffer and repeated, and copies of the points, standing in for the GL
+// buffer uploads
+void prepareBuffers(const PackedPoints& points, Stages& stages)
+{
+	const size_t count = points.positions.size() / 3;
+	std::unique_ptr<uint32_t[]> indices(new uint32_t[2 * count]);
+	stages.shuffle = timeSeconds([&]() { shuffle_utils::random_permutation(indices.get(), count, 42); });
+
+	stages.buffer = timeSeconds([&]() {
+		std::unique_ptr<float[]> positions(new float[points.positions.size()]);
+		std::unique_ptr<uint8_t[]> colours(new uint8_t[points.colours.size()]);
+		std::memcpy(positions.get(), points.positions.data(), points.positions.size() * sizeof(float));
+		std::memcpy(colours.get(), points.colours.data(), points.colours.size());
+		std::memcpy(indices.get() + count, indices.get(), count * sizeof(uint32_t));
+		volatile uint32_t sink = indices[count / 2] + colours[0];
+		(void)sink;
+	});
+}
+
+RunResult runOnce(const std::string& path, const std::string& loader, const bool cold)
+{
+	if(cold)
+	{
+		evictFromPageCache(path);
+	}
+	const double startRssMb = resetPeakRss();
+
+	RunResult result;
+	PackedPoints points;
+	const bool stream = loader.find("stream") != std::string::npos;
+	if(loader.rfind("ply_utils", 0) == 0)
+	{
+		decodeWithPlyUtils(path, stream, result.stages, points);
+	}
+	else
+	{
+		decodeWithTinyply(path, stream, result.stages, points);
+	}
+	prepareBuffers(points, result.stages);
+	result.peakRssMb = std::max(peakRssMb() - startRssMb, 0.0);
+
+	// so a loader that's fast because it's wrong doesn't go unnoticed
+	result.checksum = std::accumulate(points.positions.begin(), points.positions.end(), 0.0) +
+		std::accumulate(points.colours.begin(), points.colours.end(), 0.0);
+	return result;
+}
+
+double median(std::vector<double> values)
+{
+	std::sort(values.begin(), values.end());
+	const size_t n = values.size();
+	return n % 2 ? values[n / 2] : 0.5 * (values[n / 2 - 1] + values[n / 2]);
+}
+
+// Describe the encoding of a ply file from its header, e.g. {"binary_big_endian", "float64"}
+std::pair<std::string, std::string> describePly(const std::string& path)
+{
+	const ply_utils::mapped_ply ply = ply_utils::map_ply_file(path);
+	const std::string format =
+		!ply.is_binary ? "ascii" : ply.is_big_endian ? "binary_big_endian" : "binary_little_endian";
+	std::string type = "unknown";
+	for(const auto& property : ply.vertex_properties)
+	{
+		if(property.name == "x")
+		{
+			type = tinyply::PropertyTable[property.propertyType].str;
+		}
+	}
+	return {format, type};
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+	BenchOptions options;
+	for(int i = 1; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+		if(arg.rfind("--points=", 0) == 0)
+		{
+			options.points = std::max(1ul, std::strtoul(arg.c_str() + 9, nullptr, 10));
+		}
+		else if(arg.rfind("--repeats=", 0) == 0)
+		{
+			options.repeats = std::max(1ul, std::strtoul(arg.c_str() + 10, nullptr, 10));
+		}
+		else if(arg.rfind("--dir=", 0) == 0)
+		{
+			options.dir = arg.substr(6);
+		}
+		else if(arg == "--cold")
+		{
+			options.cold = true;
+		}
+		else if(arg.rfind("--out=", 0) == 0)
+		{
+			options.out = arg.substr(6);
+		}
+		else if(arg.rfind("--", 0) == 0)
+		{
+			std::cerr << "Ignoring unknown option " << arg << "\n";
+		}
+		else
+		{
+			options.files.push_back(arg);
+		}
+	}
+
+	// the loaders report as they go, keep that out of the JSON
+	std::ostringstream loaderLog;
+	std::streambuf* const coutBuffer = std::cout.rdbuf(loaderLog.rdbuf());
+
+	if(options.files.empty())
+	{
+		std::filesystem::create_directories(options.dir);
+		for(const std::string format : {"binary_little_endian", "binary_big_endian", "ascii"})
+		{
+			for(const bool doubles : {false, true})
+			{
+				const std::string path = options.dir + "/synthetic_" + std::to_string(options.points) + "_" +
+					format + (doubles ? "_f64" : "_f32") + ".ply";
+				if(!std::filesystem::exists(path))
+				{
+					std::cerr << "generating " << path << "\n";
+					writeSyntheticPly(path, options.points, format, doubles);
+				}
+				options.files.push_back(path);
+			}
+		}
+	}
+
+	const char* loaders[] = {"ply_utils_preload", "ply_utils_stream", "tinyply_preload", "tinyply_stream"};
+
+	std::ostringstream json;
+	json.precision(6);
+	json << "{\n  \"threads\": " << parallel_utils::thread_count()
+		 << ",\n  \"avx2\": " << (ply_utils::detail::has_avx2() ? "true" : "false")
+		 << ",\n  \"repeats\": " << options.repeats << ",\n  \"cold\": " << (options.cold ? "true" : "false")
+		 << ",\n  \"results\": [";
+
+	bool first = true;
+	for(const std::string& path : options.files)
+	{
+		std::pair<std::string, std::string> encoding;
+		size_t pointCount = 0;
+		try
+		{
+			encoding = describePly(path);
+			pointCount = ply_utils::map_ply_file(path).vertex_count;
+		}
+		catch(const std::exception& e)
+		{
+			std::cerr << "skipping " << path << ": " << e.what() << "\n";
+			continue;
+		}
+		const double fileMb = std::filesystem::file_size(path) * 1e-6;
+
+		for(const char* loader : loaders)
+		{
+			std::cerr << loader << " " << path << "\n";
+			std::vector<RunResult> runs;
+			try
+			{
+				for(size_t r = 0; r < options.repeats; ++r)
+				{
+					runs.push_back(runOnce(path, loader, options.cold));
+				}
+			}
+			catch(const std::exception& e)
+			{
+				std::cerr << "\tfailed: " << e.what() << "\n";
+				continue;
+			}
+
+			const auto stageMedian = [&](double Stages::*stage) {
+				std::vector<double> values;
+				for(const RunResult& run : runs)
+				{
+					values.push_back(run.stages.*stage);
+				}
+				return median(values);
+			};
+			std::vector<double> totals, peaks;
+			for(const RunResult& run : runs)
+			{
+				totals.push_back(run.stages.total());
+				peaks.push_back(run.peakRssMb);
+			}
+			const double total = median(totals);
+
+			json << (first ? "\n" : ",\n") << "    {\"file\": \"" << path << "\", \"format\": \"" << encoding.first
+				 << "\", \"type\": \"" << encoding.second << "\", \"loader\": \"" << loader
+				 << "\", \"points\": " << pointCount << ", \"file_mb\": " << fileMb
+				 << ",\n     \"seconds\": {\"io\": " << stageMedian(&Stages::io)
+				 << ", \"header\": " << stageMedian(&Stages::header)
+				 << ", \"decode\": " << stageMedian(&Stages::decode)
+				 << ", \"shuffle\": " << stageMedian(&Stages::shuffle)
+				 << ", \"buffer\": " << stageMedian(&Stages::buffer) << ", \"total\": " << total << "}"
+				 << ",\n     \"mb_per_s\": " << (fileMb / total) << ", \"points_per_s\": " << (pointCount / total)
+				 << ", \"peak_rss_mb\": " << *std::max_element(peaks.begin(), peaks.end())
+				 << ", \"checksum\": " << std::setprecision(15) << runs.front().checksum
+				 << std::setprecision(6) << "}";
+			first = false;
+		}
+	}
+	json << "\n  ]\n}\n";
+
+	std::cout.rdbuf(coutBuffer);
+	if(options.out.empty())
+	{
+		std::cout << json.str();
+	}
+	else
+	{
+		std::ofstream(options.out) << json.str();
+	}
+	return 0;
+}
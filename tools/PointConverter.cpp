@@ -0,0 +1,545 @@
+// Headless point cloud converter, does the expensive preparation the renderer would otherwise repeat at every
+// startup and writes a ready to render file: any format the loaders read in, optionally deduplicated or
+// decimated to a voxel grid, then either a '.pcrc' cache with the points already in fill order, or a '.pcrz'
+// chunked file with quantised positions. Prints the bounds, robust extent and spacing of each output as JSON.
+// Everything runs on all cores, and the host memory a job needs is estimated from the point counts before
+// anything is decoded, so a job that wouldn't fit in --memory-limit fails up front instead of swapping a build
+// machine.
+// Only two kinds of job stream their inputs. A shuffled '.pcrc' with no filter holds just the permutation, 4
+// bytes a point, and one batch. A '.pcro' level of detail octree is built out of core, holding only as much
+// as --memory-limit allows, so it takes clouds of any size. Every other job (a .pcrz, a filtered .pcrc, or
+// one in morton-blocks or hierarchical order) decodes the whole cloud into memory, 15 bytes a point and more.
+//
+// pcr-convert [options] --out=FILE input...       all the inputs as one cloud (files, directories of tiles or
+//                                                 '.tiles' manifests, as the renderer takes them)
+// pcr-convert [options] --out-dir=DIR input...    every input file converted on its own, to DIR/<name>.<format>,
+//                                                 refusing inputs whose names would collide
+//
+//   --format=pcrc|pcrz|pcro       output format for --out-dir, --out goes by its extension (default pcrc)
+//   --order=shuffled|morton-blocks|hierarchical   fill order of a .pcrc (default shuffled), a .pcrz is always
+//                                                 in Morton order so takes no other
+//   --block-size=N                points per block for morton-blocks (default 256)
+//   --seed=N                      seed for the order, 0 draws one (default 0)
+//   --dedup                       drop points at exactly the same position as an earlier one
+//   --voxel-size=S                keep one point per voxel of side S, with the voxel's average colour
+//   --position-bits=N             quantisation of a .pcrz's positions per axis (default 16)
+//   --chunk-size=N                points per chunk of a .pcrz (default 65536)
+//   --node-capacity=N             most points an octree node holds before it splits (default 16384)
+//   --memory-limit=MB             refuse in memory jobs estimated to need more host memory than this, and size
+//                                 the chunks of an octree build to it
+//   --pipelined-io, --direct-io   read binary records through staging buffers, with O_DIRECT
+
+#include "cloud_stats.h"
+#include "octree_cloud.h"
+#include "point_cache.h"
+#include "point_filter.h"
+#include "point_order.h"
+#include "point_readers.h"
+#include "shuffle_utils.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+enum class Filter
+{
+	None,
+	Duplicates,
+	Voxels,
+};
+
+enum class Order
+{
+	Shuffled,
+	MortonBlocks,
+	Hierarchical,
+};
+
+struct ConvertOptions
+{
+	std::string out;
+	std::string outDir;
+	std::string format = "pcrc";
+	Order order = Order::Shuffled;
+	size_t blockSize = 256;
+	uint64_t seed = 0;
+	Filter filter = Filter::None;
+	float voxelSize = 0.0f;
+	chunked_cloud::write_options chunked;
+	octree_cloud::build_options octree;
+	size_t memoryLimitMb = 0; // 0 for no limit
+	point_readers::reader_options readers;
+	std::vector<std::string> inputs;
+};
+
+// A cloud to convert from one or more files into one output
+struct Job
+{
+	std::vector<std::string> inputs;
+	std::string output;
+};
+
+bool endsWith(const std::string& s, const std::string& suffix)
+{
+	return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Peak host bytes per point of a job: the packed points, plus the largest of the transient sort and order
+// arrays each step allocates alongside them (keys, indices and their radix sort scratch)
+size_t bytesPerPoint(const ConvertOptions& options, const bool chunked)
+{
+	constexpr size_t packed = 3 * sizeof(float) + 3 * sizeof(uint8_t);
+	const size_t filter = options.filter == Filter::None ? 0 : 2 * sizeof(uint64_t) + 2 * sizeof(uint32_t) + 1;
+	size_t order = sizeof(uint32_t);
+	if(chunked)
+	{
+		// the Morton sort, then the encoded chunks which are at most around the size of the packed points
+		order = 2 * sizeof(uint64_t) + 2 * sizeof(uint32_t) + packed;
+	}
+	else if(options.order != Order::Shuffled)
+	{
+		// codes, their scratch and the cell keys, sorted indices and scratch, levels, and the result
+		order = 3 * sizeof(uint64_t) + 3 * sizeof(uint32_t) + 1;
+	}
+	return packed + std::max(filter, order);
+}
+
+// 's' as a JSON string literal, quoted and escaped
+std::string jsonString(const std::string& s)
+{
+	std::string quoted = "\"";
+	for(const char c : s)
+	{
+		if(c == '"' || c == '\\')
+		{
+			quoted += '\\';
+			quoted += c;
+		}
+		else if(uint8_t(c) < 0x20)
+		{
+			char escaped[8];
+			std::snprintf(escaped, sizeof(escaped), "\\u%04x", unsigned(c));
+			quoted += escaped;
+		}
+		else
+		{
+			quoted += c;
+		}
+	}
+	return quoted + "\"";
+}
+
+template<typename T>
+void writeVec3(std::ostream& json, const T v[3])
+{
+	json << "[" << v[0] << ", " << v[1] << ", " << v[2] << "]";
+}
+
+void writeStatistics(std::ostream& json, const Job& job, const size_t total, const size_t count, const uint64_t seed,
+	const float* positions, const size_t estimatedMb, const float seconds)
+{
+	const cloud_stats::summary stats = cloud_stats::summarise(positions, count);
+	float extent[3], robustExtent[3];
+	for(size_t k = 0; k < 3; ++k)
+	{
+		extent[k] = stats.bounds_max[k] - stats.bounds_min[k];
+		robustExtent[k] = stats.robust_max[k] - stats.robust_min[k];
+	}
+
+	json << "    {\"output\": " << jsonString(job.output) << ", \"inputs\": " << job.inputs.size()
+		 << ", \"points_in\": " << total << ", \"points_removed\": " << (total - count)
+		 << ", \"points_out\": " << count << ", \"seed\": " << seed << ", \"bounds_min\": ";
+	writeVec3(json, stats.bounds_min);
+	json << ", \"bounds_max\": ";
+	writeVec3(json, stats.bounds_max);
+	json << ", \"extent\": ";
+	writeVec3(json, extent);
+	json << ", \"robust_extent\": ";
+	writeVec3(json, robustExtent);
+	json << ", \"centroid\": ";
+	writeVec3(json, stats.centroid);
+	json << ", \"spacing\": " << stats.spacing << ", \"estimated_mb\": " << estimatedMb << ", \"seconds\": " << seconds << "}";
+}
+
+// One reader over each of the set's files in turn
+point_readers::read_function readInTurn(const std::shared_ptr<point_readers::file_set>& files)
+{
+	const auto current = std::make_shared<size_t>(0);
+	return [files, current](size_t maxCount, float* positions, uint8_t* colours) {
+		for(; *current < files->readers.size(); ++*current)
+		{
+			if(const size_t n = files->readers[*current](maxCount, positions, colours))
+			{
+				return n;
+			}
+		}
+		return size_t(0);
+	};
+}
+
+// Write a shuffled cache of the job's inputs, scattering each batch as it's decoded straight to its place in
+// the output, so only the permutation and a batch are ever in memory
+bool convertStreamedCache(const Job& job, const ConvertOptions& options, const uint64_t seed, std::ostream& json)
+{
+	ply_utils::manual_timer jobTimer;
+	jobTimer.start();
+
+	std::shared_ptr<point_readers::file_set> files;
+	try
+	{
+		files = std::make_shared<point_readers::file_set>(point_readers::open_file_set(job.inputs, options.readers));
+	}
+	catch(const std::exception& e)
+	{
+		std::cerr << "can't open " << job.inputs.front() << ": " << e.what() << "\n";
+		return false;
+	}
+	const size_t total = files->total();
+	if(total > UINT32_MAX)
+	{
+		std::cerr << job.output << ": " << total << " points is more than one file can hold\n";
+		return false;
+	}
+
+	// the permutation, and a batch of packed points
+	const size_t estimatedMb = (total * sizeof(uint32_t) >> 20) + 16;
+	if(options.memoryLimitMb && estimatedMb > options.memoryLimitMb)
+	{
+		std::cerr << job.output << ": " << total << " points needs around " << estimatedMb
+				  << "mb, over the limit of " << options.memoryLimitMb << "mb\n";
+		return false;
+	}
+
+	try
+	{
+		point_cache::write_cache(job.inputs, total, readInTurn(files), job.output, seed);
+		files.reset();
+		const point_cache::mapped_cache cache = point_cache::map_cache(job.output);
+		jobTimer.stop();
+		writeStatistics(json, job, total, total, seed, cache.positions, estimatedMb, jobTimer.get() / 1000.f);
+	}
+	catch(const std::exception& e)
+	{
+		std::cerr << "can't convert to " << job.output << ": " << e.what() << "\n";
+		return false;
+	}
+	return true;
+}
+
+// Build an octree over the job's inputs, streaming them once per pass of the build. Each thread indexes one
+// chunk of the cloud at a time, so the chunk size comes from the memory limit rather than the cloud's size
+bool convertOctree(const Job& job, const ConvertOptions& options, const uint64_t seed, std::ostream& json)
+{
+	ply_utils::manual_timer jobTimer;
+	jobTimer.start();
+
+	if(options.filter != Filter::None || options.order != Order::Shuffled)
+	{
+		std::cerr << job.output << ": octree nodes are sampled on their own grids, ignoring --order, --dedup and "
+				  << "--voxel-size\n";
+	}
+
+	octree_cloud::build_options build = options.octree;
+	build.seed = seed;
+	// a chunk and its sort scratch at 32 bytes a point per thread, after the counting grid and batch buffers
+	constexpr size_t reservedMb = 256;
+	if(options.memoryLimitMb)
+	{
+		if(options.memoryLimitMb <= reservedMb)
+		{
+			std::cerr << job.output << ": an octree build needs more than " << reservedMb << "mb\n";
+			return false;
+		}
+		build.chunk_points = std::max<uint64_t>(
+			1 << 16, ((options.memoryLimitMb - reservedMb) << 20) / (32 * parallel_utils::thread_count()));
+	}
+
+	// every pass opens the files afresh and reads them one after the other
+	const auto open = [&](uint64_t& count) {
+		const auto files =
+			std::make_shared<point_readers::file_set>(point_readers::open_file_set(job.inputs, options.readers));
+		count = files->total();
+		return readInTurn(files);
+	};
+
+	try
+	{
+		octree_cloud::write_octree(job.output, open, build);
+		const octree_cloud::mapped_octree octree = octree_cloud::map_octree_file(job.output);
+		const size_t total = octree.hdr.point_count;
+		jobTimer.stop();
+		const size_t estimatedMb = reservedMb + (build.chunk_points * 32 * parallel_utils::thread_count() >> 20);
+		writeStatistics(json, job, total, total, seed, octree.positions, estimatedMb, jobTimer.get() / 1000.f);
+	}
+	catch(const std::exception& e)
+	{
+		std::cerr << "can't build " << job.output << ": " << e.what() << "\n";
+		return false;
+	}
+	return true;
+}
+
+// Run one job, appending its statistics to 'json'. Returns false, having said why, if it couldn't be done
+bool convert(const Job& job, const ConvertOptions& options, std::ostream& json)
+{
+	uint64_t seed = options.seed;
+	if(seed == 0)
+	{
+		std::random_device rd;
+		seed = (uint64_t(rd()) << 32) | rd();
+	}
+	if(endsWith(job.output, ".pcro"))
+	{
+		return convertOctree(job, options, seed, json);
+	}
+	const bool chunked = endsWith(job.output, ".pcrz");
+	if(chunked && options.order != Order::Shuffled)
+	{
+		std::cerr << job.output << ": a chunked file is always in Morton order, it can't take --order\n";
+		return false;
+	}
+	if(!chunked && options.filter == Filter::None && options.order == Order::Shuffled)
+	{
+		return convertStreamedCache(job, options, seed, json);
+	}
+
+	ply_utils::manual_timer jobTimer;
+	jobTimer.start();
+
+	point_readers::file_set files;
+	try
+	{
+		files = point_readers::open_file_set(job.inputs, options.readers);
+	}
+	catch(const std::exception& e)
+	{
+		std::cerr << "can't open " << job.inputs.front() << ": " << e.what() << "\n";
+		return false;
+	}
+	const size_t total = files.total();
+	if(total > UINT32_MAX)
+	{
+		std::cerr << job.output << ": " << total << " points is more than one file can hold\n";
+		return false;
+	}
+
+	const size_t estimatedMb = (total * bytesPerPoint(options, chunked) >> 20) + 1;
+	if(options.memoryLimitMb && estimatedMb > options.memoryLimitMb)
+	{
+		std::cerr << job.output << ": " << total << " points needs around " << estimatedMb
+				  << "mb, over the limit of " << options.memoryLimitMb << "mb\n";
+		return false;
+	}
+
+	std::vector<float> positions(3 * total);
+	std::vector<uint8_t> colours(3 * total);
+	size_t count = total;
+	try
+	{
+		point_readers::read_file_set(files, positions.data(), colours.data());
+		files = {};
+
+		if(options.filter == Filter::Duplicates)
+		{
+			count = point_filter::remove_duplicates(positions.data(), colours.data(), count);
+		}
+		else if(options.filter == Filter::Voxels)
+		{
+			count = point_filter::decimate_to_voxels(positions.data(), colours.data(), count, options.voxelSize);
+		}
+
+		if(chunked)
+		{
+			chunked_cloud::write_chunked(job.output, count, positions.data(), colours.data(), options.chunked);
+		}
+		else
+		{
+			std::vector<uint32_t> order(count);
+			uint32_t flags = options.filter == Filter::None ? 0u : uint32_t(point_cache::filtered);
+			if(options.order == Order::MortonBlocks)
+			{
+				point_order::block_shuffled_morton_order(
+					positions.data(), count, std::max<size_t>(1, options.blockSize), seed, order.data());
+				flags |= point_cache::morton_blocks;
+			}
+			else if(options.order == Order::Hierarchical)
+			{
+				point_order::hierarchical_order(positions.data(), count, seed, order.data());
+				flags |= point_cache::hierarchical;
+			}
+			else
+			{
+				shuffle_utils::random_permutation(order.data(), count, seed);
+				flags |= point_cache::shuffled;
+			}
+			point_cache::write_cache(
+				job.inputs, count, positions.data(), colours.data(), order.data(), flags, job.output, seed);
+		}
+	}
+	catch(const std::exception& e)
+	{
+		std::cerr << "can't convert to " << job.output << ": " << e.what() << "\n";
+		return false;
+	}
+
+	jobTimer.stop();
+	writeStatistics(json, job, total, count, seed, positions.data(), estimatedMb, jobTimer.get() / 1000.f);
+	return true;
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+	ConvertOptions options;
+	for(int i = 1; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+		if(arg.rfind("--out=", 0) == 0)
+		{
+			options.out = arg.substr(6);
+		}
+		else if(arg.rfind("--out-dir=", 0) == 0)
+		{
+			options.outDir = arg.substr(10);
+		}
+		else if(arg == "--format=pcrc" || arg == "--format=pcrz" || arg == "--format=pcro")
+		{
+			options.format = arg.substr(9);
+		}
+		else if(arg == "--order=shuffled")
+		{
+			options.order = Order::Shuffled;
+		}
+		else if(arg == "--order=morton-blocks")
+		{
+			options.order = Order::MortonBlocks;
+		}
+		else if(arg == "--order=hierarchical")
+		{
+			options.order = Order::Hierarchical;
+		}
+		else if(arg.rfind("--block-size=", 0) == 0)
+		{
+			options.blockSize = std::strtoull(arg.c_str() + 13, nullptr, 10);
+		}
+		else if(arg.rfind("--seed=", 0) == 0)
+		{
+			options.seed = std::strtoull(arg.c_str() + 7, nullptr, 10);
+		}
+		else if(arg == "--dedup")
+		{
+			options.filter = Filter::Duplicates;
+		}
+		else if(arg.rfind("--voxel-size=", 0) == 0)
+		{
+			options.filter = Filter::Voxels;
+			options.voxelSize = std::strtof(arg.c_str() + 13, nullptr);
+		}
+		else if(arg.rfind("--position-bits=", 0) == 0)
+		{
+			options.chunked.position_bits = std::strtoul(arg.c_str() + 16, nullptr, 10);
+		}
+		else if(arg.rfind("--chunk-size=", 0) == 0)
+		{
+			options.chunked.chunk_size = std::strtoul(arg.c_str() + 13, nullptr, 10);
+		}
+		else if(arg.rfind("--node-capacity=", 0) == 0)
+		{
+			options.octree.node_capacity = std::strtoul(arg.c_str() + 16, nullptr, 10);
+		}
+		else if(arg.rfind("--memory-limit=", 0) == 0)
+		{
+			options.memoryLimitMb = std::strtoull(arg.c_str() + 15, nullptr, 10);
+		}
+		else if(arg == "--pipelined-io")
+		{
+			options.readers.pipelined_io = true;
+		}
+		else if(arg == "--direct-io")
+		{
+			options.readers.direct_io = true;
+		}
+		else if(arg.rfind("--", 0) == 0)
+		{
+			std::cerr << "Ignoring unknown option " << arg << "\n";
+		}
+		else
+		{
+			options.inputs.push_back(arg);
+		}
+	}
+	if(options.inputs.empty() || options.out.empty() == options.outDir.empty())
+	{
+		std::cerr << "usage: pcr-convert [options] (--out=FILE | --out-dir=DIR) input...\n";
+		return 2;
+	}
+
+	std::vector<std::string> files;
+	for(const std::string& input : options.inputs)
+	{
+		const std::vector<std::string> listed = point_readers::list_point_files(input);
+		files.insert(files.end(), listed.begin(), listed.end());
+	}
+
+	std::vector<Job> jobs;
+	if(!options.out.empty())
+	{
+		jobs.push_back({files, options.out});
+	}
+	else
+	{
+		// outputs are named by the stem alone, so two inputs with the same name in different directories would
+		// overwrite each other
+		std::map<std::string, std::string> outputInputs;
+		for(const std::string& file : files)
+		{
+			const std::string name = std::filesystem::path(file).stem().string();
+			const std::string output = (std::filesystem::path(options.outDir) / (name + "." + options.format)).string();
+			const auto inserted = outputInputs.emplace(output, file);
+			if(!inserted.second)
+			{
+				std::cerr << file << " and " << inserted.first->second << " would both be converted to " << output
+						  << ", convert them in separate runs\n";
+				return 2;
+			}
+			jobs.push_back({{file}, output});
+		}
+		std::filesystem::create_directories(options.outDir);
+	}
+
+	// the loaders report as they go on std::cout, send that to stderr with everything else and keep stdout
+	// for the JSON
+	std::streambuf* const coutBuffer = std::cout.rdbuf(std::cerr.rdbuf());
+
+	std::ostringstream json;
+	json.precision(9);
+	json << "{\n  \"threads\": " << parallel_utils::thread_count() << ",\n  \"outputs\": [\n";
+	size_t failed = 0;
+	bool first = true;
+	for(const Job& job : jobs)
+	{
+		std::ostringstream entry;
+		entry.precision(9);
+		if(!convert(job, options, entry))
+		{
+			++failed;
+			continue;
+		}
+		json << (first ? "" : ",\n") << entry.str();
+		first = false;
+	}
+	json << "\n  ],\n  \"failed\": " << failed << "\n}\n";
+
+	std::cout.rdbuf(coutBuffer);
+	std::cout << json.str();
+	return failed ? 1 : 0;
+}